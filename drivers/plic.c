@@ -0,0 +1,75 @@
+#include "uros.h"
+
+// Platform-Level Interrupt Controller (QEMU virt)
+//
+// Device interrupts reach the hart as a single supervisor external
+// interrupt. The trap handler claims the pending source with the highest
+// priority, runs the handler its driver registered and writes the source
+// back to complete it, until nothing is left pending. Only hart 0's
+// S-mode context (context 1) is used; every source gets priority 1 and the
+// threshold is 0, so all enabled sources are delivered.
+
+#define PLIC_PRIORITY(irq) (PLIC_BASE + 4 * (u64)(irq))
+#define PLIC_SENABLE       (PLIC_BASE + 0x2080)   // Context 1 enable bits
+#define PLIC_STHRESHOLD    (PLIC_BASE + 0x201000) // Context 1 threshold
+#define PLIC_SCLAIM        (PLIC_BASE + 0x201004) // Context 1 claim/complete
+
+typedef struct {
+  void (*fn)(void *);
+  void *arg;
+} plic_handler_t;
+
+static plic_handler_t handlers[PLIC_MAX_IRQ];
+static u64 irq_count = 0;
+static u64 spurious_count = 0; // Claimed sources nobody registered
+
+static inline u32 plic_read(u64 addr) { return *(volatile u32 *)addr; }
+
+static inline void plic_write(u64 addr, u32 value) {
+  *(volatile u32 *)addr = value;
+}
+
+void plic_init(void) {
+  plic_write(PLIC_STHRESHOLD, 0);
+
+  // Enable SEIE in sie (bit 9); nothing arrives until a source is enabled
+  u64 sie_val = (1UL << 9);
+  __asm__ volatile("csrs sie, %0" ::"r"(sie_val));
+}
+
+// Route source 'irq' to fn(arg), called from the trap with IRQs off.
+// Returns -1 for a source number the table cannot hold.
+int plic_register(int irq, void (*fn)(void *), void *arg) {
+  if (irq <= 0 || irq >= PLIC_MAX_IRQ) {
+    return -1;
+  }
+
+  irqflags_t flags = irq_save();
+  handlers[irq].fn = fn;
+  handlers[irq].arg = arg;
+  plic_write(PLIC_PRIORITY(irq), 1);
+  u64 enable = PLIC_SENABLE + 4 * (u64)(irq / 32);
+  plic_write(enable, plic_read(enable) | (1U << (irq % 32)));
+  irq_restore(flags);
+  return 0;
+}
+
+// Supervisor external interrupt, from trap_handler_c
+void plic_handle(void) {
+  u32 irq;
+
+  while ((irq = plic_read(PLIC_SCLAIM)) != 0) {
+    irq_count++;
+    if (irq < PLIC_MAX_IRQ && handlers[irq].fn) {
+      handlers[irq].fn(handlers[irq].arg);
+    } else {
+      spurious_count++;
+    }
+    plic_write(PLIC_SCLAIM, irq);
+  }
+}
+
+void plic_stats(u64 *irqs, u64 *spurious) {
+  *irqs = irq_count;
+  *spurious = spurious_count;
+}
@@ -0,0 +1,37 @@
+#include "uros.h"
+
+// RAM disk
+//
+// CONFIG_RAMDISK_SIZE bytes of kernel memory behind the block device
+// interface, so the buffer cache can be used without a virtio disk.
+// Requests complete inside submit: the data is copied, the status set and
+// the done hook called before ramdisk_submit returns.
+
+static u8 ram[CONFIG_RAMDISK_SIZE] __attribute__((aligned(CACHE_LINE_SIZE)));
+
+static int ramdisk_submit(blk_req_t *r) {
+  u64 sectors = CONFIG_RAMDISK_SIZE / BLK_SECTOR_SIZE;
+  if (r->count == 0 || r->sector >= sectors || r->count > sectors - r->sector) {
+    return -1;
+  }
+
+  u8 *p = ram + r->sector * BLK_SECTOR_SIZE;
+  size_t len = (size_t)r->count * BLK_SECTOR_SIZE;
+  if (r->write) {
+    memcpy(p, r->buf, len);
+  } else {
+    memcpy(r->buf, p, len);
+  }
+
+  r->status = BLK_OK;
+  if (r->done) {
+    r->done(r);
+  }
+  return 0;
+}
+
+// Registers the RAM disk; returns its device number
+int ramdisk_init(void) {
+  return blkdev_register("ram0", CONFIG_RAMDISK_SIZE / BLK_SECTOR_SIZE,
+                         ramdisk_submit, (void (*)(void))0);
+}
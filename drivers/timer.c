@@ -4,8 +4,7 @@
 #define SBI_EID_TIME 0x54494D45
 #define SBI_FID_SET_TIMER 0
 
-#define TIMER_TIMEBASE_HZ 10000000UL
-#define TIMER_DELTA_CYCLES (TIMER_TIMEBASE_HZ / TICK_HZ)
+#define TIMER_DELTA_CYCLES (TIMEBASE_HZ / TICK_HZ)
 
 static u64 tick_delta = TIMER_DELTA_CYCLES;
 
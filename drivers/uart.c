@@ -57,8 +57,8 @@ int uart_getc(void) {
 int uart_getc_blocking(void) {
   int ch;
   while ((ch = uart_getc()) < 0) {
-    // Yield to let other tasks run while waiting for input
-    task_yield();
+    // Sleep until the next tick so other tasks can run while we wait
+    task_sleep(1);
   }
   return ch;
 }
@@ -0,0 +1,527 @@
+#include "uros.h"
+
+// virtio-blk over virtio-mmio, with one split virtqueue
+//
+// Requests are asynchronous. blk_submit only puts a request on the
+// pending list; the list goes to the device when blk_unplug runs, when a
+// task has to wait for one of its requests, or once CONFIG_BLK_MAX_MERGE
+// requests are pending. On the way out, requests for consecutive sectors
+// in the same direction are merged into one device request: one header
+// descriptor, one data descriptor per request and one status descriptor.
+// A batch costs a single QueueNotify, however many device requests it
+// holds.
+//
+// The device signals completion through its PLIC source. The interrupt
+// handler only acknowledges it and raises a softirq, which walks the used
+// ring, sets each request's status, wakes the task sleeping in blk_wait
+// and calls the request's 'done' hook. Freed descriptors let any requests
+// that did not fit go out at the same time.
+//
+// Both the version 2 (virtio 1.x) transport and the legacy version 1 one
+// QEMU uses by default are supported. The rings sit in one static block
+// laid out the way the legacy transport wants it, with the used ring on
+// its own page; the modern transport is just given the three addresses.
+// There is no MMU, so buffer addresses go to the device as they are.
+
+// virtio-mmio registers
+#define VIO_MAGIC         0x000
+#define VIO_VERSION       0x004
+#define VIO_DEVICE_ID     0x008
+#define VIO_DEV_FEATURES  0x010
+#define VIO_DEV_FEAT_SEL  0x014
+#define VIO_DRV_FEATURES  0x020
+#define VIO_DRV_FEAT_SEL  0x024
+#define VIO_GUEST_PAGE    0x028 // Legacy only
+#define VIO_QUEUE_SEL     0x030
+#define VIO_QUEUE_NUM_MAX 0x034
+#define VIO_QUEUE_NUM     0x038
+#define VIO_QUEUE_ALIGN   0x03c // Legacy only
+#define VIO_QUEUE_PFN     0x040 // Legacy only
+#define VIO_QUEUE_READY   0x044
+#define VIO_QUEUE_NOTIFY  0x050
+#define VIO_INT_STATUS    0x060
+#define VIO_INT_ACK       0x064
+#define VIO_STATUS        0x070
+#define VIO_QUEUE_DESC    0x080 // Low word, high word at +4
+#define VIO_QUEUE_DRIVER  0x090
+#define VIO_QUEUE_DEVICE  0x0a0
+#define VIO_CONFIG        0x100 // virtio_blk_config: capacity first
+
+#define VIO_MAGIC_VALUE   0x74726976 // "virt"
+#define VIO_ID_BLOCK      2
+
+// Device status bits
+#define VIO_S_ACKNOWLEDGE 1
+#define VIO_S_DRIVER      2
+#define VIO_S_DRIVER_OK   4
+#define VIO_S_FEATURES_OK 8
+
+#define VIO_F_VERSION_1   32 // Feature bit, in the high word
+#define VIO_BLK_F_RO      5
+
+#define VIRTQ_DESC_F_NEXT  1
+#define VIRTQ_DESC_F_WRITE 2 // Device writes the buffer
+
+#define VIO_BLK_T_IN  0
+#define VIO_BLK_T_OUT 1
+
+#define QSIZE CONFIG_VIRTIO_BLK_QUEUE
+#define VQ_PAGE 4096
+
+struct virtq_desc {
+  u64 addr;
+  u32 len;
+  u16 flags;
+  u16 next;
+};
+
+struct virtq_avail {
+  u16 flags;
+  u16 idx;
+  u16 ring[QSIZE];
+};
+
+struct virtq_used_elem {
+  u32 id;
+  u32 len;
+};
+
+struct virtq_used {
+  u16 flags;
+  u16 idx;
+  struct virtq_used_elem ring[QSIZE];
+};
+
+struct virtio_blk_outhdr {
+  u32 type;
+  u32 reserved;
+  u64 sector;
+};
+
+// In-flight device request, indexed by its head descriptor
+typedef struct {
+  struct virtio_blk_outhdr hdr;
+  blk_req_t *reqs; // The merged requests, in sector order
+  volatile u8 status;
+} blk_slot_t;
+
+// Descriptor table and avail ring on the first page, used ring on the next
+static u8 vq_mem[2 * VQ_PAGE] __attribute__((aligned(VQ_PAGE)));
+static struct virtq_desc *const desc = (struct virtq_desc *)vq_mem;
+static struct virtq_avail *avail; // Right after the qsize descriptors in use
+static struct virtq_used *const used = (struct virtq_used *)(vq_mem + VQ_PAGE);
+
+static blk_slot_t slots[QSIZE];
+
+static blk_info_t dev;
+static u32 qsize;
+static u16 free_head; // Free descriptors, linked through next
+static u32 nfree;
+static u16 last_used; // Next used ring entry to look at
+static u32 inflight;  // Device requests
+
+static blk_req_t *pend_head; // Submitted, not yet given to the device
+static blk_req_t *pend_tail;
+static u32 npend;
+
+static int merge_enabled = 1;
+static blk_stats_t stats;
+static work_t complete_work;
+
+static inline u32 vio_read(u32 off) {
+  return *(volatile u32 *)(dev.base + off);
+}
+
+static inline void vio_write(u32 off, u32 value) {
+  *(volatile u32 *)(dev.base + off) = value;
+}
+
+static inline void vio_write64(u32 off, u64 value) {
+  vio_write(off, (u32)value);
+  vio_write(off + 4, (u32)(value >> 32));
+}
+
+static inline void fence(void) {
+  __asm__ volatile("fence rw, rw" ::: "memory");
+}
+
+static u16 desc_alloc(void) {
+  u16 d = free_head;
+  free_head = desc[d].next;
+  nfree--;
+  return d;
+}
+
+static void desc_free_chain(u16 d) {
+  while (1) {
+    u16 flags = desc[d].flags;
+    u16 next = desc[d].next;
+    desc[d].next = free_head;
+    free_head = d;
+    nfree++;
+    if (!(flags & VIRTQ_DESC_F_NEXT)) {
+      break;
+    }
+    d = next;
+  }
+}
+
+// Unlink the first pending request in the given direction that extends
+// the sectors [start, end) at either end
+static blk_req_t *pend_take_adjacent(int write, u64 start, u64 end) {
+  blk_req_t *prev = (blk_req_t *)0;
+
+  for (blk_req_t *r = pend_head; r; prev = r, r = r->next) {
+    if (r->write != write ||
+        (r->sector != end && r->sector + r->count != start)) {
+      continue;
+    }
+    if (prev) {
+      prev->next = r->next;
+    } else {
+      pend_head = r->next;
+    }
+    if (pend_tail == r) {
+      pend_tail = prev;
+    }
+    npend--;
+    r->next = (blk_req_t *)0;
+    return r;
+  }
+  return (blk_req_t *)0;
+}
+
+// Build one device request from the head of the pending list plus
+// whatever extends it, and make it available. IRQs off; needs three free
+// descriptors.
+static void issue_one(void) {
+  blk_req_t *first = pend_head;
+  pend_head = first->next;
+  if (!pend_head) {
+    pend_tail = (blk_req_t *)0;
+  }
+  npend--;
+  first->next = (blk_req_t *)0;
+
+  // Grow the group at both ends while descriptors and the limit allow
+  blk_req_t *group = first;
+  blk_req_t *last = first;
+  u64 start = first->sector;
+  u64 end = first->sector + first->count;
+  u32 nreq = 1;
+  u32 max = nfree - 2;
+  if (max > CONFIG_BLK_MAX_MERGE) {
+    max = CONFIG_BLK_MAX_MERGE;
+  }
+  if (!merge_enabled) {
+    max = 1;
+  }
+  while (nreq < max) {
+    blk_req_t *r = pend_take_adjacent(first->write, start, end);
+    if (!r) {
+      break;
+    }
+    if (r->sector == end) {
+      last->next = r;
+      last = r;
+      end += r->count;
+    } else {
+      r->next = group;
+      group = r;
+      start = r->sector;
+    }
+    nreq++;
+  }
+  stats.merged += nreq - 1;
+
+  u16 head = desc_alloc();
+  blk_slot_t *slot = &slots[head];
+  slot->hdr.type = first->write ? VIO_BLK_T_OUT : VIO_BLK_T_IN;
+  slot->hdr.reserved = 0;
+  slot->hdr.sector = start;
+  slot->reqs = group;
+  slot->status = 0xff;
+
+  desc[head].addr = (u64)&slot->hdr;
+  desc[head].len = sizeof(slot->hdr);
+  desc[head].flags = VIRTQ_DESC_F_NEXT;
+
+  u16 prev = head;
+  for (blk_req_t *r = group; r; r = r->next) {
+    u16 d = desc_alloc();
+    desc[d].addr = (u64)r->buf;
+    desc[d].len = r->count * BLK_SECTOR_SIZE;
+    desc[d].flags = VIRTQ_DESC_F_NEXT | (r->write ? 0 : VIRTQ_DESC_F_WRITE);
+    desc[prev].next = d;
+    prev = d;
+  }
+
+  u16 st = desc_alloc();
+  desc[st].addr = (u64)&slot->status;
+  desc[st].len = 1;
+  desc[st].flags = VIRTQ_DESC_F_WRITE;
+  desc[prev].next = st;
+
+  avail->ring[avail->idx % qsize] = head;
+  fence();
+  avail->idx++;
+
+  stats.dev_reqs++;
+  inflight++;
+  if (inflight > stats.max_inflight) {
+    stats.max_inflight = inflight;
+  }
+}
+
+// Hand pending requests to the device, as many as there are descriptors
+// for, then notify it once. IRQs off.
+static void unplug_locked(void) {
+  int issued = 0;
+
+  while (pend_head && nfree >= 3) {
+    issue_one();
+    issued = 1;
+  }
+  if (issued) {
+    fence();
+    vio_write(VIO_QUEUE_NOTIFY, 0);
+    stats.notifies++;
+  }
+}
+
+// Reap the used ring. Runs as a softirq, or inline from the interrupt
+// with deferral off.
+static void blk_complete(void *arg) {
+  (void)arg;
+  irqflags_t flags = irq_save();
+
+  while (last_used != *(volatile u16 *)&used->idx) {
+    fence();
+    u16 head = (u16)used->ring[last_used % qsize].id;
+    blk_slot_t *slot = &slots[head];
+    int status = slot->status == 0 ? BLK_OK : BLK_EIO;
+
+    blk_req_t *r = slot->reqs;
+    slot->reqs = (blk_req_t *)0;
+    while (r) {
+      // The owner may reuse the request as soon as it sees the status
+      blk_req_t *next = r->next;
+      if (status != BLK_OK) {
+        stats.errors++;
+      }
+      r->status = status;
+      sched_wake_all(&r->wq);
+      // Last, since the hook may free the request
+      if (r->done) {
+        r->done(r);
+      }
+      r = next;
+    }
+
+    desc_free_chain(head);
+    inflight--;
+    last_used++;
+  }
+
+  unplug_locked();
+  irq_restore(flags);
+}
+
+static void blk_irq(void *arg) {
+  (void)arg;
+
+  vio_write(VIO_INT_ACK, vio_read(VIO_INT_STATUS) & 0x3);
+  stats.irqs++;
+  if (softirq_get_defer()) {
+    softirq_raise(&complete_work);
+  } else {
+    blk_complete((void *)0);
+  }
+}
+
+// Feature negotiation and queue setup; returns -1 if the device refuses
+static int blk_setup(void) {
+  vio_write(VIO_STATUS, 0);
+  vio_write(VIO_STATUS, VIO_S_ACKNOWLEDGE);
+  vio_write(VIO_STATUS, VIO_S_ACKNOWLEDGE | VIO_S_DRIVER);
+
+  // Only the read-only flag is of interest; VERSION_1 is mandatory
+  // for the modern transport
+  vio_write(VIO_DEV_FEAT_SEL, 0);
+  u32 features = vio_read(VIO_DEV_FEATURES) & (1U << VIO_BLK_F_RO);
+  dev.readonly = features != 0;
+  vio_write(VIO_DRV_FEAT_SEL, 0);
+  vio_write(VIO_DRV_FEATURES, features);
+
+  u32 status = VIO_S_ACKNOWLEDGE | VIO_S_DRIVER;
+  if (!dev.legacy) {
+    vio_write(VIO_DEV_FEAT_SEL, 1);
+    if (!(vio_read(VIO_DEV_FEATURES) & (1U << (VIO_F_VERSION_1 - 32)))) {
+      return -1;
+    }
+    vio_write(VIO_DRV_FEAT_SEL, 1);
+    vio_write(VIO_DRV_FEATURES, 1U << (VIO_F_VERSION_1 - 32));
+
+    status |= VIO_S_FEATURES_OK;
+    vio_write(VIO_STATUS, status);
+    if (!(vio_read(VIO_STATUS) & VIO_S_FEATURES_OK)) {
+      return -1;
+    }
+  }
+
+  if (dev.legacy) {
+    vio_write(VIO_GUEST_PAGE, VQ_PAGE);
+  }
+
+  vio_write(VIO_QUEUE_SEL, 0);
+  u32 max = vio_read(VIO_QUEUE_NUM_MAX);
+  if (max == 0) {
+    return -1;
+  }
+  qsize = max < QSIZE ? max : QSIZE;
+  vio_write(VIO_QUEUE_NUM, qsize);
+  avail = (struct virtq_avail *)(vq_mem + qsize * sizeof(struct virtq_desc));
+
+  if (dev.legacy) {
+    vio_write(VIO_QUEUE_ALIGN, VQ_PAGE);
+    vio_write(VIO_QUEUE_PFN, (u32)((u64)vq_mem / VQ_PAGE));
+  } else {
+    vio_write64(VIO_QUEUE_DESC, (u64)desc);
+    vio_write64(VIO_QUEUE_DRIVER, (u64)avail);
+    vio_write64(VIO_QUEUE_DEVICE, (u64)used);
+    vio_write(VIO_QUEUE_READY, 1);
+  }
+
+  dev.capacity = (u64)vio_read(VIO_CONFIG) |
+                 ((u64)vio_read(VIO_CONFIG + 4) << 32);
+  vio_write(VIO_STATUS, status | VIO_S_DRIVER_OK);
+  return 0;
+}
+
+// Probe the virtio-mmio slots for a block device. Returns -1 if there is
+// none, which leaves every blk_* call failing.
+int blk_init(void) {
+  for (int i = 0; i < VIRTIO_MMIO_SLOTS; i++) {
+    dev.base = VIRTIO_MMIO_BASE + (u64)i * VIRTIO_MMIO_STRIDE;
+    if (vio_read(VIO_MAGIC) != VIO_MAGIC_VALUE ||
+        vio_read(VIO_DEVICE_ID) != VIO_ID_BLOCK) {
+      continue;
+    }
+    u32 version = vio_read(VIO_VERSION);
+    if (version != 1 && version != 2) {
+      continue;
+    }
+
+    dev.legacy = version == 1;
+    dev.irq = VIRTIO_MMIO_IRQ + i;
+    memset(vq_mem, 0, sizeof(vq_mem));
+    if (blk_setup() < 0) {
+      vio_write(VIO_STATUS, 0x80); // FAILED
+      continue;
+    }
+
+    for (u32 d = 0; d < qsize; d++) {
+      desc[d].next = (u16)(d + 1);
+    }
+    free_head = 0;
+    nfree = qsize;
+    dev.queue_size = qsize;
+    dev.present = 1;
+
+    work_init(&complete_work, blk_complete, (void *)0);
+    plic_register(dev.irq, blk_irq, (void *)0);
+    return 0;
+  }
+
+  dev.base = 0;
+  return -1;
+}
+
+void blk_req_init(blk_req_t *r, int write, u64 sector, u32 count, void *buf) {
+  r->sector = sector;
+  r->count = count;
+  r->write = write;
+  r->buf = buf;
+  r->status = BLK_OK;
+  r->done = (void (*)(blk_req_t *))0;
+  r->arg = (void *)0;
+  wq_init(&r->wq);
+  r->next = (blk_req_t *)0;
+}
+
+// Queue a request. Returns -1 without queueing it if there is no disk or
+// the request is out of range or writes a read-only disk.
+int blk_submit(blk_req_t *r) {
+  if (!dev.present || r->count == 0 || r->sector >= dev.capacity ||
+      r->count > dev.capacity - r->sector || (r->write && dev.readonly)) {
+    return -1;
+  }
+
+  irqflags_t flags = irq_save();
+  r->status = BLK_PENDING;
+  r->next = (blk_req_t *)0;
+  if (pend_tail) {
+    pend_tail->next = r;
+  } else {
+    pend_head = r;
+  }
+  pend_tail = r;
+  npend++;
+  stats.submitted++;
+  if (npend >= CONFIG_BLK_MAX_MERGE) {
+    unplug_locked();
+  }
+  irq_restore(flags);
+  return 0;
+}
+
+void blk_unplug(void) {
+  irqflags_t flags = irq_save();
+  unplug_locked();
+  irq_restore(flags);
+}
+
+// Sleep until the request completes; returns its status. Whatever is
+// still pending goes to the device first.
+int blk_wait(blk_req_t *r) {
+  irqflags_t flags = irq_save();
+
+  if (r->status == BLK_PENDING) {
+    unplug_locked();
+  }
+  while (r->status == BLK_PENDING) {
+    sched_block(&r->wq, flags);
+  }
+
+  irq_restore(flags);
+  return r->status;
+}
+
+// Synchronous read or write. The request, with its status and wait
+// queue, is on the heap, so the pending list and descriptor slots never
+// link into the caller's frame. 'buf' often is on the caller's stack;
+// that is safe only because blk_rw cannot return before completion and
+// task_kill refuses a task blocked here.
+int blk_rw(int write, u64 sector, u32 count, void *buf) {
+  blk_req_t *r = (blk_req_t *)kmalloc(sizeof(blk_req_t));
+  if (!r) {
+    return BLK_EIO;
+  }
+
+  blk_req_init(r, write, sector, count, buf);
+  int status = blk_submit(r) < 0 ? BLK_EIO : blk_wait(r);
+  kfree(r);
+  return status;
+}
+
+void blk_info(blk_info_t *info) { *info = dev; }
+
+void blk_stats(blk_stats_t *st) {
+  irqflags_t flags = irq_save();
+  *st = stats;
+  irq_restore(flags);
+}
+
+void blk_set_merge(int on) { merge_enabled = on ? 1 : 0; }
+
+int blk_get_merge(void) { return merge_enabled; }
@@ -5,3 +5,49 @@
 // Set to 0 for cooperative scheduling (manual yield points)
 #define CONFIG_PREEMPT_DEFAULT 0
 
+
+// Kernel heap size in bytes. PCBs and task stacks come from here, so this
+// bounds how many tasks can exist at once (each costs about 9 KB).
+#define CONFIG_HEAP_SIZE (48 * 1024 * 1024)
+
+// Size of the chunks a task's arena takes from the heap; bigger requests
+// get a chunk of their own
+#ifndef CONFIG_ARENA_CHUNK_SIZE
+#define CONFIG_ARENA_CHUNK_SIZE 4096
+#endif
+
+// virtio-blk virtqueue size (descriptors). A device request takes one
+// descriptor per merged request plus two, so this bounds what can be in
+// flight. At most 227 so the descriptor table and avail ring share a page.
+#ifndef CONFIG_VIRTIO_BLK_QUEUE
+#define CONFIG_VIRTIO_BLK_QUEUE 64
+#endif
+
+// Most requests merged into one device request
+#ifndef CONFIG_BLK_MAX_MERGE
+#define CONFIG_BLK_MAX_MERGE 16
+#endif
+
+// Buffer cache: number of 4 KB buffers, flusher period in ticks, and the
+// largest read-ahead window in blocks
+#ifndef CONFIG_BCACHE_BUFS
+#define CONFIG_BCACHE_BUFS 128
+#endif
+#ifndef CONFIG_BCACHE_FLUSH_TICKS
+#define CONFIG_BCACHE_FLUSH_TICKS 100
+#endif
+#ifndef CONFIG_BCACHE_RA_MAX
+#define CONFIG_BCACHE_RA_MAX 32
+#endif
+
+// Size of the built-in RAM disk (block device 0)
+#ifndef CONFIG_RAMDISK_SIZE
+#define CONFIG_RAMDISK_SIZE (4 * 1024 * 1024)
+#endif
+
+// Set to 1 to time every IRQ-off region and record where it started
+// (shell command irqsoff). Costs two rdtime reads per region.
+// Usually set from the command line: make IRQSOFF_TRACE=1
+#ifndef CONFIG_IRQSOFF_TRACE
+#define CONFIG_IRQSOFF_TRACE 0
+#endif
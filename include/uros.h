@@ -12,11 +12,73 @@ typedef unsigned long size_t;
 
 // Constants
 #define UART_BASE       0x10000000
+#define PLIC_BASE       0x0c000000UL
+#define PLIC_MAX_IRQ    64
+#define VIRTIO_MMIO_BASE   0x10001000UL // Slot i at BASE + i * STRIDE
+#define VIRTIO_MMIO_STRIDE 0x1000
+#define VIRTIO_MMIO_SLOTS  8
+#define VIRTIO_MMIO_IRQ    1            // Slot i raises PLIC source 1 + i
+#define TIMEBASE_HZ     10000000UL
 #define TICK_HZ         100
 #define RR_QUANTUM      5
-#define STACK_SIZE      8192
-#define MAX_TASKS       32
-#define HEAP_SIZE       (256 * 1024)
+#define STACK_SIZE      8192 // Default task stack
+#define STACK_MIN       1024
+#define HEAP_SIZE       CONFIG_HEAP_SIZE
+#define CACHE_LINE_SIZE 64
+
+// PID = generation << PID_SLOT_BITS | slot; MAX_TASKS must be 1 << bits
+#define PID_SLOT_BITS   13
+#define MAX_TASKS       (1 << PID_SLOT_BITS)
+#define PID_SLOT(pid)   ((pid) & (MAX_TASKS - 1))
+#define PID_GEN_MASK    ((1U << (31 - PID_SLOT_BITS)) - 1)
+#define REPLAY_MAX_TASKS 24
+
+// MLFQ: level 0 is the highest priority, quantum doubles per level
+#define MLFQ_LEVELS         8
+#define MLFQ_BASE_QUANTUM   2
+#define MLFQ_BOOST_TICKS    100
+
+// Fair scheduler tuning
+#define FAIR_NICE_0_WEIGHT        1024
+#define FAIR_MIN_GRANULARITY_US   20000  // Shortest slice before preemption
+#define FAIR_SLEEPER_CREDIT_US    10000  // Head start given to woken tasks
+
+// Burst estimation: estimates are kept in 1/1024 tick internally and
+// updated with τ_new = α * burst + (1-α) * τ_old, α in percent
+#define BURST_FP_SHIFT        10
+#define BURST_ALPHA_DEFAULT   50
+
+// Timer wheel: KTIMER_LEVELS levels of 2^KTIMER_SLOT_BITS slots each
+#define KTIMER_SLOT_BITS  6
+#define KTIMER_SLOTS      (1 << KTIMER_SLOT_BITS)
+#define KTIMER_LEVELS     4
+
+// EDF admission control: utilization is fixed point, EDF_UTIL_ONE = 100%
+#define EDF_UTIL_ONE    (1UL << 20)
+
+#define container_of(ptr, type, member) \
+    ((type *)((u8 *)(ptr) - __builtin_offsetof(type, member)))
+
+// Intrusive red-black tree (lib/rbtree.c)
+typedef struct rb_node {
+    struct rb_node *parent;
+    struct rb_node *left;
+    struct rb_node *right;
+    int color;
+} rb_node_t;
+
+typedef struct {
+    rb_node_t *root;
+    rb_node_t *leftmost;  // Cached minimum
+} rb_root_t;
+
+void rb_init(rb_root_t *root);
+void rb_insert(rb_root_t *root, rb_node_t *node,
+               int (*less)(const rb_node_t *, const rb_node_t *));
+void rb_erase(rb_root_t *root, rb_node_t *node);
+rb_node_t *rb_next(rb_node_t *node);
+
+static inline rb_node_t *rb_first(rb_root_t *root) { return root->leftmost; }
 
 // Task states
 typedef enum {
@@ -30,9 +92,30 @@ typedef enum {
 // Scheduler modes
 typedef enum {
     SCHED_RR = 0,
-    SCHED_SJF
+    SCHED_SJF,
+    SCHED_MLFQ,
+    SCHED_FAIR,
+    SCHED_EDF,
+    SCHED_SRTF,
+    SCHED_NR_MODES
 } sched_mode_t;
 
+// Load averages: run queue length (plus the running task) sampled every
+// LOAD_FREQ ticks and decayed over 1, 5 and 15 seconds, in fixed point
+#define LOAD_FREQ    (TICK_HZ / 10)
+#define LOAD_FSHIFT  11
+#define LOAD_FIXED_1 (1 << LOAD_FSHIFT)
+
+// Ready-to-running latency histogram: bucket 0 is under 1 us, bucket b
+// covers [2^(b-1), 2^b) us and the last one everything above
+#define SCHEDLAT_BUCKETS 20
+
+typedef struct {
+    u64 count;
+    u64 max;              // rdtime cycles
+    u32 hist[SCHEDLAT_BUCKETS];
+} schedlat_t;
+
 // Context structure - offsets must match boot/start.S exactly
 // Total size: 34 * 8 = 272 bytes
 typedef struct {
@@ -71,36 +154,214 @@ typedef struct {
     u64 sepc;         // offset 256
 } context_t;
 
-// Process Control Block
+// Kernel timer (kernel/ktimer.c). Storage belongs to the caller.
+typedef struct ktimer {
+    struct ktimer *next;
+    struct ktimer **pprev;  // Link that points at this timer
+    u64 expires;            // Tick to fire on
+    void (*fn)(void *);
+    void *arg;
+    int pending;
+} ktimer_t;
+
+// Per-task bump arena (kernel/arena.c). Only the owning task touches it.
+typedef struct arena_chunk {
+    struct arena_chunk *prev; // Chunk filled before this one
+    size_t size;              // Usable bytes after this header
+} arena_chunk_t;
+
+typedef struct {
+    arena_chunk_t *chunk;     // Chunk being carved, NULL before the first
+    u8 *cur;                  // Next free byte in it
+    u8 *end;
+} arena_t;
+
+// Position to roll the current task's arena back to
 typedef struct {
+    arena_chunk_t *chunk;
+    u8 *cur;
+} arena_mark_t;
+
+// FIFO of tasks blocked on an event, linked through pcb_t.wq_next
+typedef struct wait_queue {
+    struct pcb *head;
+    struct pcb *tail;
+} wait_queue_t;
+
+// Process Control Block
+//
+// The first cache line holds everything a run-queue scan or pick reads
+// (queue link, burst key and tie-break, CPU accounting, pid/state). The
+// saved context and the per-policy and statistics fields live in the
+// cold lines after it, so scanning a queue costs one line per task.
+typedef struct pcb {
+    // Hot: exactly one cache line
+    struct pcb *rq_next;  // Link in the RR/SJF queue or an MLFQ level list
+    u64 burst_avg;        // Exponential average, 1/1024 tick
+    u64 burst_start;      // sum_exec when the current CPU burst began
+    u64 sum_exec;         // Total CPU time (rdtime cycles)
+    u64 exec_start;       // When the task last started running
+    u64 arrival_time;
     int pid;
     task_state_t state;
-    context_t context;
-    void *stack_base;
+    u32 dl_period;        // 0 for tasks without real-time parameters
+    int mlfq_level;
+
+    // Cold: saved registers, touched only when switching to or from it
+    context_t context __attribute__((aligned(CACHE_LINE_SIZE)));
+    void *stack_base;     // Lowest address; holds the overflow canary
+    u32 stack_size;
+    u32 stack_hwm;        // Deepest use measured so far, bytes
     void (*entry)(void *);
     void *arg;
+
+    // Statistics
     u64 ticks_used;
     int burst_hint;
-    u64 burst_estimate;
-    u64 arrival_time;
+    u64 burst_estimate;   // Ticks, rounded from burst_avg
+    u64 burst_err;        // Sum of |estimate - actual| over bursts
+    u32 burst_count;
     u64 start_time;
     u64 finish_time;
     u64 wait_time;
-} pcb_t;
+    u64 ready_stamp;      // rdtime() when last made ready, 0 once running
+    schedlat_t lat;       // Every ready -> running delay
+    u64 sum_wait;         // Total time spent ready in a queue (cycles)
+    u32 nr_switches;      // Times switched in
+
+    // Counters at the last top refresh
+    u64 top_exec;
+    u64 top_wait;
+    u32 top_switches;
+
+    // MLFQ state
+    int mlfq_allot;       // Ticks left before demotion
+    u32 mlfq_epoch;       // Boost epoch the level was assigned in
+
+    // Fair scheduling
+    u64 vruntime;         // Weighted CPU time
+    rb_node_t fair_node;
+    int nice;
+    u32 weight;
+
+    // Periodic real-time parameters
+    u32 dl_runtime;       // Budget per period, in ticks
+    u32 dl_deadline;      // Relative to each release
+    u64 dl_util;          // Admitted utilization
+    u64 dl_release;       // Release tick of the current job
+    u64 dl_abs_deadline;
+    int dl_budget;        // Ticks left in the current job
+    int dl_throttled;     // Budget ran out, wait for the next release
+    int dl_wait_release;  // Sleeping until dl_release
+    int dl_missed;        // Current job already counted as a miss
+    u32 dl_jobs;
+    u32 dl_misses;
+    rb_node_t dl_node;
+
+    // Sleep
+    ktimer_t sleep_timer;
+    u64 wake_stamp;       // rdtime() when woken
+
+    // Blocking, exit and join
+    wait_queue_t *wq;     // Wait queue this task is blocked on, if any
+    struct pcb *wq_next;
+    wait_queue_t joiners; // Tasks waiting in task_join for this one
+    int joining;          // Blocked in task_waitpid: safe to kill
+    int exit_status;
+    int detached;         // Freed automatically when it exits
+    int kthread;          // Idle or worker: never queued, cannot be killed
+    arena_t arena;        // Freed as a whole when the task exits
+
+    // Priority inheritance: while boosted the task runs with a mutex
+    // waiter's scheduling keys, and its own are kept here
+    struct mutex *pi_blocked_on; // Mutex it is sleeping on
+    struct mutex *pi_held;       // Mutexes it holds, through held_next
+    int pi_boosted;
+    u64 pi_burst_avg;
+    int pi_mlfq_level;
+    u32 pi_mlfq_epoch;
+    u64 pi_deadline;
+} __attribute__((aligned(CACHE_LINE_SIZE))) pcb_t;
+
+_Static_assert(__builtin_offsetof(pcb_t, context) == CACHE_LINE_SIZE,
+               "pcb_t hot fields must fit in the first cache line");
 
 // Global tick counter
 extern volatile u64 g_ticks;
 extern volatile int need_resched;
 
-// IRQ helpers
-static inline void disable_irq(void) {
-    __asm__ volatile("csrci sstatus, 2"); // clear SIE bit (bit 1)
+// IRQ helpers. irq_save() disables interrupts and returns the previous
+// state; irq_restore() puts it back, so sections nest and an inner one
+// never turns interrupts on inside an outer one.
+#define SSTATUS_SIE (1UL << 1)
+#define SSTATUS_VS (3UL << 9)          // Vector unit state, 0 is off
+#define SSTATUS_VS_INITIAL (1UL << 9)
+
+typedef u64 irqflags_t;
+
+#if CONFIG_IRQSOFF_TRACE
+void irqsoff_begin(const char *func, int line);
+void irqsoff_end(void);
+#define irq_save() irq_save_at(__func__, __LINE__)
+#else
+#define irq_save() irq_save_at((const char *)0, 0)
+#endif
+
+static inline irqflags_t irq_save_at(const char *func, int line) {
+    irqflags_t flags;
+    __asm__ volatile("csrrci %0, sstatus, 2" : "=r"(flags) : : "memory");
+    flags &= SSTATUS_SIE;
+#if CONFIG_IRQSOFF_TRACE
+    if (flags) {
+        irqsoff_begin(func, line);
+    }
+#else
+    (void)func;
+    (void)line;
+#endif
+    return flags;
 }
 
-static inline void enable_irq(void) {
-    __asm__ volatile("csrsi sstatus, 2"); // set SIE bit (bit 1)
+static inline void irq_restore(irqflags_t flags) {
+    if (flags) {
+#if CONFIG_IRQSOFF_TRACE
+        irqsoff_end();
+#endif
+        __asm__ volatile("csrsi sstatus, 2" : : : "memory");
+    }
 }
 
+// IRQ-off tracer (kernel/irqsoff.c), only active with CONFIG_IRQSOFF_TRACE
+#define IRQSOFF_BUCKETS 16 // log2 microsecond buckets
+#define IRQSOFF_SITES   32
+
+typedef struct {
+    const char *func;  // NULL for an unused entry
+    int line;
+    u32 count;
+    u64 max;           // rdtime cycles
+    u64 total;
+} irqsoff_site_t;
+
+typedef struct {
+    u64 max;
+    const char *max_func;
+    int max_line;
+    u64 regions;
+    u64 dropped;       // Regions from sites that did not fit the table
+    u32 hist[IRQSOFF_BUCKETS];
+} irqsoff_stats_t;
+
+#if CONFIG_IRQSOFF_TRACE
+void irqsoff_restart(void);
+void irqsoff_trap(u64 entry);
+#else
+static inline void irqsoff_restart(void) {}
+static inline void irqsoff_trap(u64 entry) { (void)entry; }
+#endif
+int irqsoff_stats(irqsoff_stats_t *st, irqsoff_site_t *sites, int max_sites);
+void irqsoff_reset(void);
+
 // UART functions
 void uart_init(void);
 void uart_putc(char c);
@@ -121,19 +382,61 @@ void sbi_set_timer(u64 stime_value);
 // Trap functions
 void trap_init(void);
 void trap_handler(void);
+u64 trap_handler_c(u64 scause, u64 sepc, u64 stval);
+
+// Allocator telemetry (kernel/kmem.c)
+#define KMEM_CLASSES     22  // log2 block size classes, from 16 bytes
+#define KMEM_LAT_BUCKETS 16  // log2 kmalloc latency, in rdtime cycles
+
+typedef struct {
+    size_t heap_size;
+    size_t used;
+    size_t free;
+    size_t peak;          // Highest 'used' seen
+    size_t largest_free;
+    u32 live_blocks;
+    u32 free_blocks;
+    u64 allocs;
+    u64 frees;
+    u64 failures;         // kmalloc calls that found no block
+    u32 live_hist[KMEM_CLASSES];
+    u32 free_hist[KMEM_CLASSES];
+    u32 lat_hist[KMEM_LAT_BUCKETS];
+} kmem_stats_t;
 
 // Task functions
 void task_init(void);
 int task_create(void (*entry)(void *), void *arg, int burst_hint);
-void task_exit(void);
+int task_create_stack(void (*entry)(void *), void *arg, int burst_hint,
+                      u32 stack_size);
+int task_create_idle(void);
+int task_create_worker(void (*entry)(void *), void *arg);
+int task_create_rt(void (*entry)(void *), void *arg, u32 runtime, u32 period,
+                   u32 deadline);
+void task_wait_period(void);
+void task_exit(int status);
+int task_join(int pid, int *status);
+int task_waitpid(int pid, int *status, pcb_t *info);
+int task_detach(int pid);
+void task_reap_dead(void);
 void task_yield(void);
+void task_sleep(u64 ticks);
 pcb_t *task_get_by_pid(int pid);
 void task_reap(int pid);
+int task_kill(int pid);
+pcb_t *task_get_slot(int slot);
+u32 task_stack_used(pcb_t *task);
+void task_check_stack(pcb_t *task);
+int task_count(void);
 void *kmalloc(size_t size);
 void kfree(void *ptr);
+void *kmalloc_aligned(size_t size, size_t align);
+void kfree_aligned(void *ptr);
 size_t kmalloc_used(void);
 size_t kmalloc_free(void);
 int kmalloc_free_blocks(void);
+u32 kmem_frag_index(void);
+void kmem_stats(kmem_stats_t *st);
 void idle_task(void *arg);
 
 // Scheduler functions
@@ -143,41 +446,470 @@ void sched_on_tick(void);
 void sched_set_mode(sched_mode_t mode);
 sched_mode_t sched_get_mode(void);
 void sched_add_ready(pcb_t *task);
+void sched_sleep(u64 ticks);
+void sched_wait_period(void);
+void sched_wakeup(pcb_t *task);
+void sched_remove(pcb_t *task);
+int sched_prio_higher(pcb_t *a, pcb_t *b);
+void sched_pi_set(pcb_t *task, pcb_t *donor);
+void wq_init(wait_queue_t *wq);
+void sched_block(wait_queue_t *wq, irqflags_t flags);
+int sched_wake_one(wait_queue_t *wq);
+void sched_wake_all(wait_queue_t *wq);
 pcb_t *sched_current(void);
+void sched_set_idle(pcb_t *task);
+void sched_set_worker(pcb_t *task);
+void sched_kick_worker(void);
+void sched_worker_wait(void);
+u64 sched_context_switches(void);
+u64 sched_idle_switches(void);
 void sched_maybe_yield_safe(void);
 void sched_set_preempt(int on);
 int sched_get_preempt(void);
+void sched_set_burst_alpha(int percent);
+int sched_get_burst_alpha(void);
+const char *sched_mode_name(sched_mode_t mode);
+void sched_loadavg(u32 load[3]);
+void sched_latency(sched_mode_t mode, schedlat_t *out);
+void sched_latency_reset(void);
+u64 schedlat_percentile(const schedlat_t *lat, int pct);
+
+// MLFQ run queue (kernel/sched_mlfq.c)
+void mlfq_init(void);
+void mlfq_task_init(pcb_t *task);
+void mlfq_enqueue(pcb_t *task);
+pcb_t *mlfq_pick_next(void);
+void mlfq_remove(pcb_t *task);
+int mlfq_ready_count(void);
+int mlfq_on_tick(pcb_t *current);
+void mlfq_wakeup(pcb_t *task);
+int mlfq_prio(pcb_t *task);
+
+// Fair run queue (kernel/sched_fair.c)
+void fair_init(void);
+void fair_task_init(pcb_t *task);
+void fair_set_nice(pcb_t *task, int nice);
+void fair_charge(pcb_t *task, u64 delta);
+void fair_enqueue(pcb_t *task);
+pcb_t *fair_pick_next(void);
+void fair_remove(pcb_t *task);
+int fair_ready_count(void);
+void fair_wakeup(pcb_t *task);
+int fair_on_tick(pcb_t *current, u64 ran);
+
+// EDF run queue (kernel/sched_edf.c)
+void edf_init(void);
+int edf_admit(u32 runtime, u32 period, u32 deadline);
+void edf_task_init(pcb_t *task, u32 runtime, u32 period, u32 deadline);
+void edf_release(pcb_t *task);
+u32 edf_utilization(void);
+void edf_check_miss(pcb_t *task);
+u64 edf_next_release(pcb_t *task);
+void edf_replenish(pcb_t *task);
+void edf_enqueue(pcb_t *task);
+pcb_t *edf_pick_next(void);
+void edf_remove(pcb_t *task);
+int edf_ready_count(void);
+int edf_on_tick(pcb_t *current);
+
+// Deferred interrupt work (kernel/softirq.c)
+typedef struct work {
+    struct work *next;
+    void (*fn)(void *);
+    void *arg;
+    int queued;
+} work_t;
+
+typedef struct {
+    u64 trap_off_max;  // Longest IRQ-off part of a trap, rdtime cycles
+    u64 softirq_max;   // Longest softirq drain
+    u64 softirq_runs;
+    u64 worker_runs;
+} softirq_stats_t;
+
+void work_init(work_t *w, void (*fn)(void *), void *arg);
+int softirq_raise(work_t *w);
+int work_queue(work_t *w);
+void softirq_exit(u64 entry);
+void worker_task(void *arg);
+void softirq_set_defer(int on);
+int softirq_get_defer(void);
+void softirq_stats(softirq_stats_t *st);
+void softirq_reset_stats(void);
+
+// Stackless coroutines (kernel/coro.c). A coroutine function looks like
+//
+//   static int fn(coro_t *co) {
+//     my_state_t *st = container_of(co, my_state_t, co);
+//     CORO_BEGIN(co);
+//     ...  CORO_YIELD(co);  CORO_SLEEP(co, ticks);  CORO_WAIT(co, &ev);
+//     CORO_END(co);
+//   }
+//
+// Locals are lost at every CORO_* point; keep state in the block that
+// embeds the coro_t. At most one CORO_* point per source line.
+#define CORO_YIELDED 0  // Run again after the other ready coroutines
+#define CORO_BLOCKED 1  // Waiting for a timer or an event
+#define CORO_DONE    2  // Finished; the executor no longer touches it
+
+typedef struct coro coro_t;
+typedef int (*coro_fn_t)(coro_t *co);
+
+struct coro {
+    coro_t *next;         // Ready list or event wait list
+    u32 resume;           // Resume point, 0 to start from the top
+    coro_fn_t fn;
+    int queued;           // On the ready list
+    ktimer_t timer;       // For CORO_SLEEP
+};
+
+// Counting event: signals nobody waited for are kept for the next wait
+typedef struct {
+    coro_t *head;
+    coro_t *tail;
+    int count;
+} coro_event_t;
+
+typedef struct {
+    int live;             // Started and not finished
+    u64 steps;            // Coroutine calls made by the executor
+    int executor_pid;
+} coro_stats_t;
+
+// The resume point is the __LINE__ of the CORO_* point to continue at,
+// used as a case label of the switch CORO_BEGIN opens (so a coroutine's
+// own switch statements must not span a CORO_* point)
+#define CORO_BEGIN(co)                                                      \
+    switch ((co)->resume) {                                                 \
+    case 0:
+
+#define CORO_YIELD(co)                                                      \
+    do {                                                                    \
+        (co)->resume = __LINE__;                                            \
+        return CORO_YIELDED;                                                \
+    case __LINE__:;                                                         \
+    } while (0)
+
+#define CORO_SLEEP(co, ticks)                                               \
+    do {                                                                    \
+        (co)->resume = __LINE__;                                            \
+        coro_sleep_start((co), (ticks));                                    \
+        return CORO_BLOCKED;                                                \
+    case __LINE__:;                                                         \
+    } while (0)
+
+#define CORO_WAIT(co, ev)                                                   \
+    do {                                                                    \
+        (co)->resume = __LINE__;                                            \
+        if (!coro_event_take((ev), (co))) {                                 \
+            return CORO_BLOCKED;                                            \
+        }                                                                   \
+        __attribute__((fallthrough));                                       \
+    case __LINE__:;                                                         \
+    } while (0)
+
+#define CORO_END(co)                                                        \
+    }                                                                       \
+    return CORO_DONE
+
+void coro_start(coro_t *co, coro_fn_t fn);
+void coro_wake(coro_t *co);
+void coro_sleep_start(coro_t *co, u64 ticks);
+void coro_event_init(coro_event_t *ev);
+int coro_event_take(coro_event_t *ev, coro_t *co);
+void coro_event_signal(coro_event_t *ev);
+void coro_executor(void *arg);
+void coro_stats(coro_stats_t *st);
+
+// Kernel timers (kernel/ktimer.c)
+void ktimer_init(void);
+void ktimer_add(ktimer_t *t, u64 deadline, void (*fn)(void *), void *arg);
+int ktimer_cancel(ktimer_t *t);
+int ktimer_tick(u64 now);
+void ktimer_run_expired(void);
+void ktimer_stats(u64 *avg_cycles, u64 *max_cycles);
+void ktimer_reset_stats(void);
+
+// Workload trace replay (kernel/replay.c)
+typedef struct {
+    int pid;
+    u32 arrival;     // Trace arrival tick
+    u32 response;    // First dispatch - arrival
+    u32 turnaround;  // Exit - arrival
+    u32 cpu;         // Ticks charged to the task
+    u32 io;          // Total I/O wait requested by the trace
+} replay_metrics_t;
+
+int replay_task_count(void);
+int replay_run(sched_mode_t mode, replay_metrics_t *out);
 
 // Shell functions
 void shell_run(void);
 void shell_task(void *arg);
 
-// Synchronization primitives
+// Synchronization primitives (kernel/sync.c)
 typedef struct {
-    volatile int count;
+    int count;            // Updated atomically
+    wait_queue_t wq;      // Tasks sleeping in sem_wait
 } sem_t;
 
 void sem_init(sem_t *s, int count);
 void sem_wait(sem_t *s);
+int sem_trywait(sem_t *s);
 void sem_post(sem_t *s);
 
-typedef struct {
-    sem_t s;
+typedef struct mutex {
+    int state;            // 0 unlocked, 1 locked, 2 locked with sleepers
+    pcb_t *owner;
+    wait_queue_t wq;
+    struct mutex *held_next; // Owner's list of held mutexes
 } mutex_t;
 
+// Longest owner chain priority inheritance follows
+#define PI_MAX_DEPTH 16
+
 void mutex_init(mutex_t *m);
 void mutex_lock(mutex_t *m);
+int mutex_trylock(mutex_t *m);
 void mutex_unlock(mutex_t *m);
+void mutex_owner_gone(pcb_t *task);
+void mutex_set_pi(int on);
+int mutex_get_pi(void);
+
+// Condition variable, used with a mutex_t
+typedef struct {
+    wait_queue_t wq;      // Tasks sleeping in cond_wait
+} cond_t;
+
+void cond_init(cond_t *c);
+void cond_wait(cond_t *c, mutex_t *m);
+void cond_signal(cond_t *c);
+void cond_broadcast(cond_t *c);
+
+// Reusable barrier for a fixed number of tasks
+typedef struct {
+    int count;            // Tasks per round
+    int arrived;          // Tasks waiting in the current round
+    u32 generation;       // Bumped each time a round completes
+    wait_queue_t wq;
+} barrier_t;
+
+void barrier_init(barrier_t *b, int count);
+int barrier_wait(barrier_t *b);
+
+// Countdown latch: waiters sleep until the count reaches zero, once
+typedef struct {
+    int count;            // Updated atomically
+    wait_queue_t wq;
+} latch_t;
+
+void latch_init(latch_t *l, int count);
+void latch_count_down(latch_t *l);
+void latch_wait(latch_t *l);
+int latch_done(latch_t *l);
+
+// Ticket spinlock, for short sections that never sleep or yield
+typedef struct {
+    u32 next;             // Next ticket to hand out
+    u32 owner;            // Ticket now holding the lock
+} spinlock_t;
+
+void spin_init(spinlock_t *l);
+void spin_lock(spinlock_t *l);
+int spin_trylock(spinlock_t *l);
+void spin_unlock(spinlock_t *l);
+irqflags_t spin_lock_irqsave(spinlock_t *l);
+void spin_unlock_irqrestore(spinlock_t *l, irqflags_t flags);
+
+// Arena allocation for the current task, 16-byte aligned
+void *arena_alloc(size_t size);
+arena_mark_t arena_mark(void);
+void arena_reset(arena_mark_t mark);
+void arena_release(arena_t *a);
+
+// Message-passing channels (kernel/chan.c)
+#define CHAN_MULTI_SEND 0x1   // More than one task may send
+#define CHAN_MULTI_RECV 0x2   // More than one task may receive
+#define CHAN_SELECT_MAX 8     // Channels one chan_select can watch
+
+typedef struct {
+    void *buf;            // kmalloc'd payload, owned by the receiver once taken
+    size_t len;
+} chan_msg_t;
+
+// chan_select's registration on one channel
+typedef struct chan_sel {
+    wait_queue_t *wq;
+    struct chan_sel *next;
+} chan_sel_t;
+
+typedef struct {
+    chan_msg_t *ring;     // Power-of-two number of slots
+    u32 mask;
+    u32 head;             // Next slot to receive, written by receivers
+    u32 tail;             // Next slot to fill, written by senders
+    int flags;            // CHAN_MULTI_*
+    int closed;
+    spinlock_t send_lock; // Only taken with CHAN_MULTI_SEND
+    spinlock_t recv_lock; // Only taken with CHAN_MULTI_RECV
+    wait_queue_t send_wq; // Senders waiting for a free slot
+    wait_queue_t recv_wq; // Receivers waiting for a message
+    chan_sel_t *selectors;
+} chan_t;
+
+int chan_init(chan_t *c, int slots, int flags);
+void chan_destroy(chan_t *c);
+int chan_send(chan_t *c, void *buf, size_t len);
+int chan_recv(chan_t *c, chan_msg_t *out);
+int chan_trysend(chan_t *c, void *buf, size_t len);
+int chan_tryrecv(chan_t *c, chan_msg_t *out);
+void chan_close(chan_t *c);
+int chan_select(chan_t **chans, int n, chan_msg_t *out);
 
 // Context switch (ASM)
 void ctx_switch(context_t *from, context_t *to);
 
-// Utility
+// Device tree (kernel/dtb.c)
+int dtb_cpu_has_ext(const void *dtb, char ext);
+
+// Memory and string routines (lib/string.c, lib/string_rvv.S)
+void string_init(int has_rvv);
+u64 string_task_sstatus(void);
+int string_has_rvv(void);
+int string_set_rvv(int on);
+int string_get_rvv(void);
+u64 rvv_vlenb(void);
 void *memset(void *s, int c, size_t n);
 void *memcpy(void *dest, const void *src, size_t n);
 int strcmp(const char *s1, const char *s2);
 int strncmp(const char *s1, const char *s2, size_t n);
 size_t strlen(const char *s);
+
+// Platform-level interrupt controller (drivers/plic.c)
+void plic_init(void);
+int plic_register(int irq, void (*fn)(void *), void *arg);
+void plic_handle(void);
+void plic_stats(u64 *irqs, u64 *spurious);
+
+// virtio-blk (drivers/virtio_blk.c)
+#define BLK_SECTOR_SIZE 512
+
+#define BLK_OK       0
+#define BLK_EIO      -1
+#define BLK_PENDING  1        // Submitted, not completed yet
+
+// One transfer of 'count' sectors between the disk and a contiguous
+// buffer. The caller owns it and must not touch it between blk_submit
+// and completion.
+typedef struct blk_req {
+    u64 sector;
+    u32 count;
+    int write;
+    void *buf;
+    volatile int status;  // BLK_OK, BLK_EIO or BLK_PENDING
+    void (*done)(struct blk_req *); // Optional, runs last in interrupt work
+    void *arg;            // For 'done'
+    wait_queue_t wq;      // blk_wait sleeps here
+    struct blk_req *next; // Pending list, then the merged group it joined
+} blk_req_t;
+
+typedef struct {
+    int present;
+    int legacy;           // virtio-mmio version 1 transport
+    int readonly;
+    int irq;
+    u64 base;
+    u64 capacity;         // Sectors
+    u32 queue_size;
+} blk_info_t;
+
+typedef struct {
+    u64 submitted;        // blk_submit calls accepted
+    u64 dev_reqs;         // Requests handed to the device after merging
+    u64 merged;           // Submissions that joined another's request
+    u64 notifies;         // QueueNotify writes
+    u64 irqs;
+    u64 errors;
+    u32 max_inflight;     // Device requests in flight at once
+} blk_stats_t;
+
+int blk_init(void);
+void blk_req_init(blk_req_t *r, int write, u64 sector, u32 count, void *buf);
+int blk_submit(blk_req_t *r);
+void blk_unplug(void);
+int blk_wait(blk_req_t *r);
+int blk_rw(int write, u64 sector, u32 count, void *buf);
+void blk_info(blk_info_t *info);
+void blk_stats(blk_stats_t *st);
+void blk_set_merge(int on);
+int blk_get_merge(void);
+
+// Block devices and buffer cache (kernel/bcache.c)
+#define BCACHE_BLOCK_SIZE 4096
+#define BLKDEV_MAX        4
+
+// A registered block device. submit and unplug follow blk_submit and
+// blk_unplug: submit may complete the request before it returns.
+typedef struct {
+    const char *name;
+    u64 capacity;         // Sectors
+    int (*submit)(blk_req_t *r);
+    void (*unplug)(void); // May be null
+} blkdev_t;
+
+#define BUF_VALID 0x1     // Data has been read in (or written)
+#define BUF_DIRTY 0x2     // Newer than the disk
+#define BUF_IO    0x4     // Read or write in flight
+#define BUF_RA    0x8     // Read ahead and not asked for yet
+
+typedef struct buf {
+    int dev;              // -1 while unused
+    u64 block;            // In BCACHE_BLOCK_SIZE units
+    u32 flags;            // BUF_*
+    int refcnt;           // bread calls not yet released
+    u32 dirty_gen;        // Bumped by bdirty
+    u32 write_gen;        // dirty_gen when the last write started
+    u8 *data;
+    struct buf *hnext;    // Hash chain
+    struct buf *prev;     // LRU list, most recently used first
+    struct buf *next;
+    wait_queue_t wq;      // Tasks waiting for BUF_IO to clear
+    blk_req_t req;
+} buf_t;
+
+typedef struct {
+    u64 lookups;          // bread calls
+    u64 hits;             // Found cached or already being read
+    u64 misses;
+    u64 ra_blocks;        // Blocks read ahead
+    u64 ra_hits;          // Hits on a read-ahead block
+    u64 writebacks;
+    u64 evictions;        // Valid blocks dropped for others
+    u64 flushes;          // Flusher rounds
+    u32 bufs;
+    u32 dirty;
+    u32 inflight;
+} bcache_stats_t;
+
+int blkdev_register(const char *name, u64 capacity,
+                    int (*submit)(blk_req_t *r), void (*unplug)(void));
+const blkdev_t *blkdev_get(int dev);
+void bcache_init(void);
+buf_t *bread(int dev, u64 block);
+void bdirty(buf_t *b);
+void brelse(buf_t *b);
+void bcache_sync(void);
+void bcache_invalidate(int dev);
+void bcache_flusher(void *arg);
+void bcache_set_readahead(int on);
+int bcache_get_readahead(void);
+void bcache_stats(bcache_stats_t *st);
+void bcache_reset_stats(void);
+
+// RAM disk (drivers/ramdisk.c)
+int ramdisk_init(void);
+
+// Utility
 int atoi(const char *s);
 
 #endif // UROS_H
@@ -0,0 +1,102 @@
+#include "uros.h"
+
+// Per-task bump arenas
+//
+// A task's arena is a stack of chunks taken from kmalloc, each
+// CONFIG_ARENA_CHUNK_SIZE bytes or, for a bigger request, just big enough
+// for it. arena_alloc only moves a pointer: objects carry no header and
+// are never freed one by one. Only the owning task uses its arena, so
+// nothing here takes a lock or disables interrupts; kmalloc does that for
+// itself when a new chunk is needed. arena_mark/arena_reset roll the arena
+// back to an earlier point, handing back the chunks taken since, and the
+// task's exit releases what is left in one go.
+
+#define ARENA_ALIGN 16
+#define ARENA_HDR ((sizeof(arena_chunk_t) + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1))
+
+static u8 *chunk_start(arena_chunk_t *c) { return (u8 *)c + ARENA_HDR; }
+
+// Start a new chunk with room for at least 'size' bytes
+static int arena_grow(arena_t *a, size_t size) {
+  size_t usable = CONFIG_ARENA_CHUNK_SIZE - ARENA_HDR;
+  if (size > usable) {
+    usable = size;
+  }
+
+  arena_chunk_t *c = (arena_chunk_t *)kmalloc(ARENA_HDR + usable);
+  if (!c) {
+    return -1;
+  }
+  c->prev = a->chunk;
+  c->size = usable;
+  a->chunk = c;
+  a->cur = chunk_start(c);
+  a->end = a->cur + usable;
+  return 0;
+}
+
+static void arena_pop(arena_t *a) {
+  arena_chunk_t *c = a->chunk;
+
+  a->chunk = c->prev;
+  kfree(c);
+  if (a->chunk) {
+    a->cur = chunk_start(a->chunk);
+    a->end = a->cur + a->chunk->size;
+  } else {
+    a->cur = (u8 *)0;
+    a->end = (u8 *)0;
+  }
+}
+
+void *arena_alloc(size_t size) {
+  pcb_t *self = sched_current();
+  if (!self || size == 0) {
+    return (void *)0;
+  }
+
+  arena_t *a = &self->arena;
+  size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+  if ((size_t)(a->end - a->cur) < size && arena_grow(a, size) < 0) {
+    return (void *)0;
+  }
+
+  void *p = a->cur;
+  a->cur += size;
+  return p;
+}
+
+arena_mark_t arena_mark(void) {
+  arena_mark_t m = {(arena_chunk_t *)0, (u8 *)0};
+  pcb_t *self = sched_current();
+
+  if (self) {
+    m.chunk = self->arena.chunk;
+    m.cur = self->arena.cur;
+  }
+  return m;
+}
+
+// Free everything allocated since 'mark'. A mark taken before the first
+// allocation empties the arena.
+void arena_reset(arena_mark_t mark) {
+  pcb_t *self = sched_current();
+  if (!self) {
+    return;
+  }
+
+  arena_t *a = &self->arena;
+  while (a->chunk && a->chunk != mark.chunk) {
+    arena_pop(a);
+  }
+  if (a->chunk) {
+    a->cur = mark.cur;
+  }
+}
+
+// Free every chunk. Called for the owner at exit and when it is destroyed.
+void arena_release(arena_t *a) {
+  while (a->chunk) {
+    arena_pop(a);
+  }
+}
@@ -0,0 +1,505 @@
+#include "uros.h"
+
+// Block devices and the buffer cache
+//
+// Drivers register a block device with the same submit/unplug contract as
+// virtio-blk and get a device number. The cache holds CONFIG_BCACHE_BUFS
+// blocks of BCACHE_BLOCK_SIZE bytes, found through a hash table on
+// (device, block) and kept on an LRU list, most recently used first.
+// A miss takes the least recently used buffer that nobody holds, has no
+// I/O in flight and is clean; if every candidate is dirty, the oldest ones
+// are written back first. Blocks read ahead but not used yet are only
+// taken when nothing else is left.
+//
+// bdirty only marks a buffer. The flusher task writes dirty buffers back
+// every CONFIG_BCACHE_FLUSH_TICKS ticks, or as soon as half the cache is
+// dirty. A buffer dirtied again while its write is in flight stays dirty
+// and goes out on the next round.
+//
+// Each device remembers the last block read. After BCACHE_RA_TRIGGER
+// reads in a row that each follow the previous block, a miss or hit also
+// starts asynchronous reads of the blocks ahead. The window starts at
+// BCACHE_RA_MIN blocks and doubles up to CONFIG_BCACHE_RA_MAX, and the
+// next batch is issued once the reader is half way through the last one,
+// so the device sees runs of adjacent blocks it can merge.
+//
+// All cache state is changed with IRQs off; completions arrive from
+// interrupt work, or straight from submit for synchronous devices such as
+// the RAM disk. Callers holding the same buffer must agree among
+// themselves on who writes to it.
+
+#define BCACHE_HASH (CONFIG_BCACHE_BUFS * 2) // Buckets, a power of two
+#define BCACHE_RA_TRIGGER 2 // Sequential reads before read-ahead starts
+#define BCACHE_RA_MIN 4     // First read-ahead window, in blocks
+#define BCACHE_WB_BATCH 8   // Dirty buffers written when no clean one is left
+#define SECTORS_PER_BLOCK (BCACHE_BLOCK_SIZE / BLK_SECTOR_SIZE)
+
+typedef struct {
+  blkdev_t dev;
+  u64 last;   // Last block read
+  u32 seq;    // Consecutive sequential reads before it
+  u64 ra_end; // Blocks below this have been read ahead
+} blkdev_slot_t;
+
+static blkdev_slot_t devs[BLKDEV_MAX];
+static int ndevs = 0;
+
+static buf_t bufs[CONFIG_BCACHE_BUFS];
+static u8 buf_data[CONFIG_BCACHE_BUFS][BCACHE_BLOCK_SIZE]
+    __attribute__((aligned(CACHE_LINE_SIZE)));
+static buf_t *hash[BCACHE_HASH];
+static buf_t *lru_head; // Most recently used
+static buf_t *lru_tail;
+
+static wait_queue_t cache_wq; // Waiting for any buffer to free up
+static u32 inflight;          // Buffers with I/O in flight
+static u32 ndirty;
+static int readahead_enabled = 1;
+static bcache_stats_t stats;
+
+// Flusher task wakeups
+static wait_queue_t flush_wq;
+static ktimer_t flush_timer;
+static int flush_kick;
+
+int blkdev_register(const char *name, u64 capacity,
+                    int (*submit)(blk_req_t *r), void (*unplug)(void)) {
+  if (ndevs == BLKDEV_MAX) {
+    return -1;
+  }
+  blkdev_slot_t *d = &devs[ndevs];
+  d->dev.name = name;
+  d->dev.capacity = capacity;
+  d->dev.submit = submit;
+  d->dev.unplug = unplug;
+  return ndevs++;
+}
+
+// Null for a device number nobody registered
+const blkdev_t *blkdev_get(int dev) {
+  return dev >= 0 && dev < ndevs ? &devs[dev].dev : (const blkdev_t *)0;
+}
+
+static inline u32 hash_of(int dev, u64 block) {
+  return (u32)(((block * 0x9e3779b97f4a7c15UL) >> 40) ^ (u64)dev) &
+         (BCACHE_HASH - 1);
+}
+
+static buf_t *hash_find(int dev, u64 block) {
+  for (buf_t *b = hash[hash_of(dev, block)]; b; b = b->hnext) {
+    if (b->block == block && b->dev == dev) {
+      return b;
+    }
+  }
+  return (buf_t *)0;
+}
+
+static void hash_remove(buf_t *b) {
+  buf_t **pp = &hash[hash_of(b->dev, b->block)];
+  while (*pp != b) {
+    pp = &(*pp)->hnext;
+  }
+  *pp = b->hnext;
+}
+
+static void lru_unlink(buf_t *b) {
+  if (b->prev) {
+    b->prev->next = b->next;
+  } else {
+    lru_head = b->next;
+  }
+  if (b->next) {
+    b->next->prev = b->prev;
+  } else {
+    lru_tail = b->prev;
+  }
+}
+
+static void lru_touch(buf_t *b) {
+  lru_unlink(b);
+  b->prev = (buf_t *)0;
+  b->next = lru_head;
+  if (lru_head) {
+    lru_head->prev = b;
+  } else {
+    lru_tail = b;
+  }
+  lru_head = b;
+}
+
+static void lru_to_tail(buf_t *b) {
+  lru_unlink(b);
+  b->next = (buf_t *)0;
+  b->prev = lru_tail;
+  if (lru_tail) {
+    lru_tail->next = b;
+  } else {
+    lru_head = b;
+  }
+  lru_tail = b;
+}
+
+// Completion hook for every cache read and write. IRQs may be on or off.
+static void bcache_io_done(blk_req_t *r) {
+  buf_t *b = (buf_t *)r->arg;
+  irqflags_t flags = irq_save();
+
+  if (r->write) {
+    stats.writebacks++;
+    if (r->status == BLK_OK && b->write_gen == b->dirty_gen) {
+      b->flags &= ~BUF_DIRTY;
+      ndirty--;
+    }
+  } else if (r->status == BLK_OK) {
+    b->flags |= BUF_VALID;
+  }
+  b->flags &= ~BUF_IO;
+  inflight--;
+  sched_wake_all(&b->wq);
+  sched_wake_all(&cache_wq);
+
+  irq_restore(flags);
+}
+
+// Start I/O on a buffer. IRQs off; BUF_IO must be clear. A synchronous
+// device has completed it by the time this returns.
+static void start_io(buf_t *b, int write) {
+  b->flags |= BUF_IO;
+  inflight++;
+  if (write) {
+    b->write_gen = b->dirty_gen;
+  }
+  blk_req_init(&b->req, write, b->block * SECTORS_PER_BLOCK,
+               SECTORS_PER_BLOCK, b->data);
+  b->req.done = bcache_io_done;
+  b->req.arg = b;
+  if (devs[b->dev].dev.submit(&b->req) < 0) {
+    b->flags &= ~BUF_IO;
+    inflight--;
+  }
+}
+
+static void unplug(int dev) {
+  if (devs[dev].dev.unplug) {
+    devs[dev].dev.unplug();
+  }
+}
+
+// Least recently used buffer that can be reused right away, or null.
+// With 'spare_ra', blocks read ahead but not used yet are passed over.
+// IRQs off.
+static buf_t *victim(int spare_ra) {
+  u32 busy = BUF_IO | BUF_DIRTY | (spare_ra ? BUF_RA : 0);
+
+  for (buf_t *b = lru_tail; b; b = b->prev) {
+    if (b->refcnt == 0 && !(b->flags & busy)) {
+      return b;
+    }
+  }
+  return (buf_t *)0;
+}
+
+// No clean buffer left: write back the oldest dirty ones nobody holds.
+// Returns how many writes were started. IRQs off.
+static int writeback_oldest(void) {
+  int n = 0;
+  u32 touched = 0; // Devices to unplug
+
+  for (buf_t *b = lru_tail; b && n < BCACHE_WB_BATCH; b = b->prev) {
+    if (b->refcnt == 0 && (b->flags & (BUF_IO | BUF_DIRTY)) == BUF_DIRTY) {
+      start_io(b, 1);
+      touched |= 1U << b->dev;
+      n++;
+    }
+  }
+  for (int dev = 0; dev < ndevs; dev++) {
+    if (touched & (1U << dev)) {
+      unplug(dev);
+    }
+  }
+  return n;
+}
+
+// Give a reusable buffer a new identity. IRQs off.
+static void claim(buf_t *b, int dev, u64 block) {
+  if (b->flags & BUF_VALID) {
+    stats.evictions++;
+  }
+  if (b->dev >= 0) {
+    hash_remove(b);
+  }
+  b->dev = dev;
+  b->block = block;
+  b->flags = 0;
+  u32 h = hash_of(dev, block);
+  b->hnext = hash[h];
+  hash[h] = b;
+}
+
+// Note a read of 'block' and issue read-ahead if the device is being read
+// sequentially. Only takes buffers that are free right now. IRQs off.
+static void readahead(int dev, u64 block) {
+  blkdev_slot_t *d = &devs[dev];
+
+  if (block == d->last + 1) {
+    d->seq++;
+  } else {
+    d->seq = 0;
+    d->ra_end = 0;
+  }
+  d->last = block;
+  if (!readahead_enabled || d->seq < BCACHE_RA_TRIGGER) {
+    return;
+  }
+
+  u32 shift = d->seq - BCACHE_RA_TRIGGER;
+  u64 win = CONFIG_BCACHE_RA_MAX;
+  if (shift < 16 && ((u64)BCACHE_RA_MIN << shift) < win) {
+    win = (u64)BCACHE_RA_MIN << shift;
+  }
+  if (d->ra_end > block + win / 2) {
+    return; // Enough already on its way
+  }
+
+  u64 from = d->ra_end > block + 1 ? d->ra_end : block + 1;
+  u64 to = block + 1 + win;
+  u64 nblocks = d->dev.capacity / SECTORS_PER_BLOCK;
+  if (to > nblocks) {
+    to = nblocks;
+  }
+  for (u64 blk = from; blk < to; blk++) {
+    if (hash_find(dev, blk)) {
+      continue;
+    }
+    buf_t *b = victim(1);
+    if (!b) {
+      to = blk;
+      break;
+    }
+    claim(b, dev, blk);
+    b->flags = BUF_RA;
+    lru_touch(b);
+    start_io(b, 0);
+    stats.ra_blocks++;
+  }
+  if (to > d->ra_end) {
+    d->ra_end = to;
+  }
+}
+
+// Return block 'block' of device 'dev' with its data read in, held until
+// brelse. Null if the block does not exist or cannot be read.
+buf_t *bread(int dev, u64 block) {
+  const blkdev_t *d = blkdev_get(dev);
+  if (!d || block >= d->capacity / SECTORS_PER_BLOCK) {
+    return (buf_t *)0;
+  }
+
+  irqflags_t flags = irq_save();
+  stats.lookups++;
+
+  buf_t *b;
+  while (1) {
+    b = hash_find(dev, block);
+    if (b) {
+      if (b->flags & (BUF_VALID | BUF_IO)) {
+        stats.hits++;
+        if (b->flags & BUF_RA) {
+          stats.ra_hits++;
+        }
+      } else {
+        stats.misses++; // An earlier read failed; try again
+        start_io(b, 0);
+      }
+      break;
+    }
+
+    // Unused read-ahead goes last, after writing back dirty buffers
+    int started = 0;
+    b = victim(1);
+    if (!b) {
+      started = writeback_oldest();
+      if (!started) {
+        b = victim(0);
+      }
+    }
+    if (b) {
+      stats.misses++;
+      claim(b, dev, block);
+      start_io(b, 0);
+      break;
+    }
+
+    // Look again once the writes are done (a RAM disk already is), or
+    // wait for I/O in flight or a brelse
+    if (!started) {
+      sched_block(&cache_wq, flags);
+    }
+  }
+
+  b->refcnt++;
+  b->flags &= ~BUF_RA;
+  lru_touch(b);
+  readahead(dev, block);
+  unplug(dev);
+
+  while (b->flags & BUF_IO) {
+    sched_block(&b->wq, flags);
+  }
+  if (!(b->flags & BUF_VALID)) {
+    b->refcnt--;
+    sched_wake_all(&cache_wq);
+    b = (buf_t *)0;
+  }
+
+  irq_restore(flags);
+  return b;
+}
+
+// The caller changed the buffer's data; the flusher writes it back
+void bdirty(buf_t *b) {
+  irqflags_t flags = irq_save();
+
+  b->dirty_gen++;
+  if (!(b->flags & BUF_DIRTY)) {
+    b->flags |= BUF_DIRTY;
+    ndirty++;
+    if (ndirty >= CONFIG_BCACHE_BUFS / 2 && !flush_kick) {
+      flush_kick = 1;
+      sched_wake_one(&flush_wq);
+    }
+  }
+
+  irq_restore(flags);
+}
+
+void brelse(buf_t *b) {
+  irqflags_t flags = irq_save();
+
+  if (--b->refcnt == 0) {
+    sched_wake_all(&cache_wq);
+  }
+
+  irq_restore(flags);
+}
+
+// Start writes for every dirty buffer of 'dev' (-1: all devices) and, if
+// 'wait' is set, sleep until they are done. IRQs off.
+static void flush_locked(int dev, int wait, irqflags_t flags) {
+  u32 touched = 0;
+
+  for (int i = 0; i < CONFIG_BCACHE_BUFS; i++) {
+    buf_t *b = &bufs[i];
+    if ((dev < 0 || b->dev == dev) &&
+        (b->flags & (BUF_IO | BUF_DIRTY)) == BUF_DIRTY) {
+      start_io(b, 1);
+      touched |= 1U << b->dev;
+    }
+  }
+  for (int d = 0; d < ndevs; d++) {
+    if (touched & (1U << d)) {
+      unplug(d);
+    }
+  }
+
+  if (wait) {
+    for (int i = 0; i < CONFIG_BCACHE_BUFS; i++) {
+      buf_t *b = &bufs[i];
+      while ((dev < 0 || b->dev == dev) && (b->flags & BUF_IO)) {
+        sched_block(&b->wq, flags);
+      }
+    }
+  }
+}
+
+// Write back everything dirty and wait for it
+void bcache_sync(void) {
+  irqflags_t flags = irq_save();
+  flush_locked(-1, 1, flags);
+  irq_restore(flags);
+}
+
+// Write back and drop every buffer of 'dev' nobody holds, and forget its
+// read-ahead state
+void bcache_invalidate(int dev) {
+  if (!blkdev_get(dev)) {
+    return;
+  }
+
+  irqflags_t flags = irq_save();
+  flush_locked(dev, 1, flags);
+  for (int i = 0; i < CONFIG_BCACHE_BUFS; i++) {
+    buf_t *b = &bufs[i];
+    if (b->dev == dev && b->refcnt == 0 &&
+        !(b->flags & (BUF_IO | BUF_DIRTY))) {
+      hash_remove(b);
+      b->dev = -1;
+      b->flags = 0;
+      lru_to_tail(b);
+    }
+  }
+  devs[dev].seq = 0;
+  devs[dev].ra_end = 0;
+  irq_restore(flags);
+}
+
+static void flush_timeout(void *arg) {
+  (void)arg;
+  irqflags_t flags = irq_save();
+  flush_kick = 1;
+  sched_wake_one(&flush_wq);
+  irq_restore(flags);
+}
+
+// Flusher task: writes dirty buffers back periodically or under pressure
+void bcache_flusher(void *arg) {
+  (void)arg;
+
+  while (1) {
+    ktimer_add(&flush_timer, g_ticks + CONFIG_BCACHE_FLUSH_TICKS,
+               flush_timeout, (void *)0);
+
+    irqflags_t flags = irq_save();
+    while (!flush_kick) {
+      sched_block(&flush_wq, flags);
+    }
+    flush_kick = 0;
+    stats.flushes++;
+    flush_locked(-1, 0, flags);
+    irq_restore(flags);
+  }
+}
+
+void bcache_init(void) {
+  wq_init(&cache_wq);
+  wq_init(&flush_wq);
+  for (int i = 0; i < CONFIG_BCACHE_BUFS; i++) {
+    buf_t *b = &bufs[i];
+    b->dev = -1;
+    b->data = buf_data[i];
+    wq_init(&b->wq);
+    b->prev = i > 0 ? &bufs[i - 1] : (buf_t *)0;
+    b->next = i + 1 < CONFIG_BCACHE_BUFS ? &bufs[i + 1] : (buf_t *)0;
+  }
+  lru_head = &bufs[0];
+  lru_tail = &bufs[CONFIG_BCACHE_BUFS - 1];
+}
+
+void bcache_set_readahead(int on) { readahead_enabled = on ? 1 : 0; }
+
+int bcache_get_readahead(void) { return readahead_enabled; }
+
+void bcache_stats(bcache_stats_t *st) {
+  irqflags_t flags = irq_save();
+  *st = stats;
+  st->bufs = CONFIG_BCACHE_BUFS;
+  st->dirty = ndirty;
+  st->inflight = inflight;
+  irq_restore(flags);
+}
+
+void bcache_reset_stats(void) {
+  irqflags_t flags = irq_save();
+  memset(&stats, 0, sizeof(stats));
+  irq_restore(flags);
+}
@@ -0,0 +1,237 @@
+#include "uros.h"
+
+// Message-passing channels
+//
+// A channel is a bounded ring of message descriptors. A message carries a
+// pointer to a kmalloc'd buffer, not the data: chan_send hands the buffer
+// over and the receiver owns it from then on (and kfrees it), so a
+// message costs no copy however large it is.
+//
+// head is only written by the receiving side and tail by the sending side,
+// so one sender and one receiver run without locks: each reads the other's
+// index with acquire and publishes its own with release. Channels made with
+// CHAN_MULTI_SEND or CHAN_MULTI_RECV serialize that side with a ticket
+// spinlock held only around the slot update.
+//
+// A task that finds the ring full or empty sleeps on the channel's wait
+// queue; as with semaphores, it rechecks with IRQs off before sleeping so
+// the other side cannot slip in between. chan_select sleeps on a wait
+// queue of its own that every channel it watches points to.
+
+static int chan_count(chan_t *c) {
+  return (int)(__atomic_load_n(&c->tail, __ATOMIC_ACQUIRE) -
+               __atomic_load_n(&c->head, __ATOMIC_ACQUIRE));
+}
+
+int chan_init(chan_t *c, int slots, int flags) {
+  u32 size = 1;
+
+  while (size < (u32)slots) {
+    size <<= 1;
+  }
+
+  c->ring = (chan_msg_t *)kmalloc(size * sizeof(chan_msg_t));
+  if (!c->ring) {
+    return -1;
+  }
+  c->mask = size - 1;
+  c->head = 0;
+  c->tail = 0;
+  c->flags = flags;
+  c->closed = 0;
+  spin_init(&c->send_lock);
+  spin_init(&c->recv_lock);
+  wq_init(&c->send_wq);
+  wq_init(&c->recv_wq);
+  c->selectors = (chan_sel_t *)0;
+  return 0;
+}
+
+// Frees the ring and every buffer still queued. Nobody may be using the
+// channel any more.
+void chan_destroy(chan_t *c) {
+  while (c->head != c->tail) {
+    kfree(c->ring[c->head & c->mask].buf);
+    c->head++;
+  }
+  kfree(c->ring);
+  c->ring = (chan_msg_t *)0;
+}
+
+// Wake selectors watching the channel. Called with IRQs off.
+static void chan_wake_selectors(chan_t *c) {
+  for (chan_sel_t *s = c->selectors; s; s = s->next) {
+    sched_wake_all(s->wq);
+  }
+}
+
+// Wake the other side if anyone sleeps there
+static void chan_kick(chan_t *c, wait_queue_t *wq, int selectors) {
+  if (__atomic_load_n(&wq->head, __ATOMIC_SEQ_CST) ||
+      (selectors && __atomic_load_n(&c->selectors, __ATOMIC_SEQ_CST))) {
+    irqflags_t flags = irq_save();
+    sched_wake_one(wq);
+    if (selectors) {
+      chan_wake_selectors(c);
+    }
+    irq_restore(flags);
+  }
+}
+
+// Put one message in the ring if there is room. Returns 1 on success.
+static int chan_push(chan_t *c, void *buf, size_t len) {
+  int multi = c->flags & CHAN_MULTI_SEND;
+  int ok = 0;
+
+  if (multi) {
+    spin_lock(&c->send_lock);
+  }
+  u32 tail = c->tail;
+  if (tail - __atomic_load_n(&c->head, __ATOMIC_ACQUIRE) <= c->mask) {
+    c->ring[tail & c->mask].buf = buf;
+    c->ring[tail & c->mask].len = len;
+    __atomic_store_n(&c->tail, tail + 1, __ATOMIC_SEQ_CST);
+    ok = 1;
+  }
+  if (multi) {
+    spin_unlock(&c->send_lock);
+  }
+  return ok;
+}
+
+// Take one message out of the ring if there is one. Returns 1 on success.
+static int chan_pop(chan_t *c, chan_msg_t *out) {
+  int multi = c->flags & CHAN_MULTI_RECV;
+  int ok = 0;
+
+  if (multi) {
+    spin_lock(&c->recv_lock);
+  }
+  u32 head = c->head;
+  if (head != __atomic_load_n(&c->tail, __ATOMIC_ACQUIRE)) {
+    *out = c->ring[head & c->mask];
+    __atomic_store_n(&c->head, head + 1, __ATOMIC_SEQ_CST);
+    ok = 1;
+  }
+  if (multi) {
+    spin_unlock(&c->recv_lock);
+  }
+  return ok;
+}
+
+// Returns 1 if the message was queued, 0 if the ring is full or the
+// channel closed. The buffer changes hands only on success.
+int chan_trysend(chan_t *c, void *buf, size_t len) {
+  if (__atomic_load_n(&c->closed, __ATOMIC_ACQUIRE) ||
+      !chan_push(c, buf, len)) {
+    return 0;
+  }
+  chan_kick(c, &c->recv_wq, 1);
+  return 1;
+}
+
+int chan_tryrecv(chan_t *c, chan_msg_t *out) {
+  if (!chan_pop(c, out)) {
+    return 0;
+  }
+  chan_kick(c, &c->send_wq, 0);
+  return 1;
+}
+
+// Blocks while the ring is full. Returns 0, or -1 if the channel was
+// closed, in which case the caller still owns buf.
+int chan_send(chan_t *c, void *buf, size_t len) {
+  while (!chan_trysend(c, buf, len)) {
+    irqflags_t flags = irq_save();
+    if (c->closed) {
+      irq_restore(flags);
+      return -1;
+    }
+    if (chan_count(c) > (int)c->mask) {
+      sched_block(&c->send_wq, flags);
+    }
+    irq_restore(flags);
+  }
+  return 0;
+}
+
+// Blocks while the ring is empty. Returns 0, or -1 once the channel is
+// closed and drained.
+int chan_recv(chan_t *c, chan_msg_t *out) {
+  while (!chan_tryrecv(c, out)) {
+    irqflags_t flags = irq_save();
+    if (chan_count(c) == 0) {
+      if (c->closed) {
+        irq_restore(flags);
+        return -1;
+      }
+      sched_block(&c->recv_wq, flags);
+    }
+    irq_restore(flags);
+  }
+  return 0;
+}
+
+// Senders fail from now on; receivers get what is left, then -1
+void chan_close(chan_t *c) {
+  irqflags_t flags = irq_save();
+  __atomic_store_n(&c->closed, 1, __ATOMIC_RELEASE);
+  sched_wake_all(&c->send_wq);
+  sched_wake_all(&c->recv_wq);
+  chan_wake_selectors(c);
+  irq_restore(flags);
+}
+
+static void sel_unlink(chan_t *c, chan_sel_t *s) {
+  for (chan_sel_t **pp = &c->selectors; *pp; pp = &(*pp)->next) {
+    if (*pp == s) {
+      *pp = s->next;
+      return;
+    }
+  }
+}
+
+// Receive from whichever of n channels (at most CHAN_SELECT_MAX) has a
+// message first, scanning in order. Returns that channel's index, or -1
+// once every channel is closed and drained or if n is out of range.
+int chan_select(chan_t **chans, int n, chan_msg_t *out) {
+  chan_sel_t sel[CHAN_SELECT_MAX];
+  wait_queue_t wq;
+
+  if (n <= 0 || n > CHAN_SELECT_MAX) {
+    return -1;
+  }
+  wq_init(&wq);
+
+  while (1) {
+    for (int i = 0; i < n; i++) {
+      if (chan_tryrecv(chans[i], out)) {
+        return i;
+      }
+    }
+
+    irqflags_t flags = irq_save();
+    int live = 0;
+    int ready = 0;
+    for (int i = 0; i < n; i++) {
+      live |= !chans[i]->closed;
+      ready |= chan_count(chans[i]) != 0;
+    }
+    if (!live && !ready) {
+      irq_restore(flags);
+      return -1;
+    }
+    if (!ready) {
+      for (int i = 0; i < n; i++) {
+        sel[i].wq = &wq;
+        sel[i].next = chans[i]->selectors;
+        chans[i]->selectors = &sel[i];
+      }
+      sched_block(&wq, flags);
+      for (int i = 0; i < n; i++) {
+        sel_unlink(chans[i], &sel[i]);
+      }
+    }
+    irq_restore(flags);
+  }
+}
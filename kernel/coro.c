@@ -0,0 +1,157 @@
+#include "uros.h"
+
+// Stackless coroutines
+//
+// A coroutine is a function written with the CORO_* macros and a coro_t
+// embedded in the caller's own state block. It runs on the stack of the
+// hart's executor task until it yields or waits, and then returns; the
+// resume point it leaves in the coro_t (a case label in the switch that
+// CORO_BEGIN opens) is where the next call picks up. Locals do not
+// survive a yield, so anything that must live across one belongs in the
+// state block.
+//
+// The executor is an ordinary task in the scheduler's run queues and runs
+// ready coroutines in FIFO order, one step each, giving up the CPU between
+// steps whenever a reschedule is due. Switching between coroutines is a
+// function return and a call; no registers are saved and no stack is
+// needed beyond the executor's own. When no coroutine is ready, the
+// executor sleeps on a wait queue.
+
+typedef struct {
+  coro_t *head; // Ready coroutines, linked through next
+  coro_t *tail;
+  wait_queue_t wq; // The executor, while nothing is ready
+  pcb_t *task;
+  int live;  // Started and not yet finished
+  u64 steps; // Coroutine calls made
+} coro_hart_t;
+
+static coro_hart_t hart0;
+
+static coro_hart_t *this_hart(void) { return &hart0; }
+
+// Put a coroutine on the ready list. May be called from any context.
+void coro_wake(coro_t *co) {
+  coro_hart_t *hart = this_hart();
+  irqflags_t flags = irq_save();
+
+  if (!co->queued) {
+    co->queued = 1;
+    co->next = (coro_t *)0;
+    if (hart->tail) {
+      hart->tail->next = co;
+    } else {
+      hart->head = co;
+    }
+    hart->tail = co;
+    sched_wake_one(&hart->wq);
+  }
+
+  irq_restore(flags);
+}
+
+void coro_start(coro_t *co, coro_fn_t fn) {
+  co->next = (coro_t *)0;
+  co->resume = 0;
+  co->fn = fn;
+  co->queued = 0;
+  __atomic_fetch_add(&this_hart()->live, 1, __ATOMIC_RELAXED);
+  coro_wake(co);
+}
+
+static void coro_timeout(void *arg) { coro_wake((coro_t *)arg); }
+
+// CORO_SLEEP: arm the coroutine's timer; it is woken when it fires
+void coro_sleep_start(coro_t *co, u64 ticks) {
+  ktimer_add(&co->timer, g_ticks + (ticks ? ticks : 1), coro_timeout, co);
+}
+
+void coro_event_init(coro_event_t *ev) {
+  ev->head = (coro_t *)0;
+  ev->tail = (coro_t *)0;
+  ev->count = 0;
+}
+
+// CORO_WAIT: consume a pending signal, or queue the coroutine on the event.
+// Returns 1 if it got a signal and can carry on.
+int coro_event_take(coro_event_t *ev, coro_t *co) {
+  irqflags_t flags = irq_save();
+
+  if (ev->count > 0) {
+    ev->count--;
+    irq_restore(flags);
+    return 1;
+  }
+
+  co->next = (coro_t *)0;
+  if (ev->tail) {
+    ev->tail->next = co;
+  } else {
+    ev->head = co;
+  }
+  ev->tail = co;
+
+  irq_restore(flags);
+  return 0;
+}
+
+// Wake the first waiter, or remember the signal if nobody waits. May be
+// called from tasks, coroutines and interrupt work alike.
+void coro_event_signal(coro_event_t *ev) {
+  irqflags_t flags = irq_save();
+
+  coro_t *co = ev->head;
+  if (co) {
+    ev->head = co->next;
+    if (!ev->head) {
+      ev->tail = (coro_t *)0;
+    }
+    coro_wake(co);
+  } else {
+    ev->count++;
+  }
+
+  irq_restore(flags);
+}
+
+// Executor task: one per hart, created at boot
+void coro_executor(void *arg) {
+  (void)arg;
+  coro_hart_t *hart = this_hart();
+
+  hart->task = sched_current();
+  while (1) {
+    irqflags_t flags = irq_save();
+    coro_t *co = hart->head;
+    if (!co) {
+      sched_block(&hart->wq, flags);
+      irq_restore(flags);
+      continue;
+    }
+    hart->head = co->next;
+    if (!hart->head) {
+      hart->tail = (coro_t *)0;
+    }
+    co->queued = 0;
+    irq_restore(flags);
+
+    hart->steps++;
+    int r = co->fn(co);
+    if (r == CORO_YIELDED) {
+      coro_wake(co);
+    } else if (r == CORO_DONE) {
+      // The coroutine may already have freed its storage
+      __atomic_fetch_sub(&hart->live, 1, __ATOMIC_RELAXED);
+    }
+
+    sched_maybe_yield_safe();
+  }
+}
+
+void coro_stats(coro_stats_t *st) {
+  coro_hart_t *hart = this_hart();
+
+  st->live = hart->live;
+  st->steps = hart->steps;
+  st->executor_pid = hart->task ? hart->task->pid : -1;
+}
@@ -0,0 +1,110 @@
+#include "uros.h"
+
+// Flattened device tree lookups
+//
+// The firmware passes the DTB's address in a1 at boot. Only what the
+// kernel needs is read: the first CPU node's ISA, either the
+// "riscv,isa" string (rv64imafdcv_zicsr...) or the newer
+// "riscv,isa-extensions" string list.
+
+#define FDT_MAGIC 0xd00dfeed
+#define FDT_BEGIN_NODE 1
+#define FDT_END_NODE 2
+#define FDT_PROP 3
+#define FDT_NOP 4
+#define FDT_END 9
+
+// DTB fields are big-endian
+static u32 be32(const void *p) {
+  const u8 *b = (const u8 *)p;
+  return ((u32)b[0] << 24) | ((u32)b[1] << 16) | ((u32)b[2] << 8) | b[3];
+}
+
+static int starts_with(const char *s, const char *prefix) {
+  while (*prefix) {
+    if (*s++ != *prefix++) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+// Single-letter extension in an ISA string, before the first '_'
+static int isa_has(const char *isa, const char *end, char ext) {
+  if (starts_with(isa, "rv64") || starts_with(isa, "rv32")) {
+    isa += 4;
+  }
+  for (; isa < end && *isa && *isa != '_'; isa++) {
+    if (*isa == ext) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+// Extension name in a NUL-separated string list
+static int list_has(const char *list, const char *end, const char *name) {
+  while (list < end) {
+    if (strcmp(list, name) == 0) {
+      return 1;
+    }
+    list += strlen(list) + 1;
+  }
+  return 0;
+}
+
+// 1 if the first CPU node lists the single-letter extension 'ext'
+int dtb_cpu_has_ext(const void *dtb, char ext) {
+  if (!dtb || be32(dtb) != FDT_MAGIC) {
+    return 0;
+  }
+
+  const u8 *base = (const u8 *)dtb;
+  const u8 *p = base + be32(base + 8);        // off_dt_struct
+  const char *strs = (const char *)base + be32(base + 12); // off_dt_strings
+  const char name[2] = {ext, '\0'};
+  int depth = 0;
+  int cpu_depth = 0; // Depth of the CPU node being read, 0 outside one
+
+  while (1) {
+    u32 tok = be32(p);
+    p += 4;
+
+    switch (tok) {
+    case FDT_BEGIN_NODE: {
+      const char *node = (const char *)p;
+      depth++;
+      if (!cpu_depth && starts_with(node, "cpu@")) {
+        cpu_depth = depth;
+      }
+      p += (strlen(node) + 1 + 3) & ~3UL;
+      break;
+    }
+    case FDT_END_NODE:
+      if (cpu_depth == depth) {
+        return 0; // First CPU node had no ISA property
+      }
+      depth--;
+      break;
+    case FDT_PROP: {
+      u32 len = be32(p);
+      const char *prop = strs + be32(p + 4);
+      const char *val = (const char *)p + 8;
+      if (cpu_depth == depth) {
+        if (strcmp(prop, "riscv,isa-extensions") == 0) {
+          return list_has(val, val + len, name);
+        }
+        if (strcmp(prop, "riscv,isa") == 0) {
+          return isa_has(val, val + len, ext);
+        }
+      }
+      p += 8 + ((len + 3) & ~3U);
+      break;
+    }
+    case FDT_NOP:
+      break;
+    default: // FDT_END or garbage
+      return 0;
+    }
+  }
+}
@@ -0,0 +1,144 @@
+#include "uros.h"
+
+// IRQ-off latency tracer
+//
+// In a CONFIG_IRQSOFF_TRACE build, irq_save() stamps the outermost
+// IRQ-off region with rdtime() and the function and line that opened it,
+// and irq_restore() closes it. Nested sections do not open a region of
+// their own; the outer call site owns the whole time. The part of a trap
+// before softirq_exit turns interrupts back on counts as a region of its
+// own, reported as "trap". Each region goes into a log2 histogram and a
+// small per-site table for the shell's irqsoff command.
+//
+// Everything here runs with interrupts off on a single hart, so it needs
+// no locking.
+
+#if CONFIG_IRQSOFF_TRACE
+
+#define CYCLES_PER_US (TIMEBASE_HZ / 1000000)
+
+static u64 cur_start;
+static const char *cur_func = (const char *)0; // NULL: no open region
+static int cur_line;
+
+static irqsoff_stats_t stats;
+static irqsoff_site_t sites[IRQSOFF_SITES];
+
+// Bucket 0 is under 1 us, bucket b covers [2^(b-1), 2^b) us
+static int bucket(u64 cycles) {
+  u64 us = cycles / CYCLES_PER_US;
+  int b = 0;
+
+  while (us && b < IRQSOFF_BUCKETS - 1) {
+    us >>= 1;
+    b++;
+  }
+  return b;
+}
+
+static void record(const char *func, int line, u64 cycles) {
+  stats.regions++;
+  stats.hist[bucket(cycles)]++;
+  if (cycles > stats.max) {
+    stats.max = cycles;
+    stats.max_func = func;
+    stats.max_line = line;
+  }
+
+  for (int i = 0; i < IRQSOFF_SITES; i++) {
+    irqsoff_site_t *s = &sites[i];
+    if (!s->func) {
+      s->func = func;
+      s->line = line;
+    } else if (s->func != func || s->line != line) {
+      continue;
+    }
+    s->count++;
+    s->total += cycles;
+    if (cycles > s->max) {
+      s->max = cycles;
+    }
+    return;
+  }
+  stats.dropped++;
+}
+
+void irqsoff_begin(const char *func, int line) {
+  cur_func = func;
+  cur_line = line;
+  cur_start = rdtime();
+}
+
+void irqsoff_end(void) {
+  if (!cur_func) {
+    return;
+  }
+
+  u64 cycles = rdtime() - cur_start;
+  const char *func = cur_func;
+  cur_func = (const char *)0;
+  record(func, cur_line, cycles);
+}
+
+// Start the open region's clock again, e.g. after idle's wfi
+void irqsoff_restart(void) {
+  if (cur_func) {
+    cur_start = rdtime();
+  }
+}
+
+// A trap ran with interrupts off from 'entry' until now
+void irqsoff_trap(u64 entry) { record("trap", 0, rdtime() - entry); }
+
+// Copy out the totals and up to max_sites sites, worst first. Returns the
+// number of sites copied.
+int irqsoff_stats(irqsoff_stats_t *st, irqsoff_site_t *out, int max_sites) {
+  irqsoff_site_t copy[IRQSOFF_SITES];
+  int n = 0;
+
+  irqflags_t flags = irq_save();
+  *st = stats;
+  for (int i = 0; i < IRQSOFF_SITES && sites[i].func; i++) {
+    copy[n++] = sites[i];
+  }
+  irq_restore(flags);
+
+  // Insertion sort by worst case, the table is small
+  for (int i = 1; i < n; i++) {
+    irqsoff_site_t s = copy[i];
+    int j = i - 1;
+    while (j >= 0 && copy[j].max < s.max) {
+      copy[j + 1] = copy[j];
+      j--;
+    }
+    copy[j + 1] = s;
+  }
+
+  if (n > max_sites) {
+    n = max_sites;
+  }
+  for (int i = 0; i < n; i++) {
+    out[i] = copy[i];
+  }
+  return n;
+}
+
+void irqsoff_reset(void) {
+  irqflags_t flags = irq_save();
+  memset(&stats, 0, sizeof(stats));
+  memset(sites, 0, sizeof(sites));
+  irq_restore(flags);
+}
+
+#else
+
+int irqsoff_stats(irqsoff_stats_t *st, irqsoff_site_t *out, int max_sites) {
+  (void)out;
+  (void)max_sites;
+  memset(st, 0, sizeof(*st));
+  return 0;
+}
+
+void irqsoff_reset(void) {}
+
+#endif
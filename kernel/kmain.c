@@ -1,6 +1,8 @@
 #include "uros.h"
 
-void kmain(void) {
+// a0 and a1 from the firmware: this hart's ID and the DTB's address
+void kmain(u64 hartid, const void *dtb) {
+  (void)hartid;
   uart_init();
 
   kprintf("\n");
@@ -13,6 +15,15 @@ void kmain(void) {
   kprintf(" HeliOS v1.0 - RISC-V 64-bit \n");
   kprintf("--------------------------------------------------\n");
 
+  // Before any task exists: new tasks inherit the vector unit state
+  string_init(dtb_cpu_has_ext(dtb, 'v'));
+  if (string_has_rvv()) {
+    kprintf("RVV: vector string routines enabled (VLEN %u bits)\n",
+            (u32)(rvv_vlenb() * 8));
+  } else {
+    kprintf("RVV: not available, using scalar string routines\n");
+  }
+
   kprintf("Initializing task system...\n");
   task_init();
 
@@ -20,13 +31,36 @@ void kmain(void) {
   sched_init();
 
   kprintf("Creating idle task...\n");
-  if (task_create((void (*)(void *))idle_task, (void *)0, 10000) < 0) {
+  if (task_create_idle() < 0) {
     kprintf("Failed to create idle task\n");
     for (;;) {
       __asm__ volatile("wfi");
     }
   }
 
+  kprintf("Creating worker task...\n");
+  ktimer_init();
+  if (task_create_worker(worker_task, (void *)0) < 0) {
+    kprintf("Failed to create worker task\n");
+    for (;;) {
+      __asm__ volatile("wfi");
+    }
+  }
+
+  // Coroutines can still be started without it, they just never run
+  kprintf("Creating coroutine executor...\n");
+  if (task_create(coro_executor, (void *)0, 10) < 0) {
+    kprintf("Failed to create coroutine executor\n");
+  }
+
+  // Dirty buffers are only written back on eviction and bcache_sync without it
+  kprintf("Creating buffer cache flusher...\n");
+  bcache_init();
+  ramdisk_init();
+  if (task_create(bcache_flusher, (void *)0, 10) < 0) {
+    kprintf("Failed to create buffer cache flusher\n");
+  }
+
   kprintf("Creating shell task...\n");
   if (task_create(shell_task, (void *)0, 1000) < 0) {
     kprintf("Failed to create shell task\n");
@@ -41,6 +75,20 @@ void kmain(void) {
   kprintf("Initializing timer...\n");
   timer_init();
 
+  kprintf("Initializing PLIC...\n");
+  plic_init();
+
+  if (blk_init() == 0) {
+    blk_info_t info;
+    blk_info(&info);
+    kprintf("virtio-blk: %u sectors (%u MB)%s, irq %d\n", (u32)info.capacity,
+            (u32)(info.capacity / 2048), info.readonly ? ", read-only" : "",
+            info.irq);
+    blkdev_register("vda", info.capacity, blk_submit, blk_unplug);
+  } else {
+    kprintf("virtio-blk: no disk\n");
+  }
+
   kprintf("System initialized, starting scheduler...\n");
 
   need_resched = 1;
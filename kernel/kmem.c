@@ -2,6 +2,10 @@
 
 // Free-list memory allocator with coalescing
 // Replaces simple bump allocator for better memory reuse
+//
+// Size-class histograms, block counts, peak usage and the largest free
+// block are maintained as blocks change state, so kmem_stats() is O(1)
+// and never walks the heap.
 
 typedef struct mem_header {
     size_t size;              // Size of this block (excluding header)
@@ -18,6 +22,85 @@ static size_t total_allocated = 0;
 static size_t total_free = 0;
 static int initialized = 0;
 
+// Telemetry, kept up to date on every state change so that reading it
+// never walks the heap
+static size_t peak_allocated = 0;
+static u32 live_blocks = 0;
+static u32 free_blocks = 0;
+static u64 nr_allocs = 0;
+static u64 nr_frees = 0;
+static u64 nr_failures = 0;
+static u32 live_hist[KMEM_CLASSES];
+static u32 free_hist[KMEM_CLASSES];
+// Largest free block seen in each class since the class was last empty,
+// and how many free blocks have exactly that size. While that count is
+// non-zero the max is exact; after those blocks go it is an upper bound,
+// less than twice the real largest of the class.
+static size_t class_max[KMEM_CLASSES];
+static u32 class_at_max[KMEM_CLASSES];
+static u32 lat_hist[KMEM_LAT_BUCKETS];
+
+// Size class of a block: 0 is under 32 bytes, class c covers
+// [2^(c+4), 2^(c+5)) and the last one everything above
+static int size_class(size_t size) {
+    int c = 0;
+    size >>= 5;
+    while (size && c < KMEM_CLASSES - 1) {
+        size >>= 1;
+        c++;
+    }
+    return c;
+}
+
+static void free_block_add(mem_header_t *block) {
+    int c = size_class(block->size);
+
+    free_hist[c]++;
+    free_blocks++;
+    total_free += block->size;
+    if (block->size > class_max[c]) {
+        class_max[c] = block->size;
+        class_at_max[c] = 1;
+    } else if (block->size == class_max[c]) {
+        class_at_max[c]++;
+    }
+}
+
+static void free_block_del(mem_header_t *block) {
+    int c = size_class(block->size);
+
+    free_hist[c]--;
+    free_blocks--;
+    total_free -= block->size;
+    if (block->size == class_max[c] && class_at_max[c]) {
+        class_at_max[c]--;
+    }
+    if (!free_hist[c]) {
+        class_max[c] = 0;
+        class_at_max[c] = 0;
+    }
+}
+
+// Largest free block: the max of the highest class that has one, in
+// O(KMEM_CLASSES). An upper bound never exceeds the free total. IRQs off.
+static size_t largest_get(void) {
+    for (int c = KMEM_CLASSES - 1; c >= 0; c--) {
+        if (free_hist[c]) {
+            return class_max[c] < total_free ? class_max[c] : total_free;
+        }
+    }
+    return 0;
+}
+
+static void lat_add(u64 cycles) {
+    int b = 0;
+    while (cycles && b < KMEM_LAT_BUCKETS - 1) {
+        cycles >>= 1;
+        b++;
+    }
+    lat_hist[b]++;
+}
+
 // Initialize memory system
 static void kmem_init(void) {
     if (initialized) {
@@ -30,8 +113,9 @@ static void kmem_init(void) {
     free_list->free = 1;
     free_list->next = (mem_header_t *)0;
     
-    total_free = HEAP_SIZE - HEADER_SIZE;
+    total_free = 0;
     total_allocated = 0;
+    free_block_add(free_list);
     initialized = 1;
 }
 
@@ -48,7 +132,8 @@ void *kmalloc(size_t size) {
     // Align to 16 bytes
     size = (size + 15) & ~15;
     
-    disable_irq();
+    irqflags_t flags = irq_save();
+    u64 start = rdtime();
     
     // Search for first-fit block
     mem_header_t *current = free_list;
@@ -56,6 +141,7 @@ void *kmalloc(size_t size) {
     while (current) {
         if (current->free && current->size >= size) {
             // Found a suitable block
+            free_block_del(current);
             
             // Should we split this block?
             size_t remaining = current->size - size;
@@ -68,21 +154,30 @@ void *kmalloc(size_t size) {
                 
                 current->size = size;
                 current->next = new_block;
+                free_block_add(new_block);
             }
             
             // Allocate this block
             current->free = 0;
             total_allocated += current->size;
-            total_free -= current->size;
+            live_hist[size_class(current->size)]++;
+            live_blocks++;
+            nr_allocs++;
+            if (total_allocated > peak_allocated) {
+                peak_allocated = total_allocated;
+            }
             
-            enable_irq();
+            lat_add(rdtime() - start);
+            irq_restore(flags);
             return (void *)((u8 *)current + HEADER_SIZE);
         }
         
         current = current->next;
     }
     
-    enable_irq();
+    nr_failures++;
+    lat_add(rdtime() - start);
+    irq_restore(flags);
     return (void *)0;  // Out of memory
 }
 
@@ -92,21 +187,28 @@ void kfree(void *ptr) {
         return;
     }
     
-    disable_irq();
+    irqflags_t flags = irq_save();
     
     // Get header
     mem_header_t *block = (mem_header_t *)((u8 *)ptr - HEADER_SIZE);
     
-    // Mark as free
-    if (!block->free) {
-        block->free = 1;
-        total_allocated -= block->size;
-        total_free += block->size;
+    // Double free: already on the books as free
+    if (block->free) {
+        irq_restore(flags);
+        return;
     }
     
+    // Mark as free
+    block->free = 1;
+    total_allocated -= block->size;
+    live_hist[size_class(block->size)]--;
+    live_blocks--;
+    nr_frees++;
+    
     // Coalesce with next block if it's free
     if (block->next && block->next->free) {
         mem_header_t *next = block->next;
+        free_block_del(next);
         block->size += HEADER_SIZE + next->size;
         block->next = next->next;
     }
@@ -122,11 +224,34 @@ void kfree(void *ptr) {
     
     if (prev && prev->free) {
         // Coalesce with previous
+        free_block_del(prev);
         prev->size += HEADER_SIZE + block->size;
         prev->next = block->next;
+        block = prev;
     }
     
-    enable_irq();
+    free_block_add(block);
+    
+    irq_restore(flags);
+}
+
+// Allocate with the returned address aligned to 'align' (a power of two).
+// The pointer kmalloc returned is kept just below the aligned block.
+void *kmalloc_aligned(size_t size, size_t align) {
+    u8 *raw = (u8 *)kmalloc(size + align + sizeof(void *));
+    if (!raw) {
+        return (void *)0;
+    }
+
+    u64 addr = ((u64)raw + sizeof(void *) + align - 1) & ~(u64)(align - 1);
+    ((void **)addr)[-1] = raw;
+    return (void *)addr;
+}
+
+void kfree_aligned(void *ptr) {
+    if (ptr) {
+        kfree(((void **)ptr)[-1]);
+    }
 }
 
 // Get used memory
@@ -141,20 +266,38 @@ size_t kmalloc_free(void) {
 
 // Get number of free blocks
 int kmalloc_free_blocks(void) {
+    return (int)free_blocks;
+}
+
+// External fragmentation in percent: how much of the free memory is not
+// in the largest free block, i.e. unusable for one big request
+u32 kmem_frag_index(void) {
+    irqflags_t flags = irq_save();
+    u32 frag = total_free
+        ? (u32)((total_free - largest_get()) * 100 / total_free) : 0;
+    irq_restore(flags);
+    return frag;
+}
+
+// Snapshot every counter in O(1)
+void kmem_stats(kmem_stats_t *st) {
     if (!initialized) {
-        return 0;
-    }
-    
-    int count = 0;
-    mem_header_t *current = free_list;
-    
-    while (current) {
-        if (current->free) {
-            count++;
-        }
-        current = current->next;
+        kmem_init();
     }
     
-    return count;
+    irqflags_t flags = irq_save();
+    st->heap_size = HEAP_SIZE;
+    st->used = total_allocated;
+    st->free = total_free;
+    st->peak = peak_allocated;
+    st->largest_free = largest_get();
+    st->live_blocks = live_blocks;
+    st->free_blocks = free_blocks;
+    st->allocs = nr_allocs;
+    st->frees = nr_frees;
+    st->failures = nr_failures;
+    memcpy(st->live_hist, live_hist, sizeof(live_hist));
+    memcpy(st->free_hist, free_hist, sizeof(free_hist));
+    memcpy(st->lat_hist, lat_hist, sizeof(lat_hist));
+    irq_restore(flags);
 }
-
@@ -0,0 +1,201 @@
+#include "uros.h"
+
+// Kernel timers on a hierarchical timing wheel
+//
+// KTIMER_LEVELS wheels of KTIMER_SLOTS slots each. Level 0 has one slot
+// per tick; each slot of level N covers KTIMER_SLOTS^N ticks. A timer is
+// filed in the lowest level whose span reaches its deadline, so insert and
+// cancel are O(1). Every tick the due level 0 slot is spliced onto the
+// expired list in O(1); when level 0 wraps, the next slot of level 1 is
+// redistributed into level 0 (and so on up), which spreads the cost of
+// far-away timers over the ticks they wait.
+//
+// The tick only moves timers around. Callbacks run later as a softirq on
+// trap exit, with interrupts enabled, not in the trap handler itself.
+
+#define KTIMER_MASK (KTIMER_SLOTS - 1)
+#define KTIMER_SPAN (1UL << (KTIMER_SLOT_BITS * KTIMER_LEVELS))
+
+static ktimer_t *wheel[KTIMER_LEVELS][KTIMER_SLOTS];
+static u64 wheel_tick = 0; // Next tick to process
+
+// Due timers waiting for the timer softirq
+static ktimer_t *expired = (ktimer_t *)0;
+static ktimer_t **expired_tail = &expired;
+
+// Cycles spent in ktimer_tick, for bench timer
+static u64 tick_cycles = 0;
+static u64 tick_max = 0;
+static u64 tick_count = 0;
+
+static void list_add(ktimer_t **head, ktimer_t *t) {
+  t->next = *head;
+  if (t->next) {
+    t->next->pprev = &t->next;
+  }
+  t->pprev = head;
+  *head = t;
+}
+
+static void list_del(ktimer_t *t) {
+  *t->pprev = t->next;
+  if (t->next) {
+    t->next->pprev = t->pprev;
+  } else if (expired_tail == &t->next) {
+    expired_tail = t->pprev;
+  }
+  t->next = (ktimer_t *)0;
+  t->pprev = (ktimer_t **)0;
+}
+
+// File a timer in the wheel relative to wheel_tick
+static void wheel_add(ktimer_t *t) {
+  u64 expires = t->expires;
+
+  if (expires < wheel_tick) {
+    // Already due: fire on the next tick processed
+    expires = wheel_tick;
+  } else if (expires - wheel_tick >= KTIMER_SPAN) {
+    // Beyond the top level: park it in the farthest slot, it is filed
+    // again from there
+    expires = wheel_tick + KTIMER_SPAN - 1;
+  }
+
+  u64 delta = expires - wheel_tick;
+  int level = 0;
+  while (level < KTIMER_LEVELS - 1 &&
+         delta >= (1UL << (KTIMER_SLOT_BITS * (level + 1)))) {
+    level++;
+  }
+
+  int slot = (int)((expires >> (KTIMER_SLOT_BITS * level)) & KTIMER_MASK);
+  list_add(&wheel[level][slot], t);
+}
+
+// Move the slot of 'level' that is now due into the levels below it.
+// Returns the slot index; zero means the level above wrapped too.
+static int cascade(int level) {
+  int slot = (int)((wheel_tick >> (KTIMER_SLOT_BITS * level)) & KTIMER_MASK);
+  ktimer_t *t = wheel[level][slot];
+
+  wheel[level][slot] = (ktimer_t *)0;
+  while (t) {
+    ktimer_t *next = t->next;
+    wheel_add(t);
+    t = next;
+  }
+  return slot;
+}
+
+void ktimer_init(void) {
+  for (int l = 0; l < KTIMER_LEVELS; l++) {
+    for (int s = 0; s < KTIMER_SLOTS; s++) {
+      wheel[l][s] = (ktimer_t *)0;
+    }
+  }
+  wheel_tick = g_ticks;
+  expired = (ktimer_t *)0;
+  expired_tail = &expired;
+}
+
+// ktimer_add and ktimer_cancel may be called with IRQs on or off
+void ktimer_add(ktimer_t *t, u64 deadline, void (*fn)(void *), void *arg) {
+  irqflags_t flags = irq_save();
+
+  if (t->pending) {
+    list_del(t);
+  }
+  t->expires = deadline;
+  t->fn = fn;
+  t->arg = arg;
+  t->pending = 1;
+  wheel_add(t);
+
+  irq_restore(flags);
+}
+
+// Returns 1 if the timer was pending and will not fire
+int ktimer_cancel(ktimer_t *t) {
+  irqflags_t flags = irq_save();
+
+  int was_pending = t->pending;
+  if (was_pending) {
+    list_del(t);
+    t->pending = 0;
+  }
+
+  irq_restore(flags);
+  return was_pending;
+}
+
+// Process every tick up to 'now'. Called from the timer interrupt.
+// Returns 1 if callbacks are waiting for the timer softirq (the worker
+// when softirq deferral is off).
+int ktimer_tick(u64 now) {
+  u64 start = rdtime();
+
+  while (wheel_tick <= now) {
+    int slot = (int)(wheel_tick & KTIMER_MASK);
+
+    // Level 0 wrapped: pull the next slot of each level that wrapped
+    if (slot == 0) {
+      for (int level = 1; level < KTIMER_LEVELS && cascade(level) == 0;
+           level++) {
+      }
+    }
+
+    // Splice the due slot onto the expired list
+    ktimer_t *t = wheel[0][slot];
+    if (t) {
+      wheel[0][slot] = (ktimer_t *)0;
+      t->pprev = expired_tail;
+      *expired_tail = t;
+      while (t->next) {
+        t = t->next;
+      }
+      expired_tail = &t->next;
+    }
+    wheel_tick++;
+  }
+
+  u64 spent = rdtime() - start;
+  tick_cycles += spent;
+  tick_count++;
+  if (spent > tick_max) {
+    tick_max = spent;
+  }
+
+  return expired != (ktimer_t *)0;
+}
+
+// Run every expired callback. Called from softirq or worker context.
+void ktimer_run_expired(void) {
+  while (1) {
+    irqflags_t flags = irq_save();
+    ktimer_t *t = expired;
+    if (!t) {
+      irq_restore(flags);
+      return;
+    }
+    list_del(t);
+    t->pending = 0;
+    void (*fn)(void *) = t->fn;
+    void *arg = t->arg;
+    irq_restore(flags);
+
+    fn(arg);
+  }
+}
+
+void ktimer_stats(u64 *avg_cycles, u64 *max_cycles) {
+  *avg_cycles = tick_count ? tick_cycles / tick_count : 0;
+  *max_cycles = tick_max;
+}
+
+void ktimer_reset_stats(void) {
+  irqflags_t flags = irq_save();
+  tick_cycles = 0;
+  tick_max = 0;
+  tick_count = 0;
+  irq_restore(flags);
+}
@@ -0,0 +1,184 @@
+#include "uros.h"
+
+// Workload trace replay
+//
+// A trace is embedded in the kernel image by kernel/trace_blob.S. It lists
+// tasks in arrival order, each with a sequence of (CPU burst, I/O wait)
+// pairs measured in ticks. The replay driver spawns every task at its
+// arrival tick and the task reproduces its bursts, so two scheduling
+// policies can be compared on exactly the same input.
+
+#define TRACE_MAGIC 0x43525455 // "UTRC"
+#define TRACE_VERSION 1
+
+typedef struct {
+  u32 magic;
+  u8 version;
+  u8 reserved;
+  u16 ntasks;
+} trace_header_t;
+
+typedef struct {
+  u32 arrival; // Arrival tick, relative to the start of the replay
+  u16 nbursts;
+  u16 reserved;
+} trace_task_t;
+
+typedef struct {
+  u16 cpu; // CPU burst in ticks
+  u16 io;  // I/O wait after the burst in ticks
+} trace_burst_t;
+
+typedef struct {
+  const trace_task_t *rec;
+  const trace_burst_t *bursts;
+  int pid;
+  int done;
+} replay_slot_t;
+
+extern const u8 trace_blob_start[];
+extern const u8 trace_blob_end[];
+
+static replay_slot_t slots[REPLAY_MAX_TASKS];
+static int slot_count = -1;
+
+// Validate the embedded trace and index its task records
+static int replay_parse(void) {
+  const u8 *p = trace_blob_start;
+  const u8 *end = trace_blob_end;
+
+  if ((size_t)(end - p) < sizeof(trace_header_t)) {
+    return -1;
+  }
+
+  const trace_header_t *hdr = (const trace_header_t *)p;
+  if (hdr->magic != TRACE_MAGIC || hdr->version != TRACE_VERSION) {
+    return -1;
+  }
+  if (hdr->ntasks > REPLAY_MAX_TASKS) {
+    return -1;
+  }
+  p += sizeof(trace_header_t);
+
+  u32 last_arrival = 0;
+  for (int i = 0; i < hdr->ntasks; i++) {
+    if ((size_t)(end - p) < sizeof(trace_task_t)) {
+      return -1;
+    }
+    const trace_task_t *rec = (const trace_task_t *)p;
+    p += sizeof(trace_task_t);
+
+    size_t burst_bytes = rec->nbursts * sizeof(trace_burst_t);
+    if (rec->nbursts == 0 || (size_t)(end - p) < burst_bytes ||
+        rec->arrival < last_arrival) {
+      return -1;
+    }
+
+    slots[i].rec = rec;
+    slots[i].bursts = (const trace_burst_t *)p;
+    last_arrival = rec->arrival;
+    p += burst_bytes;
+  }
+
+  return hdr->ntasks;
+}
+
+int replay_task_count(void) {
+  if (slot_count < 0) {
+    slot_count = replay_parse();
+  }
+  return slot_count;
+}
+
+// Replayed task: alternate CPU bursts and I/O waits from the trace
+static void replay_task(void *arg) {
+  replay_slot_t *slot = (replay_slot_t *)arg;
+  pcb_t *self = sched_current();
+
+  for (int i = 0; i < slot->rec->nbursts; i++) {
+    const trace_burst_t *b = &slot->bursts[i];
+
+    // CPU burst: burn until this task has been charged the burst length
+    u64 target = self->ticks_used + b->cpu;
+    while (self->ticks_used < target) {
+      volatile int sum = 0;
+      for (int j = 0; j < 1000; j++) {
+        sum += j;
+      }
+      sched_maybe_yield_safe();
+    }
+
+    // I/O wait: block until the wait has elapsed
+    if (b->io) {
+      task_sleep(b->io);
+    }
+  }
+}
+
+int replay_run(sched_mode_t mode, replay_metrics_t *out) {
+  int n = replay_task_count();
+  if (n <= 0) {
+    return n;
+  }
+
+  sched_mode_t prev_mode = sched_get_mode();
+  sched_set_mode(mode);
+
+  for (int i = 0; i < n; i++) {
+    slots[i].pid = -1;
+    slots[i].done = 0;
+    memset(&out[i], 0, sizeof(replay_metrics_t));
+  }
+
+  u64 t0 = g_ticks;
+  int spawned = 0;
+  int finished = 0;
+
+  while (finished < n) {
+    // Release every task whose arrival tick has been reached
+    while (spawned < n && g_ticks - t0 >= slots[spawned].rec->arrival) {
+      replay_slot_t *slot = &slots[spawned];
+      u16 hint = slot->bursts[0].cpu;
+      slot->pid = task_create(replay_task, slot, hint);
+      if (slot->pid < 0) {
+        // Out of task slots: count it as finished so the replay ends
+        out[spawned].pid = -1;
+        slot->done = 1;
+        finished++;
+      }
+      spawned++;
+    }
+
+    // Collect metrics from tasks that have exited
+    for (int i = 0; i < spawned; i++) {
+      replay_slot_t *slot = &slots[i];
+      if (slot->done) {
+        continue;
+      }
+
+      pcb_t *task = task_get_by_pid(slot->pid);
+      if (!task || task->state != TASK_ZOMBIE) {
+        continue;
+      }
+
+      replay_metrics_t *m = &out[i];
+      m->pid = slot->pid;
+      m->arrival = slot->rec->arrival;
+      m->response = (u32)(task->start_time - task->arrival_time);
+      m->turnaround = (u32)(task->finish_time - task->arrival_time);
+      m->cpu = (u32)task->ticks_used;
+      for (int b = 0; b < slot->rec->nbursts; b++) {
+        m->io += slot->bursts[b].io;
+      }
+
+      task_reap(slot->pid);
+      slot->done = 1;
+      finished++;
+    }
+
+    task_yield();
+  }
+
+  sched_set_mode(prev_mode);
+  return n;
+}
@@ -1,49 +1,85 @@
 #include "uros.h"
 
-extern pcb_t *task_get_table(void);
-extern int task_get_max_tasks(void);
-
 static sched_mode_t current_mode = SCHED_RR;
 static pcb_t *current_task = (pcb_t *)0;
 static int quantum_left = RR_QUANTUM;
 static int preempt_enabled = CONFIG_PREEMPT_DEFAULT;
+static u64 slice_start = 0; // rdtime() when the current task was dispatched
+static int burst_alpha = BURST_ALPHA_DEFAULT;
+
+#define CYCLES_PER_TICK (TIMEBASE_HZ / TICK_HZ)
 
-// Simple ready queue (array of task pointers)
-static pcb_t *ready_queue[MAX_TASKS];
-static int ready_head = 0;
-static int ready_tail = 0;
+// FIFO ready queue linked through pcb_t.rq_next, used by RR and SJF
+static pcb_t *ready_head = (pcb_t *)0;
+static pcb_t *ready_tail = (pcb_t *)0;
 static int ready_count = 0;
 
+// Per-hart scheduler state. The idle task never enters a run queue: the
+// hart falls back to it only when the queue is empty. The worker runs
+// deferred work (timer callbacks) ahead of every queued task whenever it
+// has been kicked. There is a single hart for now.
+typedef struct {
+  pcb_t *idle;
+  pcb_t *worker;
+  int kick;        // Worker has work to do
+  u64 nr_switches; // Context switches performed on this hart
+  u64 nr_idle;     // How many of them switched to idle
+} sched_hart_t;
+
+static sched_hart_t hart0;
+
+// Load averages over 1, 5 and 15 seconds, LOAD_FSHIFT fixed point. The
+// decay factors are LOAD_FIXED_1 * exp(-LOAD_FREQ ticks / period).
+static u64 loadavg[3];
+static const u64 load_exp[3] = {1853, 2007, 2034};
+static int load_countdown = LOAD_FREQ;
+
+// Ready -> running latency of every dispatch, by the policy it ran under
+static schedlat_t lat_by_mode[SCHED_NR_MODES];
+
+static sched_hart_t *this_hart(void) { return &hart0; }
+
+static int is_idle(pcb_t *task) { return task == this_hart()->idle; }
+
 void sched_init(void) {
   current_mode = SCHED_RR;
   current_task = (pcb_t *)0;
   quantum_left = RR_QUANTUM;
-  ready_head = 0;
-  ready_tail = 0;
+  ready_head = (pcb_t *)0;
+  ready_tail = (pcb_t *)0;
   ready_count = 0;
+  memset(&hart0, 0, sizeof(hart0));
+  memset(lat_by_mode, 0, sizeof(lat_by_mode));
+  memset(loadavg, 0, sizeof(loadavg));
+  load_countdown = LOAD_FREQ;
+  mlfq_init();
+  fair_init();
+  edf_init();
 }
 
-void sched_add_ready(pcb_t *task) {
-  if (!task || ready_count >= MAX_TASKS) {
-    return;
-  }
-
-  u64 sstatus;
-  __asm__ volatile("csrr %0, sstatus" : "=r"(sstatus));
-  int interrupts_were_enabled = (sstatus & (1UL << 1)) != 0;
-  if (interrupts_were_enabled) {
-    disable_irq();
+static void rq_push(pcb_t *task) {
+  task->rq_next = (pcb_t *)0;
+  if (ready_tail) {
+    ready_tail->rq_next = task;
+  } else {
+    ready_head = task;
   }
-
-  ready_queue[ready_tail] = task;
-  ready_tail = (ready_tail + 1) % MAX_TASKS;
+  ready_tail = task;
   ready_count++;
-  task->state = TASK_READY;
-  need_resched = 1;
+}
 
-  if (interrupts_were_enabled) {
-    enable_irq();
+// Unlink a task from the FIFO; prev is its predecessor or NULL
+static void rq_unlink(pcb_t *prev, pcb_t *task) {
+  if (prev) {
+    prev->rq_next = task->rq_next;
+  } else {
+    ready_head = task->rq_next;
+  }
+  if (ready_tail == task) {
+    ready_tail = prev;
   }
+  task->rq_next = (pcb_t *)0;
+  ready_count--;
 }
 
 static pcb_t *sched_pick_next_rr(void) {
@@ -51,159 +87,791 @@ static pcb_t *sched_pick_next_rr(void) {
     return (pcb_t *)0;
   }
 
-  pcb_t *task = ready_queue[ready_head];
-  ready_head = (ready_head + 1) % MAX_TASKS;
-  ready_count--;
+  pcb_t *task = ready_head;
+  rq_unlink((pcb_t *)0, task);
 
   quantum_left = RR_QUANTUM;
   return task;
 }
 
+// CPU time used in the current burst, in 1/1024 tick
+static u64 burst_elapsed(pcb_t *task) {
+  u64 exec = task->sum_exec;
+  if (task == current_task && task->state == TASK_RUNNING) {
+    exec += rdtime() - task->exec_start;
+  }
+  return ((exec - task->burst_start) << BURST_FP_SHIFT) / CYCLES_PER_TICK;
+}
+
+// SJF orders by the predicted burst, SRTF by what is left of it
+static u64 burst_key(pcb_t *task) {
+  if (current_mode != SCHED_SRTF) {
+    return task->burst_avg;
+  }
+
+  u64 elapsed = burst_elapsed(task);
+  return task->burst_avg > elapsed ? task->burst_avg - elapsed : 0;
+}
+
 static pcb_t *sched_pick_next_sjf(void) {
   if (ready_count == 0) {
     return (pcb_t *)0;
   }
 
   // Find task with minimum burst estimate
-  int best_idx = -1;
-  int best_offset = -1;
+  pcb_t *best = (pcb_t *)0;
+  pcb_t *best_prev = (pcb_t *)0;
   u64 min_burst = ~0UL;
 
-  for (int i = 0; i < ready_count; i++) {
-    int idx = (ready_head + i) % MAX_TASKS;
-    pcb_t *task = ready_queue[idx];
+  for (pcb_t *prev = (pcb_t *)0, *task = ready_head; task;
+       prev = task, task = task->rq_next) {
+    u64 key = burst_key(task);
 
-    if (task->burst_estimate < min_burst ||
-        (task->burst_estimate == min_burst &&
-         (best_idx == -1 ||
-          task->arrival_time < ready_queue[best_idx]->arrival_time))) {
-      min_burst = task->burst_estimate;
-      best_idx = idx;
-      best_offset = i;
+    if (key < min_burst || (key == min_burst && (!best || task->arrival_time <
+                                                            best->arrival_time))) {
+      min_burst = key;
+      best = task;
+      best_prev = prev;
     }
   }
 
-  if (best_idx == -1) {
+  if (!best) {
     return (pcb_t *)0;
   }
 
-  // Remove from queue
-  pcb_t *task = ready_queue[best_idx];
+  rq_unlink(best_prev, best);
+  return best;
+}
 
-  // Shift queue to remove the selected task
-  // We only shift elements AFTER the removed task
-  for (int i = best_offset; i < ready_count - 1; i++) {
-    int dst_idx = (ready_head + i) % MAX_TASKS;
-    int src_idx = (ready_head + i + 1) % MAX_TASKS;
-    ready_queue[dst_idx] = ready_queue[src_idx];
+// Tasks in the EDF tree: real-time ones, and any task that inherited a
+// deadline from a real-time mutex waiter
+static int edf_has_deadline(pcb_t *task) {
+  return task->dl_period || (task->pi_boosted && task->dl_abs_deadline);
+}
+
+// Run queue dispatch on the current policy. Callers hold IRQs off.
+static void rq_enqueue(pcb_t *task) {
+  switch (current_mode) {
+  case SCHED_MLFQ:
+    mlfq_enqueue(task);
+    break;
+  case SCHED_FAIR:
+    fair_enqueue(task);
+    break;
+  case SCHED_EDF:
+    // Tasks without real-time parameters run in the background
+    if (edf_has_deadline(task)) {
+      edf_enqueue(task);
+    } else {
+      rq_push(task);
+    }
+    break;
+  default:
+    rq_push(task);
+    break;
   }
+}
 
-  ready_count--;
-  ready_tail = (ready_tail - 1 + MAX_TASKS) % MAX_TASKS;
+static pcb_t *rq_pick_next(void) {
+  switch (current_mode) {
+  case SCHED_SJF:
+  case SCHED_SRTF:
+    return sched_pick_next_sjf();
+  case SCHED_MLFQ:
+    return mlfq_pick_next();
+  case SCHED_FAIR:
+    return fair_pick_next();
+  case SCHED_EDF: {
+    pcb_t *task = edf_pick_next();
+    return task ? task : sched_pick_next_rr();
+  }
+  default:
+    return sched_pick_next_rr();
+  }
+}
 
-  return task;
+static void rq_remove(pcb_t *task) {
+  switch (current_mode) {
+  case SCHED_MLFQ:
+    mlfq_remove(task);
+    return;
+  case SCHED_FAIR:
+    fair_remove(task);
+    return;
+  case SCHED_EDF:
+    if (edf_has_deadline(task)) {
+      edf_remove(task);
+      return;
+    }
+    break;
+  default:
+    break;
+  }
+
+  pcb_t *prev = (pcb_t *)0;
+  for (pcb_t *cur = ready_head; cur; prev = cur, cur = cur->rq_next) {
+    if (cur == task) {
+      rq_unlink(prev, task);
+      return;
+    }
+  }
+}
+
+static int rq_count(void) {
+  switch (current_mode) {
+  case SCHED_MLFQ:
+    return mlfq_ready_count();
+  case SCHED_FAIR:
+    return fair_ready_count();
+  case SCHED_EDF:
+    return edf_ready_count() + ready_count;
+  default:
+    return ready_count;
+  }
+}
+
+static void schedlat_add(schedlat_t *lat, u64 cycles) {
+  u64 us = cycles / (TIMEBASE_HZ / 1000000);
+  int b = 0;
+
+  while (us && b < SCHEDLAT_BUCKETS - 1) {
+    us >>= 1;
+    b++;
+  }
+  lat->hist[b]++;
+  lat->count++;
+  if (cycles > lat->max) {
+    lat->max = cycles;
+  }
 }
 
-void sched_yield(void) {
-  disable_irq();
+// Charge the CPU time used since the task was dispatched or last charged
+static void sched_account(pcb_t *task, u64 now) {
+  u64 delta = now - task->exec_start;
+
+  task->exec_start = now;
+  task->sum_exec += delta;
+  fair_charge(task, delta);
+}
 
+// A CPU burst ended (yield, block or exit): feed it into the estimate
+static void sched_end_burst(pcb_t *task) {
+  if (task->sum_exec == task->burst_start) {
+    return;
+  }
+
+  u64 actual = burst_elapsed(task);
+  // A boosted task keeps the inherited estimate; its own one is updated
+  u64 *avg = task->pi_boosted ? &task->pi_burst_avg : &task->burst_avg;
+  u64 estimate = *avg;
+
+  task->burst_err += actual > estimate ? actual - estimate : estimate - actual;
+  task->burst_count++;
+
+  // Exponential averaging: τ_new = α * real_burst + (1-α) * τ_old
+  *avg = ((u64)burst_alpha * actual + (u64)(100 - burst_alpha) * estimate) /
+         100;
+  task->burst_estimate =
+      (*avg + (1UL << (BURST_FP_SHIFT - 1))) >> BURST_FP_SHIFT;
+  task->burst_start = task->sum_exec;
+}
+
+void sched_add_ready(pcb_t *task) {
+  if (!task) {
+    return;
+  }
+
+  irqflags_t flags = irq_save();
+
+  task->state = TASK_READY;
+  task->ready_stamp = rdtime();
+  rq_enqueue(task);
+
+  // SRTF only preempts for a task that would finish sooner
+  if (current_mode != SCHED_SRTF || !current_task ||
+      current_task->state != TASK_RUNNING || is_idle(current_task) ||
+      burst_key(task) < burst_key(current_task)) {
+    need_resched = 1;
+  }
+
+  irq_restore(flags);
+}
+
+// Sleep timer callback, runs in the timer softirq (the worker when
+// softirq deferral is off)
+static void sleep_timeout(void *arg) {
+  irqflags_t flags = irq_save();
+  sched_wakeup((pcb_t *)arg);
+  irq_restore(flags);
+}
+
+static void sleep_insert(pcb_t *task, u64 wake_tick) {
+  task->state = TASK_SLEEPING;
+  ktimer_add(&task->sleep_timer, wake_tick, sleep_timeout, task);
+}
+
+// Switch to the next task. 'preempted' is set when the scheduler asked
+// for the switch rather than the task giving up the CPU itself. Called
+// with IRQs off and returns with them off, once this task runs again; they
+// stay off across ctx_switch, so a task that marked itself TASK_SLEEPING
+// cannot be woken and queued before it is off the CPU.
+static void sched_switch_locked(int preempted) {
+  sched_hart_t *hart = this_hart();
   pcb_t *prev = current_task;
   pcb_t *next;
+  u64 now = rdtime();
+
+  if (prev && prev->kthread) {
+    // Idle and the worker are not queued. A preempted worker keeps its
+    // kick so it is picked again right away.
+    sched_account(prev, now);
+    if (prev == hart->worker && prev->state == TASK_RUNNING) {
+      hart->kick = 1;
+    }
+    if (prev->state == TASK_RUNNING) {
+      prev->state = TASK_READY;
+    }
+  } else if (prev) {
+    sched_account(prev, now);
+
+    // SJF is non-preemptive: the running task keeps the CPU until it
+    // yields, blocks or exits
+    if (preempted && current_mode == SCHED_SJF &&
+        prev->state == TASK_RUNNING && !hart->kick) {
+      need_resched = 0;
+      return;
+    }
 
-  // Pick next task based on mode
-  if (current_mode == SCHED_RR) {
-    next = sched_pick_next_rr();
+    // A preempted task is still in the middle of its burst
+    if (!preempted) {
+      sched_end_burst(prev);
+    }
+  }
+
+  // Put the current task back first so it competes with the ready tasks.
+  // A real-time task that overran its budget waits for its next release.
+  if (prev && prev->state == TASK_RUNNING) {
+    if (prev->dl_throttled) {
+      prev->dl_throttled = 0;
+      prev->dl_wait_release = 1;
+      sleep_insert(prev, edf_next_release(prev));
+    } else {
+      prev->state = TASK_READY;
+      prev->ready_stamp = now;
+      rq_enqueue(prev);
+    }
+  }
+
+  // Pending deferred work first, then the policy's pick, then idle
+  if (hart->kick && hart->worker) {
+    hart->kick = 0;
+    next = hart->worker;
   } else {
-    next = sched_pick_next_sjf();
+    next = rq_pick_next();
+    if (!next) {
+      next = hart->idle;
+    }
   }
 
-  // If no task available, stay idle or re-run current
+  // Nothing to run (idle not created yet)
   if (!next) {
-    enable_irq();
     return;
   }
 
-  // Save current task back to ready queue if still runnable
-  if (prev && prev->state == TASK_RUNNING) {
-    prev->state = TASK_READY;
-    sched_add_ready(prev);
-  }
-
   // Update task metrics
+  if (next->ready_stamp) {
+    u64 lat = now - next->ready_stamp;
+    next->ready_stamp = 0;
+    next->sum_wait += lat;
+    schedlat_add(&next->lat, lat);
+    schedlat_add(&lat_by_mode[current_mode], lat);
+  }
   if (next->start_time == 0) {
     next->start_time = g_ticks;
     next->wait_time = g_ticks - next->arrival_time;
   }
 
   next->state = TASK_RUNNING;
+  next->exec_start = now;
+  slice_start = now;
   current_task = next;
 
   // Clear resched flag
   need_resched = 0;
 
-  enable_irq();
+  if (prev != next) {
+    hart->nr_switches++;
+    next->nr_switches++;
+    if (next == hart->idle) {
+      hart->nr_idle++;
+    }
+  }
 
   // Context switch
   if (prev && prev != next) {
+    task_check_stack(prev);
     ctx_switch(&prev->context, &next->context);
+
+    // Back on this task's stack: detached tasks that exited meanwhile can
+    // have theirs freed now
+    task_reap_dead();
   } else if (!prev && next) {
     // First task - no previous context to save
     ctx_switch((context_t *)0, &next->context);
   }
 }
 
+static void sched_switch(int preempted) {
+  irqflags_t flags = irq_save();
+  sched_switch_locked(preempted);
+  irq_restore(flags);
+}
+
+void sched_yield(void) { sched_switch(0); }
+
+// Block the current task until the given tick. Called inside irq_save();
+// interrupts stay off until it is switched out and go back to 'flags'
+// once it has been woken.
+static void sched_sleep_until(pcb_t *self, u64 wake_tick, irqflags_t flags) {
+  sleep_insert(self, wake_tick);
+  sched_switch_locked(0);
+  irq_restore(flags);
+}
+
+// Block the current task for the given number of ticks
+void sched_sleep(u64 ticks) {
+  pcb_t *self = current_task;
+  if (!self) {
+    return;
+  }
+
+  irqflags_t flags = irq_save();
+  sched_sleep_until(self, g_ticks + (ticks ? ticks : 1), flags);
+}
+
+// End the current job of a periodic task and sleep until the next release
+void sched_wait_period(void) {
+  pcb_t *self = current_task;
+  if (!self || !self->dl_period) {
+    return;
+  }
+
+  irqflags_t flags = irq_save();
+
+  // A job that finished late is counted as a miss
+  edf_check_miss(self);
+  self->dl_throttled = 0;
+  self->dl_release += self->dl_period;
+
+  if (self->dl_release <= g_ticks) {
+    // Already past the next release: start that job right away
+    edf_replenish(self);
+    irq_restore(flags);
+    return;
+  }
+
+  self->dl_wait_release = 1;
+  sched_sleep_until(self, self->dl_release, flags);
+}
+
+// Make a blocked task runnable again
+void sched_wakeup(pcb_t *task) {
+  if (!task || task->state != TASK_SLEEPING) {
+    return;
+  }
+
+  task->wake_stamp = rdtime();
+  ktimer_cancel(&task->sleep_timer);
+  if (task->dl_wait_release) {
+    task->dl_wait_release = 0;
+    edf_replenish(task);
+  }
+
+  if (current_mode == SCHED_MLFQ) {
+    mlfq_wakeup(task);
+  } else if (current_mode == SCHED_FAIR) {
+    fair_wakeup(task);
+  }
+  sched_add_ready(task);
+}
+
+void wq_init(wait_queue_t *wq) {
+  wq->head = (pcb_t *)0;
+  wq->tail = (pcb_t *)0;
+}
+
+static void wq_unlink(wait_queue_t *wq, pcb_t *task) {
+  pcb_t *prev = (pcb_t *)0;
+  pcb_t *cur = wq->head;
+
+  while (cur && cur != task) {
+    prev = cur;
+    cur = cur->wq_next;
+  }
+  if (!cur) {
+    return;
+  }
+
+  if (prev) {
+    prev->wq_next = task->wq_next;
+  } else {
+    wq->head = task->wq_next;
+  }
+  if (wq->tail == task) {
+    wq->tail = prev;
+  }
+  task->wq_next = (pcb_t *)0;
+  task->wq = (wait_queue_t *)0;
+}
+
+// Block the current task on a wait queue until it is woken. Called inside
+// the caller's irq_save(), whose 'flags' the tasks that run meanwhile do
+// not need: IRQs stay off until the switch and are off again when it
+// returns.
+void sched_block(wait_queue_t *wq, irqflags_t flags) {
+  pcb_t *self = current_task;
+  (void)flags;
+
+  self->wq = wq;
+  self->wq_next = (pcb_t *)0;
+  if (wq->tail) {
+    wq->tail->wq_next = self;
+  } else {
+    wq->head = self;
+  }
+  wq->tail = self;
+  self->state = TASK_SLEEPING;
+  sched_switch_locked(0);
+}
+
+// Wake the task at the head of a wait queue. Returns 0 if it was empty.
+// Called with IRQs off.
+int sched_wake_one(wait_queue_t *wq) {
+  pcb_t *task = wq->head;
+  if (!task) {
+    return 0;
+  }
+
+  wq_unlink(wq, task);
+  sched_wakeup(task);
+  return 1;
+}
+
+void sched_wake_all(wait_queue_t *wq) {
+  while (sched_wake_one(wq)) {
+  }
+}
+
+// Take a task that is about to be destroyed off the run, sleep or wait
+// queue. Called with IRQs off.
+void sched_remove(pcb_t *task) {
+  if (task->state == TASK_READY) {
+    rq_remove(task);
+  } else if (task->wq) {
+    wq_unlink(task->wq, task);
+  } else if (task->state == TASK_SLEEPING) {
+    ktimer_cancel(&task->sleep_timer);
+  }
+}
+
+static u64 edf_key(pcb_t *task) {
+  return edf_has_deadline(task) ? task->dl_abs_deadline : ~0UL;
+}
+
+// 1 if a would be picked before b under the current policy. RR and FAIR
+// have no priorities to inherit.
+int sched_prio_higher(pcb_t *a, pcb_t *b) {
+  switch (current_mode) {
+  case SCHED_SJF:
+  case SCHED_SRTF:
+    return burst_key(a) < burst_key(b);
+  case SCHED_MLFQ:
+    return mlfq_prio(a) < mlfq_prio(b);
+  case SCHED_EDF:
+    return edf_key(a) < edf_key(b);
+  default:
+    return 0;
+  }
+}
+
+// Priority inheritance: run 'task' with the scheduling keys of 'donor'
+// where they are better than its own (burst estimate, MLFQ level,
+// deadline), or with its own again if donor is NULL. Its own keys are
+// saved while boosted. Called with IRQs off.
+void sched_pi_set(pcb_t *task, pcb_t *donor) {
+  int queued = task->state == TASK_READY && task != current_task &&
+               !task->kthread;
+  if (queued) {
+    rq_remove(task);
+  }
+
+  if (task->pi_boosted) {
+    task->burst_avg = task->pi_burst_avg;
+    task->mlfq_level = task->pi_mlfq_level;
+    task->mlfq_epoch = task->pi_mlfq_epoch;
+    task->dl_abs_deadline = task->pi_deadline;
+    task->pi_boosted = 0;
+  }
+
+  if (donor && sched_prio_higher(donor, task)) {
+    u64 deadline = edf_key(donor) < edf_key(task) ? donor->dl_abs_deadline
+                                                  : task->dl_abs_deadline;
+    int level = mlfq_prio(donor) < mlfq_prio(task) ? mlfq_prio(donor)
+                                                   : task->mlfq_level;
+
+    task->pi_burst_avg = task->burst_avg;
+    task->pi_mlfq_level = task->mlfq_level;
+    task->pi_mlfq_epoch = task->mlfq_epoch;
+    task->pi_deadline = task->dl_abs_deadline;
+    task->pi_boosted = 1;
+
+    if (donor->burst_avg < task->burst_avg) {
+      task->burst_avg = donor->burst_avg;
+    }
+    if (level != task->mlfq_level) {
+      task->mlfq_level = level;
+      task->mlfq_epoch = donor->mlfq_epoch;
+    }
+    task->dl_abs_deadline = deadline;
+  }
+
+  if (queued) {
+    rq_enqueue(task);
+  }
+}
+
+// Fold the current run queue length into the load averages
+static void calc_load(void) {
+  u64 n = (u64)rq_count();
+  if (current_task && !is_idle(current_task) &&
+      current_task->state == TASK_RUNNING) {
+    n++;
+  }
+
+  n <<= LOAD_FSHIFT;
+  for (int i = 0; i < 3; i++) {
+    loadavg[i] = (loadavg[i] * load_exp[i] + n * (LOAD_FIXED_1 - load_exp[i]) +
+                  (LOAD_FIXED_1 >> 1)) >>
+                 LOAD_FSHIFT;
+  }
+}
+
 void sched_on_tick(void) {
+  if (--load_countdown <= 0) {
+    load_countdown = LOAD_FREQ;
+    calc_load();
+  }
+
   if (!current_task) {
-    if (ready_count > 0) {
+    if (rq_count() > 0) {
       need_resched = 1;
     }
     return;
   }
 
-  if (current_task->pid != 0) {
-    current_task->ticks_used++;
+  u64 now = rdtime();
+  sched_account(current_task, now);
+
+  // Idle gives way to anything that became ready; the policies below only
+  // ever see real tasks
+  if (is_idle(current_task)) {
+    if (rq_count() > 0) {
+      need_resched = 1;
+    }
+    return;
   }
 
-  if (current_mode == SCHED_RR) {
-    if (preempt_enabled) {
-      if (--quantum_left <= 0) {
-        need_resched = 1;
-        quantum_left = RR_QUANTUM;
-      }
+  // The worker runs until it has drained its work
+  if (current_task->kthread) {
+    return;
+  }
+
+  current_task->ticks_used++;
+
+  if (current_mode == SCHED_FAIR) {
+    if (fair_on_tick(current_task, now - slice_start)) {
+      need_resched = 1;
     }
-  } else {
-    // SJF is non-preemptive; if idle is running but work exists, request
-    // resched
-    if (current_task->pid == 0 && ready_count > 0) {
+    return;
+  }
+
+  if (current_mode == SCHED_EDF) {
+    if (edf_on_tick(current_task)) {
+      need_resched = 1;
+    }
+    return;
+  }
+
+  if (current_mode == SCHED_MLFQ) {
+    // MLFQ decides for itself when the running task must give up the CPU
+    if (mlfq_on_tick(current_task)) {
+      need_resched = 1;
+    }
+    return;
+  }
+
+  if (current_mode == SCHED_RR) {
+    if (!preempt_enabled) {
+      // Cooperative RR: reschedule at every tick boundary, so tasks that
+      // only call sched_maybe_yield_safe still take turns
+      need_resched = 1;
+    } else if (--quantum_left <= 0) {
       need_resched = 1;
+      quantum_left = RR_QUANTUM;
     }
   }
+  // SJF and SRTF only switch on yields and arrivals
 }
 
 void sched_set_mode(sched_mode_t mode) {
-  disable_irq();
+  irqflags_t flags = irq_save();
+
+  // Move ready tasks over to the new policy's run queue, keeping them on
+  // a temporary list linked through rq_next in the old pick order
+  if (mode != current_mode) {
+    pcb_t *head = (pcb_t *)0;
+    pcb_t *tail = (pcb_t *)0;
+    pcb_t *task;
+
+    while ((task = rq_pick_next()) != (pcb_t *)0) {
+      task->rq_next = (pcb_t *)0;
+      if (tail) {
+        tail->rq_next = task;
+      } else {
+        head = task;
+      }
+      tail = task;
+    }
+    current_mode = mode;
+    while (head) {
+      task = head;
+      head = task->rq_next;
+      rq_enqueue(task);
+    }
+  }
+
   current_mode = mode;
   if (mode == SCHED_RR) {
     quantum_left = RR_QUANTUM;
   }
-  enable_irq();
+  irq_restore(flags);
 }
 
 sched_mode_t sched_get_mode(void) { return current_mode; }
 
+const char *sched_mode_name(sched_mode_t mode) {
+  switch (mode) {
+  case SCHED_RR:
+    return "RR";
+  case SCHED_SJF:
+    return "SJF";
+  case SCHED_MLFQ:
+    return "MLFQ";
+  case SCHED_FAIR:
+    return "FAIR";
+  case SCHED_EDF:
+    return "EDF";
+  case SCHED_SRTF:
+    return "SRTF";
+  default:
+    return "?";
+  }
+}
+
 pcb_t *sched_current(void) { return current_task; }
 
-void sched_update_burst_estimate(pcb_t *task) {
-  if (!task) {
+// Load averages in hundredths
+void sched_loadavg(u32 load[3]) {
+  for (int i = 0; i < 3; i++) {
+    load[i] = (u32)((loadavg[i] * 100 + (LOAD_FIXED_1 >> 1)) >> LOAD_FSHIFT);
+  }
+}
+
+void sched_latency(sched_mode_t mode, schedlat_t *out) {
+  irqflags_t flags = irq_save();
+  *out = lat_by_mode[mode];
+  irq_restore(flags);
+}
+
+// Clear the per-policy and per-task histograms
+void sched_latency_reset(void) {
+  irqflags_t flags = irq_save();
+  memset(lat_by_mode, 0, sizeof(lat_by_mode));
+  for (int i = 0; i < MAX_TASKS; i++) {
+    pcb_t *task = task_get_slot(i);
+    if (task) {
+      memset(&task->lat, 0, sizeof(task->lat));
+    }
+  }
+  irq_restore(flags);
+}
+
+// Latency below which pct percent of the samples fall, in rdtime cycles.
+// Resolved to the upper edge of a bucket, and never above the maximum.
+u64 schedlat_percentile(const schedlat_t *lat, int pct) {
+  if (!lat->count) {
+    return 0;
+  }
+
+  u64 want = (lat->count * (u64)pct + 99) / 100;
+  u64 seen = 0;
+  for (int b = 0; b < SCHEDLAT_BUCKETS - 1; b++) {
+    seen += lat->hist[b];
+    if (seen >= want) {
+      u64 edge = (1UL << b) * (TIMEBASE_HZ / 1000000);
+      return edge < lat->max ? edge : lat->max;
+    }
+  }
+  return lat->max;
+}
+
+// Install the idle task for this hart. It stays off the run queues.
+void sched_set_idle(pcb_t *task) { this_hart()->idle = task; }
+
+// Install this hart's worker. It also stays off the run queues and runs
+// whenever it has been kicked.
+void sched_set_worker(pcb_t *task) { this_hart()->worker = task; }
+
+// Give the worker something to do. Called with IRQs off.
+void sched_kick_worker(void) {
+  sched_hart_t *hart = this_hart();
+  if (hart->worker) {
+    hart->kick = 1;
+    need_resched = 1;
+  }
+}
+
+// Called by the worker when it is out of work: block until the next kick
+void sched_worker_wait(void) {
+  sched_hart_t *hart = this_hart();
+  pcb_t *self = current_task;
+
+  irqflags_t flags = irq_save();
+  if (hart->kick) {
+    hart->kick = 0;
+    irq_restore(flags);
     return;
   }
+  self->state = TASK_SLEEPING;
+  sched_switch_locked(0);
+  irq_restore(flags);
+}
 
-  // Exponential averaging: τ_new = α * real_burst + (1-α) * τ_old
-  // α = 0.5
-  u64 real_burst = task->ticks_used;
-  task->burst_estimate = (real_burst + task->burst_estimate) / 2;
+u64 sched_context_switches(void) { return this_hart()->nr_switches; }
+
+u64 sched_idle_switches(void) { return this_hart()->nr_idle; }
+
+void sched_set_burst_alpha(int percent) {
+  if (percent < 0) {
+    percent = 0;
+  } else if (percent > 100) {
+    percent = 100;
+  }
+  burst_alpha = percent;
 }
 
+int sched_get_burst_alpha(void) { return burst_alpha; }
+
 // Cooperative scheduling - call this periodically from user code
 void sched_maybe_yield_safe(void) {
   if (!need_resched) {
@@ -212,7 +880,7 @@ void sched_maybe_yield_safe(void) {
 
   if (current_task) {
     need_resched = 0;
-    sched_yield();
+    sched_switch(1);
   } else {
     need_resched = 0;
   }
@@ -220,13 +888,13 @@ void sched_maybe_yield_safe(void) {
 
 // Set preemption mode
 void sched_set_preempt(int on) {
-  disable_irq();
+  irqflags_t flags = irq_save();
   preempt_enabled = on ? 1 : 0;
   if (preempt_enabled && current_mode == SCHED_RR) {
     need_resched = 1;
     quantum_left = RR_QUANTUM;
   }
-  enable_irq();
+  irq_restore(flags);
 }
 
 // Get preemption mode
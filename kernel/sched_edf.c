@@ -0,0 +1,139 @@
+#include "uros.h"
+
+// Earliest-deadline-first run queue for periodic real-time tasks
+//
+// A real-time task is created with (runtime, period, deadline) in ticks.
+// Each period releases a job with an absolute deadline of release +
+// deadline and a budget of runtime ticks. Ready real-time tasks are kept
+// in a red-black tree ordered by absolute deadline; tasks without
+// real-time parameters run in the background when the tree is empty.
+
+static rb_root_t edf_tree;
+static int edf_count = 0;
+
+// Admitted utilization, sum of runtime / period in EDF_UTIL_ONE units
+static u64 total_util = 0;
+
+static int edf_less(const rb_node_t *a, const rb_node_t *b) {
+  const pcb_t *ta = container_of(a, pcb_t, dl_node);
+  const pcb_t *tb = container_of(b, pcb_t, dl_node);
+  return ta->dl_abs_deadline < tb->dl_abs_deadline;
+}
+
+static pcb_t *edf_leftmost(void) {
+  rb_node_t *node = rb_first(&edf_tree);
+  return node ? container_of(node, pcb_t, dl_node) : (pcb_t *)0;
+}
+
+void edf_init(void) {
+  rb_init(&edf_tree);
+  edf_count = 0;
+  total_util = 0;
+}
+
+// Reserve utilization for a new task. Returns -1 if the parameters are
+// invalid or the task set would exceed 100% utilization.
+int edf_admit(u32 runtime, u32 period, u32 deadline) {
+  if (runtime == 0 || runtime > deadline || deadline > period) {
+    return -1;
+  }
+
+  u64 util = (u64)runtime * EDF_UTIL_ONE / period;
+  if (total_util + util > EDF_UTIL_ONE) {
+    return -1;
+  }
+
+  total_util += util;
+  return 0;
+}
+
+void edf_task_init(pcb_t *task, u32 runtime, u32 period, u32 deadline) {
+  task->dl_runtime = runtime;
+  task->dl_period = period;
+  task->dl_deadline = deadline;
+  task->dl_util = (u64)runtime * EDF_UTIL_ONE / period;
+  task->dl_release = g_ticks;
+  task->dl_abs_deadline = g_ticks + deadline;
+  task->dl_budget = (int)runtime;
+  task->dl_jobs = 1;
+}
+
+// Give a task's utilization back to the admission pool
+void edf_release(pcb_t *task) {
+  total_util -= task->dl_util;
+  task->dl_util = 0;
+}
+
+u32 edf_utilization(void) { return (u32)(total_util * 1000 / EDF_UTIL_ONE); }
+
+// Count a miss once per job if its deadline has passed
+void edf_check_miss(pcb_t *task) {
+  if (!task->dl_missed && g_ticks > task->dl_abs_deadline) {
+    task->dl_missed = 1;
+    task->dl_misses++;
+  }
+}
+
+// Advance to the first release after now and return it
+u64 edf_next_release(pcb_t *task) {
+  do {
+    task->dl_release += task->dl_period;
+  } while (task->dl_release <= g_ticks);
+  return task->dl_release;
+}
+
+// Start the job released at dl_release
+void edf_replenish(pcb_t *task) {
+  edf_check_miss(task);
+  // While it runs on an inherited deadline its own one is saved aside
+  if (task->pi_boosted) {
+    task->pi_deadline = task->dl_release + task->dl_deadline;
+  } else {
+    task->dl_abs_deadline = task->dl_release + task->dl_deadline;
+  }
+  task->dl_budget = (int)task->dl_runtime;
+  task->dl_throttled = 0;
+  task->dl_missed = 0;
+  task->dl_jobs++;
+}
+
+void edf_enqueue(pcb_t *task) {
+  rb_insert(&edf_tree, &task->dl_node, edf_less);
+  edf_count++;
+}
+
+pcb_t *edf_pick_next(void) {
+  pcb_t *task = edf_leftmost();
+  if (task) {
+    rb_erase(&edf_tree, &task->dl_node);
+    edf_count--;
+  }
+  return task;
+}
+
+void edf_remove(pcb_t *task) {
+  rb_erase(&edf_tree, &task->dl_node);
+  edf_count--;
+}
+
+int edf_ready_count(void) { return edf_count; }
+
+// Charge one tick to the running task. Returns 1 when it should give up
+// the CPU: its budget is spent or an earlier deadline is ready.
+int edf_on_tick(pcb_t *current) {
+  if (!current->dl_period) {
+    // Background tasks round-robin every tick and give way to any
+    // real-time work
+    return 1;
+  }
+
+  edf_check_miss(current);
+
+  if (--current->dl_budget <= 0) {
+    current->dl_throttled = 1;
+    return 1;
+  }
+
+  pcb_t *left = edf_leftmost();
+  return left && left->dl_abs_deadline < current->dl_abs_deadline;
+}
@@ -0,0 +1,111 @@
+#include "uros.h"
+
+// Completely-fair run queue
+//
+// Every task accrues virtual runtime: the CPU time it used (measured with
+// rdtime), scaled by NICE_0 weight / task weight. Ready tasks are kept in
+// a red-black tree ordered by vruntime and the leftmost one runs next, so
+// a task that yields often is picked again soon after and ends up with
+// the same CPU share as one that never yields.
+
+// Nice -20..19 to weight; each step is roughly a 10% CPU share change
+static const u32 nice_to_weight[40] = {
+    88761, 71755, 56483, 46273, 36291, 29154, 23254, 18705, 14949, 11916,
+    9548,  7620,  6100,  4904,  3906,  3121,  2501,  1991,  1586,  1277,
+    1024,  820,   655,   526,   423,   335,   272,   215,   172,   137,
+    110,   87,    70,    56,    45,    36,    29,    23,    18,    15,
+};
+
+#define CYCLES_PER_US (TIMEBASE_HZ / 1000000)
+
+static rb_root_t fair_tree;
+static int fair_count = 0;
+static u64 min_vruntime = 0;
+
+static int fair_less(const rb_node_t *a, const rb_node_t *b) {
+  const pcb_t *ta = container_of(a, pcb_t, fair_node);
+  const pcb_t *tb = container_of(b, pcb_t, fair_node);
+  return ta->vruntime < tb->vruntime;
+}
+
+static pcb_t *fair_leftmost(void) {
+  rb_node_t *node = rb_first(&fair_tree);
+  return node ? container_of(node, pcb_t, fair_node) : (pcb_t *)0;
+}
+
+void fair_init(void) {
+  rb_init(&fair_tree);
+  fair_count = 0;
+  min_vruntime = 0;
+}
+
+void fair_task_init(pcb_t *task) {
+  task->nice = 0;
+  task->weight = FAIR_NICE_0_WEIGHT;
+  // New tasks start level with the queue instead of ahead of everyone
+  task->vruntime = min_vruntime;
+}
+
+void fair_set_nice(pcb_t *task, int nice) {
+  if (nice < -20) {
+    nice = -20;
+  } else if (nice > 19) {
+    nice = 19;
+  }
+  task->nice = nice;
+  task->weight = nice_to_weight[nice + 20];
+}
+
+void fair_charge(pcb_t *task, u64 delta) {
+  task->vruntime += delta * FAIR_NICE_0_WEIGHT / task->weight;
+}
+
+void fair_enqueue(pcb_t *task) {
+  rb_insert(&fair_tree, &task->fair_node, fair_less);
+  fair_count++;
+}
+
+pcb_t *fair_pick_next(void) {
+  pcb_t *task = fair_leftmost();
+  if (!task) {
+    return (pcb_t *)0;
+  }
+
+  rb_erase(&fair_tree, &task->fair_node);
+  fair_count--;
+
+  // min_vruntime only moves forward
+  if (task->vruntime > min_vruntime) {
+    min_vruntime = task->vruntime;
+  }
+  return task;
+}
+
+void fair_remove(pcb_t *task) {
+  rb_erase(&fair_tree, &task->fair_node);
+  fair_count--;
+}
+
+int fair_ready_count(void) { return fair_count; }
+
+// A task that slept is placed no further back than min_vruntime minus a
+// small credit, so sleeping neither banks unlimited CPU nor loses its turn
+void fair_wakeup(pcb_t *task) {
+  u64 credit = FAIR_SLEEPER_CREDIT_US * CYCLES_PER_US;
+  u64 floor = min_vruntime > credit ? min_vruntime - credit : 0;
+
+  if (task->vruntime < floor) {
+    task->vruntime = floor;
+  }
+}
+
+// Returns 1 when the running task has had at least the minimum
+// granularity and a task with less vruntime is waiting
+int fair_on_tick(pcb_t *current, u64 ran) {
+  pcb_t *left = fair_leftmost();
+
+  if (!left || ran < FAIR_MIN_GRANULARITY_US * CYCLES_PER_US) {
+    return 0;
+  }
+  return left->vruntime < current->vruntime;
+}
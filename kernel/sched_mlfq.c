@@ -0,0 +1,179 @@
+#include "uros.h"
+
+// Multi-level feedback queue run queue
+//
+// Level 0 is the highest priority. Each level is a FIFO of ready tasks
+// linked through pcb_t.rq_next, and bit N of level_bitmap is set while
+// level N is non-empty, so picking the next task is a single
+// count-trailing-zeros. A task that uses up its allotment at a level is
+// demoted; every MLFQ_BOOST_TICKS all tasks go back to level 0.
+
+static pcb_t *level_head[MLFQ_LEVELS];
+static pcb_t *level_tail[MLFQ_LEVELS];
+static u32 level_bitmap = 0;
+static int mlfq_count = 0;
+
+// Boosts only splice the level lists; each task's own level is reset
+// lazily when its epoch no longer matches.
+static u32 boost_epoch = 0;
+static u64 next_boost = MLFQ_BOOST_TICKS;
+
+static int mlfq_quantum(int level) { return MLFQ_BASE_QUANTUM << level; }
+
+static void mlfq_set_level(pcb_t *task, int level) {
+  task->mlfq_level = level;
+  task->mlfq_allot = mlfq_quantum(level);
+  task->mlfq_epoch = boost_epoch;
+}
+
+void mlfq_init(void) {
+  for (int i = 0; i < MLFQ_LEVELS; i++) {
+    level_head[i] = (pcb_t *)0;
+    level_tail[i] = (pcb_t *)0;
+  }
+  level_bitmap = 0;
+  mlfq_count = 0;
+  boost_epoch = 0;
+  next_boost = g_ticks + MLFQ_BOOST_TICKS;
+}
+
+void mlfq_task_init(pcb_t *task) {
+  mlfq_set_level(task, 0);
+  task->rq_next = (pcb_t *)0;
+}
+
+void mlfq_enqueue(pcb_t *task) {
+  if (task->mlfq_epoch != boost_epoch) {
+    mlfq_set_level(task, 0);
+  }
+
+  int level = task->mlfq_level;
+  task->rq_next = (pcb_t *)0;
+  if (level_tail[level]) {
+    level_tail[level]->rq_next = task;
+  } else {
+    level_head[level] = task;
+  }
+  level_tail[level] = task;
+  level_bitmap |= 1U << level;
+  mlfq_count++;
+}
+
+pcb_t *mlfq_pick_next(void) {
+  if (level_bitmap == 0) {
+    return (pcb_t *)0;
+  }
+
+  int level = __builtin_ctz(level_bitmap);
+  pcb_t *task = level_head[level];
+
+  level_head[level] = task->rq_next;
+  if (!level_head[level]) {
+    level_tail[level] = (pcb_t *)0;
+    level_bitmap &= ~(1U << level);
+  }
+  task->rq_next = (pcb_t *)0;
+  mlfq_count--;
+
+  if (task->mlfq_epoch != boost_epoch) {
+    mlfq_set_level(task, 0);
+  }
+  return task;
+}
+
+// Unlink a task from whichever level list it is queued on
+void mlfq_remove(pcb_t *task) {
+  // A boost moved tasks queued in an older epoch onto level 0
+  int level = task->mlfq_epoch == boost_epoch ? task->mlfq_level : 0;
+  pcb_t *prev = (pcb_t *)0;
+  pcb_t *cur = level_head[level];
+
+  while (cur && cur != task) {
+    prev = cur;
+    cur = cur->rq_next;
+  }
+  if (!cur) {
+    return;
+  }
+
+  if (prev) {
+    prev->rq_next = task->rq_next;
+  } else {
+    level_head[level] = task->rq_next;
+  }
+  if (level_tail[level] == task) {
+    level_tail[level] = prev;
+  }
+  if (!level_head[level]) {
+    level_bitmap &= ~(1U << level);
+  }
+  task->rq_next = (pcb_t *)0;
+  mlfq_count--;
+}
+
+int mlfq_ready_count(void) { return mlfq_count; }
+
+// Move every level onto the end of level 0 in priority order
+static void mlfq_boost(void) {
+  for (int level = 1; level < MLFQ_LEVELS; level++) {
+    if (!level_head[level]) {
+      continue;
+    }
+    if (level_tail[0]) {
+      level_tail[0]->rq_next = level_head[level];
+    } else {
+      level_head[0] = level_head[level];
+    }
+    level_tail[0] = level_tail[level];
+    level_head[level] = (pcb_t *)0;
+    level_tail[level] = (pcb_t *)0;
+  }
+  if (level_bitmap) {
+    level_bitmap = 1;
+  }
+
+  boost_epoch++;
+  next_boost = g_ticks + MLFQ_BOOST_TICKS;
+}
+
+// Charge one tick to the running task. Returns 1 when it should give up
+// the CPU: its allotment ran out or a higher level has work.
+int mlfq_on_tick(pcb_t *current) {
+  if (g_ticks >= next_boost) {
+    mlfq_boost();
+  }
+
+  if (current->mlfq_epoch != boost_epoch) {
+    mlfq_set_level(current, 0);
+  }
+
+  if (--current->mlfq_allot <= 0) {
+    // A task holding a lock for a waiter keeps the level it inherited
+    if (current->pi_boosted) {
+      current->mlfq_allot = mlfq_quantum(current->mlfq_level);
+      return 1;
+    }
+    int level = current->mlfq_level + 1;
+    if (level >= MLFQ_LEVELS) {
+      level = MLFQ_LEVELS - 1;
+    }
+    mlfq_set_level(current, level);
+    return 1;
+  }
+
+  return level_bitmap && __builtin_ctz(level_bitmap) < current->mlfq_level;
+}
+
+// Effective level: a task queued before the last boost is at level 0
+int mlfq_prio(pcb_t *task) {
+  return task->mlfq_epoch == boost_epoch ? task->mlfq_level : 0;
+}
+
+// A task that blocked gets promoted one level when it wakes up
+void mlfq_wakeup(pcb_t *task) {
+  if (task->mlfq_epoch != boost_epoch) {
+    mlfq_set_level(task, 0);
+  } else if (task->mlfq_level > 0) {
+    mlfq_set_level(task, task->mlfq_level - 1);
+  }
+}
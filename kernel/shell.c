@@ -1,9 +1,5 @@
 #include "uros.h"
 
-extern pcb_t *task_get_table(void);
-extern int task_get_max_tasks(void);
-extern void sched_update_burst_estimate(pcb_t *task);
-
 static inline u64 csr_read_sstatus(void) {
   u64 value;
   __asm__ volatile("csrr %0, sstatus" : "=r"(value));
@@ -27,9 +23,10 @@ static inline u64 csr_read_sip(void) {
 static int pc_buffer[BUFFER_SIZE];
 static int pc_in = 0;
 static int pc_out = 0;
-static sem_t pc_empty;
-static sem_t pc_full;
+static int pc_count = 0;
 static mutex_t pc_mutex;
+static cond_t pc_not_full;
+static cond_t pc_not_empty;
 
 // Task functions for run commands
 static void cpu_task(void *arg) {
@@ -58,31 +55,101 @@ static void io_task(void *arg) {
   for (int i = 0; i < 5; i++) {
     kprintf("IO task %d: iteration %d\n", id, i);
 
-    // Simulate I/O wait by yielding and letting other tasks run
-    for (int j = 0; j < 5; j++) {
+    // Simulate I/O wait
+    task_sleep(5);
+  }
+}
+
+// One task of the scheduling benchmark
+typedef struct {
+  u32 arrival; // Ticks after the round starts
+  u32 burst;   // CPU ticks per burst
+  u32 bursts;  // Bursts, each followed by a one-tick sleep
+  int hint;    // Initial estimate for task_create, deliberately wrong
+} bench_spec_t;
+
+// Benchmark task: 'bursts' CPU bursts of 'burst' ticks of its own CPU
+// time, with a sleep between them so each one ends and is measured
+static void bench_task(void *arg) {
+  const bench_spec_t *spec = (const bench_spec_t *)arg;
+  pcb_t *self = sched_current();
+
+  for (u32 b = 0; b < spec->bursts; b++) {
+    u64 target = self->ticks_used + spec->burst;
+    while (self->ticks_used < target) {
+      volatile int sum = 0;
+      for (int j = 0; j < 1000; j++) {
+        sum += j;
+      }
+      // Lets RR take turns and SRTF preempt for a shorter arrival
       sched_maybe_yield_safe();
-      task_yield();
+    }
+    if (b + 1 < spec->bursts) {
+      task_sleep(1);
     }
   }
 }
 
-// Benchmark task
-static void bench_task(void *arg) {
-  int burst_ticks = (int)(u64)arg;
-  u64 start = g_ticks;
+// CPU hog for the latency benchmark, runs until hog_stop is set
+static volatile int hog_stop = 0;
+
+static void hog_task(void *arg) {
+  (void)arg;
+
+  while (!hog_stop) {
+    volatile int sum = 0;
+    for (int j = 0; j < 1000; j++) {
+      sum += j;
+    }
+    sched_maybe_yield_safe();
+  }
+}
+
+// Same work as hog_task, but gives up the CPU after every chunk
+static void yielder_task(void *arg) {
+  (void)arg;
+
+  while (!hog_stop) {
+    volatile int sum = 0;
+    for (int j = 0; j < 1000; j++) {
+      sum += j;
+    }
+    task_yield();
+  }
+}
+
+// Mostly idle task: a short chunk of work every few ticks
+static void light_task(void *arg) {
+  (void)arg;
 
-  // Busy wait for the specified number of ticks
-  while ((g_ticks - start) < (u64)burst_ticks) {
-    // Burn CPU
+  while (!hog_stop) {
     volatile int sum = 0;
     for (int j = 0; j < 1000; j++) {
       sum += j;
     }
-    // Optional: Yield to allow other tasks to run if cooperative
-    // task_yield();
+    task_sleep(5);
   }
+}
 
-  // Task completes
+// Periodic real-time task: each job burns dl_runtime ticks of CPU
+static void rt_task(void *arg) {
+  int jobs = (int)(u64)arg;
+  pcb_t *self = sched_current();
+
+  for (int i = 0; i < jobs; i++) {
+    u64 target = self->ticks_used + self->dl_runtime;
+    while (1) {
+      volatile int sum = 0;
+      for (int j = 0; j < 1000; j++) {
+        sum += j;
+      }
+      if (self->ticks_used >= target) {
+        break;
+      }
+      sched_maybe_yield_safe();
+    }
+    task_wait_period();
+  }
 }
 
 // Producer task for producer-consumer demo
@@ -90,30 +157,25 @@ static void producer_task(void *arg) {
   int n_items = (int)(u64)arg;
 
   for (int i = 0; i < n_items; i++) {
-    // Wait for empty slot
-    sem_wait(&pc_empty);
-
-    // Enter critical section
+    // Enter critical section, wait for an empty slot
     mutex_lock(&pc_mutex);
+    while (pc_count == BUFFER_SIZE) {
+      cond_wait(&pc_not_full, &pc_mutex);
+    }
 
     // Produce item
     int item = i + 1;
     pc_buffer[pc_in] = item;
     kprintf("Producer: produced item %d at index %d\n", item, pc_in);
     pc_in = (pc_in + 1) % BUFFER_SIZE;
+    pc_count++;
 
-    // Exit critical section
+    // Signal item available, exit critical section
+    cond_signal(&pc_not_empty);
     mutex_unlock(&pc_mutex);
 
-    // Signal item available
-    sem_post(&pc_full);
-
     // Sleep to make demo visible
-    u64 target = g_ticks + 5;
-    while (g_ticks < target) {
-      sched_maybe_yield_safe();
-      task_yield();
-    }
+    task_sleep(5);
   }
 
   kprintf("Producer: finished producing %d items\n", n_items);
@@ -124,29 +186,24 @@ static void consumer_task(void *arg) {
   int n_items = (int)(u64)arg;
 
   for (int i = 0; i < n_items; i++) {
-    // Wait for item available
-    sem_wait(&pc_full);
-
-    // Enter critical section
+    // Enter critical section, wait for an item
     mutex_lock(&pc_mutex);
+    while (pc_count == 0) {
+      cond_wait(&pc_not_empty, &pc_mutex);
+    }
 
     // Consume item
     int item = pc_buffer[pc_out];
     kprintf("Consumer: consumed item %d from index %d\n", item, pc_out);
     pc_out = (pc_out + 1) % BUFFER_SIZE;
+    pc_count--;
 
-    // Exit critical section
+    // Signal empty slot, exit critical section
+    cond_signal(&pc_not_full);
     mutex_unlock(&pc_mutex);
 
-    // Signal empty slot
-    sem_post(&pc_empty);
-
     // Sleep to make demo visible
-    u64 target = g_ticks + 5;
-    while (g_ticks < target) {
-      sched_maybe_yield_safe();
-      task_yield();
-    }
+    task_sleep(5);
   }
 
   kprintf("Consumer: finished consuming %d items\n", n_items);
@@ -156,57 +213,110 @@ static void cmd_help(void) {
   kprintf("Available commands:\n");
   kprintf("  help            - Show this help\n");
   kprintf("  ps              - List tasks\n");
+  kprintf("  ps -s           - Stack size and high-water mark per task\n");
   kprintf("  run cpu         - Create CPU-bound task\n");
   kprintf("  run io          - Create I/O-bound task\n");
+  kprintf("  run rt C T [D]  - Create periodic real-time task (ticks)\n");
   kprintf("  kill <pid>      - Kill a task\n");
   kprintf("  sched rr        - Switch to Round-Robin\n");
   kprintf("  sched sjf       - Switch to SJF\n");
+  kprintf("  sched mlfq      - Switch to Multi-Level Feedback Queue\n");
+  kprintf("  sched fair      - Switch to Completely-Fair scheduling\n");
+  kprintf("  sched edf       - Switch to Earliest-Deadline-First\n");
+  kprintf("  sched srtf      - Switch to Shortest-Remaining-Time-First\n");
+  kprintf("  sched alpha <n> - Burst estimate smoothing factor (percent)\n");
+  kprintf("  nice <pid> <n>  - Set nice value (-20..19) for fair mode\n");
   kprintf("  sched preempt on|off - Enable/disable preemption\n");
   kprintf("  sleep <ticks>   - Sleep for N ticks\n");
   kprintf("  pcdemo          - Producer-Consumer demo\n");
-  kprintf("  bench           - Run scheduler benchmark\n");
-  kprintf("  uptime          - Show system uptime\n");
-  kprintf("  meminfo         - Show memory usage\n");
+  kprintf("  pcdemo pi       - Priority inversion under SJF, PI off vs on\n");
+  kprintf("  bench           - Run scheduler benchmark (RR/SJF/SRTF)\n");
+  kprintf("  bench lat       - Shell wakeup latency under 16 CPU hogs\n");
+  kprintf("  bench fair      - CPU share fairness index, RR vs FAIR\n");
+  kprintf("  bench edf       - Deadline misses of a periodic set, RR vs EDF\n");
+  kprintf("  bench spawn     - Task creation rate at 32/1024/4096 tasks\n");
+  kprintf("  bench pick      - Run queue scan cost, legacy vs hot PCB\n");
+  kprintf("  bench idle      - Context switch rate under light load\n");
+  kprintf("  bench timer     - Timer wheel tick cost with 10k timers\n");
+  kprintf("  bench sync      - Lock fast paths and a 32-task contention test\n");
+  kprintf("  bench chan      - Messages/s: shared ring vs channels\n");
+  kprintf("  bench coro      - Memory and switch cost, coroutines vs tasks\n");
+  kprintf("  bench arena     - Small allocations, kmalloc vs task arena\n");
+  kprintf("  bench str       - memcpy/memset/strlen/strcmp MB/s, 8 B to 64 KB\n");
+  kprintf("  bench blk       - virtio-blk seq/random MB/s and IOPS (overwrites disk)\n");
+  kprintf("  bench bcache [dev] - Buffer cache hit rate and MB/s, seq vs random\n");
+  kprintf("  replay [a b]    - Replay embedded trace under two policies\n");
+  kprintf("  uptime          - Show system uptime and load averages\n");
+  kprintf("  top [ticks]     - Live per-task CPU%%, refresh every N ticks\n");
+  kprintf("  meminfo [-v]    - Show memory usage (-v: allocator telemetry)\n");
+  kprintf("  bcache [sync|reset|ra on|off] - Buffer cache and block devices\n");
   kprintf("  intstats        - Show interrupt/timer status\n");
+  kprintf("  softirq [on|off|reset] - Deferred IRQ work, IRQ-off maxima\n");
+  kprintf("  irqsoff [reset] - IRQ-off latency histogram and worst sites\n");
+  kprintf("  schedlat [reset|<pid>] - Ready-to-run latency p50/p99/max\n");
 }
 
-static void cmd_ps(void) {
-  pcb_t *tasks = task_get_table();
-  int max_tasks = task_get_max_tasks();
-
-  kprintf("PID  STATE     TICKS  BURST_EST  ARRIVAL\n");
+static const char *state_name(task_state_t state) {
+  switch (state) {
+  case TASK_NEW:
+    return "NEW    ";
+  case TASK_READY:
+    return "READY  ";
+  case TASK_RUNNING:
+    return "RUNNING";
+  case TASK_SLEEPING:
+    return "SLEEP  ";
+  default:
+    return "ZOMBIE ";
+  }
+}
 
-  for (int i = 0; i < max_tasks; i++) {
-    if (tasks[i].pid >= 0 && tasks[i].state != TASK_ZOMBIE) {
-      const char *state_str;
-      switch (tasks[i].state) {
-      case TASK_NEW:
-        state_str = "NEW    ";
-        break;
-      case TASK_READY:
-        state_str = "READY  ";
-        break;
-      case TASK_RUNNING:
-        state_str = "RUNNING";
-        break;
-      case TASK_SLEEPING:
-        state_str = "SLEEP  ";
-        break;
-      default:
-        state_str = "ZOMBIE ";
-        break;
+static void cmd_ps(void) {
+  kprintf("PID  STATE     TICKS  BURST_EST  ARRIVAL  DL_MISS\n");
+
+  for (int i = 0; i < MAX_TASKS; i++) {
+    pcb_t *task = task_get_slot(i);
+    if (task && task->state != TASK_ZOMBIE) {
+      const char *state_str = state_name(task->state);
+
+      kprintf("%d    %s  %u      %u          %u", task->pid, state_str,
+              (u32)task->ticks_used, (u32)task->burst_estimate,
+              (u32)task->arrival_time);
+      if (task->dl_period) {
+        kprintf("        %u/%u\n", task->dl_misses, task->dl_jobs);
+      } else {
+        kprintf("        -\n");
       }
+    }
+  }
+}
 
-      kprintf("%d    %s  %u      %u          %u\n", tasks[i].pid, state_str,
-              (u32)tasks[i].ticks_used, (u32)tasks[i].burst_estimate,
-              (u32)tasks[i].arrival_time);
+// Stack use per task: the high-water mark found by scanning for the
+// creation paint, against the stack's size
+static void cmd_ps_stack(void) {
+  u32 total = 0;
+  u32 used = 0;
+
+  kprintf("PID  STATE     STACK  USED  PCT\n");
+  for (int i = 0; i < MAX_TASKS; i++) {
+    pcb_t *task = task_get_slot(i);
+    if (task && task->state != TASK_ZOMBIE) {
+      u32 hwm = task_stack_used(task);
+      kprintf("%d    %s  %u   %u  %u%%\n", task->pid,
+              state_name(task->state), task->stack_size, hwm,
+              hwm * 100 / task->stack_size);
+      total += task->stack_size;
+      used += hwm;
     }
   }
+  kprintf("Stacks: %u KB allocated, %u KB ever used\n", total / 1024,
+          used / 1024);
 }
 
 static void cmd_run_cpu(void) {
   int pid = task_create(cpu_task, (void *)50, 20);
   if (pid >= 0) {
+    task_detach(pid);
     kprintf("Created CPU task with PID %d\n", pid);
   } else {
     kprintf("Failed to create task\n");
@@ -217,24 +327,79 @@ static void cmd_run_io(void) {
   static int io_counter = 0;
   int pid = task_create(io_task, (void *)(u64)io_counter++, 15);
   if (pid >= 0) {
+    task_detach(pid);
     kprintf("Created I/O task with PID %d\n", pid);
   } else {
     kprintf("Failed to create task\n");
   }
 }
 
+static void cmd_run_rt(const char *arg) {
+  u32 params[3] = {0, 0, 0};
+  int n = 0;
+
+  while (*arg && n < 3) {
+    while (*arg == ' ') {
+      arg++;
+    }
+    if (*arg < '0' || *arg > '9') {
+      break;
+    }
+    params[n++] = (u32)atoi(arg);
+    while (*arg >= '0' && *arg <= '9') {
+      arg++;
+    }
+  }
+
+  if (n < 2) {
+    kprintf("Usage: run rt <runtime> <period> [deadline]\n");
+    return;
+  }
+  if (n == 2) {
+    params[2] = params[1]; // Implicit deadline = period
+  }
+
+  int pid = task_create_rt(rt_task, (void *)20, params[0], params[1],
+                           params[2]);
+  if (pid >= 0) {
+    kprintf("Created RT task with PID %d (C=%u T=%u D=%u, utilization "
+            "%u/1000)\n",
+            pid, params[0], params[1], params[2], edf_utilization());
+  } else {
+    kprintf("Admission refused (invalid parameters or utilization > 1)\n");
+  }
+}
+
 static void cmd_kill(const char *arg) {
   int pid = atoi(arg);
-  pcb_t *task = task_get_by_pid(pid);
 
-  if (task) {
-    task->state = TASK_ZOMBIE;
-    task->finish_time = g_ticks;
-    task_reap(pid);
+  if (task_kill(pid) == 0) {
     kprintf("Killed task %d\n", pid);
   } else {
+    // Only runnable, sleeping or joining tasks can be killed
+    kprintf("Task %d not found, or blocked on a lock, channel or I/O\n",
+            pid);
+  }
+}
+
+static void cmd_nice(const char *arg) {
+  int pid = atoi(arg);
+  while (*arg && *arg != ' ') {
+    arg++;
+  }
+  if (*arg == '\0') {
+    kprintf("Usage: nice <pid> <value>\n");
+    return;
+  }
+
+  pcb_t *task = task_get_by_pid(pid);
+  if (!task || task->state == TASK_ZOMBIE) {
     kprintf("Task %d not found\n", pid);
+    return;
   }
+
+  fair_set_nice(task, atoi(arg));
+  kprintf("Task %d: nice=%d weight=%u\n", pid, task->nice, task->weight);
 }
 
 static void cmd_sched(const char *arg) {
@@ -244,6 +409,25 @@ static void cmd_sched(const char *arg) {
   } else if (strcmp(arg, "sjf") == 0) {
     sched_set_mode(SCHED_SJF);
     kprintf("Scheduler: Shortest Job First (non-preemptive)\n");
+  } else if (strcmp(arg, "mlfq") == 0) {
+    sched_set_mode(SCHED_MLFQ);
+    kprintf("Scheduler: MLFQ (%d levels, base quantum=%d ticks, boost=%d "
+            "ticks)\n",
+            MLFQ_LEVELS, MLFQ_BASE_QUANTUM, MLFQ_BOOST_TICKS);
+  } else if (strcmp(arg, "fair") == 0) {
+    sched_set_mode(SCHED_FAIR);
+    kprintf("Scheduler: Completely-Fair (min granularity=%d us)\n",
+            FAIR_MIN_GRANULARITY_US);
+  } else if (strcmp(arg, "srtf") == 0) {
+    sched_set_mode(SCHED_SRTF);
+    kprintf("Scheduler: Shortest Remaining Time First (preemptive)\n");
+  } else if (strncmp(arg, "alpha ", 6) == 0) {
+    sched_set_burst_alpha(atoi(arg + 6));
+    kprintf("Burst estimate alpha: %d%%\n", sched_get_burst_alpha());
+  } else if (strcmp(arg, "edf") == 0) {
+    sched_set_mode(SCHED_EDF);
+    kprintf("Scheduler: Earliest Deadline First (RT utilization %u/1000)\n",
+            edf_utilization());
   } else if (strncmp(arg, "preempt ", 8) == 0) {
     const char *mode = arg + 8;
     if (strcmp(mode, "on") == 0) {
@@ -256,10 +440,16 @@ static void cmd_sched(const char *arg) {
       kprintf("Usage: sched preempt on|off\n");
     }
   } else {
-    kprintf("Usage: sched rr|sjf|preempt on|off\n");
+    kprintf("Usage: sched rr|sjf|srtf|mlfq|fair|edf|alpha <n>|preempt "
+            "on|off\n");
   }
 }
 
+// Load average in hundredths, printed as 1.23
+static void print_load(u32 load) {
+  kprintf("%u.%u%u", load / 100, load / 10 % 10, load % 10);
+}
+
 static void cmd_uptime(void) {
   u64 ticks = g_ticks;
   u64 seconds = ticks / TICK_HZ;
@@ -267,13 +457,120 @@ static void cmd_uptime(void) {
 
   kprintf("Uptime: %u.%u seconds (%u ticks)\n", (u32)seconds, (u32)centisecs,
           (u32)ticks);
+
+  u32 load[3];
+  sched_loadavg(load);
+  kprintf("Load average:");
+  for (int i = 0; i < 3; i++) {
+    kprintf(i ? ", " : " ");
+    print_load(load[i]);
+  }
+  kprintf("\n");
 }
 
-static void cmd_meminfo(void) {
+// top: the busiest tasks over each refresh interval
+#define TOP_ROWS 16
+
+typedef struct {
+  pcb_t *task;
+  u64 exec;
+  u64 wait;
+  u32 switches;
+} top_row_t;
+
+// Take every task's counters since the last refresh and keep the
+// TOP_ROWS busiest. Nothing here yields, so no task can go away mid-walk.
+static int top_collect(top_row_t *rows, int *ntasks) {
+  int n = 0;
+
+  *ntasks = 0;
+  for (int i = 0; i < MAX_TASKS; i++) {
+    pcb_t *task = task_get_slot(i);
+    if (!task || task->state == TASK_ZOMBIE) {
+      continue;
+    }
+    (*ntasks)++;
+
+    top_row_t row = {task, task->sum_exec - task->top_exec,
+                     task->sum_wait - task->top_wait,
+                     task->nr_switches - task->top_switches};
+    task->top_exec = task->sum_exec;
+    task->top_wait = task->sum_wait;
+    task->top_switches = task->nr_switches;
+
+    // Keep the rows sorted by CPU time, dropping what falls off the end
+    if (n == TOP_ROWS && rows[n - 1].exec >= row.exec) {
+      continue;
+    }
+    int j = n < TOP_ROWS ? n++ : TOP_ROWS - 1;
+    while (j > 0 && rows[j - 1].exec < row.exec) {
+      rows[j] = rows[j - 1];
+      j--;
+    }
+    rows[j] = row;
+  }
+  return n;
+}
+
+static void cmd_top(const char *arg) {
+  int interval = arg[0] ? atoi(arg) : TICK_HZ;
+  if (interval <= 0) {
+    kprintf("Usage: top [ticks]\n");
+    return;
+  }
+
+  top_row_t rows[TOP_ROWS];
+  int ntasks;
+  u64 last = rdtime();
+  u64 last_sw = sched_context_switches();
+  top_collect(rows, &ntasks);
+
+  while (1) {
+    // Sleep a tick at a time so a key press ends it promptly
+    for (int t = 0; t < interval; t++) {
+      task_sleep(1);
+      if (uart_getc() >= 0) {
+        return;
+      }
+    }
+
+    u64 now = rdtime();
+    u64 elapsed = now - last;
+    u64 sw = sched_context_switches();
+    int n = top_collect(rows, &ntasks);
+    u32 load[3];
+    sched_loadavg(load);
+
+    kprintf("\033[2J\033[H");
+    kprintf("top - %u s, %d tasks, load", (u32)(g_ticks / TICK_HZ), ntasks);
+    for (int i = 0; i < 3; i++) {
+      kprintf(" ");
+      print_load(load[i]);
+    }
+    kprintf(", ctxsw/s %u, %s\n",
+            (u32)((sw - last_sw) * TIMEBASE_HZ / elapsed),
+            sched_mode_name(sched_get_mode()));
+    kprintf("PID  STATE    CPU%%  WAIT%%  SW/S\n");
+    for (int i = 0; i < n; i++) {
+      kprintf("%d    %s  %u     %u      %u\n", rows[i].task->pid,
+              state_name(rows[i].task->state),
+              (u32)(rows[i].exec * 100 / elapsed),
+              (u32)(rows[i].wait * 100 / elapsed),
+              (u32)((u64)rows[i].switches * TIMEBASE_HZ / elapsed));
+    }
+    kprintf("(press any key to quit)\n");
+
+    last = now;
+    last_sw = sw;
+  }
+}
+
+static void cmd_meminfo(const char *arg) {
   size_t used = kmalloc_used();
   size_t free = kmalloc_free();
   int free_blocks = kmalloc_free_blocks();
   size_t total = HEAP_SIZE;
+  u32 frag = kmem_frag_index();
 
   kprintf("=== Memory Usage ===\n");
   kprintf("Heap total:    %u bytes\n", (u32)total);
@@ -282,7 +579,37 @@ static void cmd_meminfo(void) {
   kprintf("Heap free:     %u bytes (%u%%)\n", (u32)free,
           (u32)((free * 100) / total));
   kprintf("Free blocks:   %d\n", free_blocks);
-  kprintf("Fragmentation: %s\n", free_blocks > 3 ? "moderate" : "low");
+  kprintf("Fragmentation: %u%% (%s)\n", frag,
+          frag < 25 ? "low" : frag < 60 ? "moderate" : "high");
+
+  if (strcmp(arg, "-v") != 0) {
+    return;
+  }
+
+  kmem_stats_t st;
+  kmem_stats(&st);
+
+  kprintf("Peak used:     %u bytes\n", (u32)st.peak);
+  kprintf("Largest free:  %u bytes\n", (u32)st.largest_free);
+  kprintf("Live blocks:   %u\n", st.live_blocks);
+  kprintf("Allocs: %u  frees: %u  failures: %u\n", (u32)st.allocs,
+          (u32)st.frees, (u32)st.failures);
+
+  kprintf("\nBlock size     live     free\n");
+  for (int c = 0; c < KMEM_CLASSES; c++) {
+    if (st.live_hist[c] || st.free_hist[c]) {
+      kprintf("  >= %u: %u  %u\n", 16U << c, st.live_hist[c],
+              st.free_hist[c]);
+    }
+  }
+
+  // One rdtime cycle is 100 ns at TIMEBASE_HZ
+  kprintf("\nkmalloc latency (cycles):\n");
+  for (int b = 0; b < KMEM_LAT_BUCKETS; b++) {
+    if (st.lat_hist[b]) {
+      kprintf("  < %u: %u\n", 1U << b, st.lat_hist[b]);
+    }
+  }
 }
 
 static void cmd_intstats(void) {
@@ -293,6 +620,134 @@ static void cmd_intstats(void) {
   kprintf("ticks=%u  sstatus=0x%x  sie=0x%x  sip=0x%x\n", (u32)g_ticks,
           (u64)sstatus, (u64)sie, (u64)sip);
   kprintf("preempt=%s\n", sched_get_preempt() ? "ON" : "OFF");
+  kprintf("ctxsw=%u  (to idle: %u)\n", (u32)sched_context_switches(),
+          (u32)sched_idle_switches());
+
+  u64 ext, spurious;
+  plic_stats(&ext, &spurious);
+  kprintf("external irqs=%u  (unclaimed: %u)\n", (u32)ext, (u32)spurious);
+}
+
+static void cmd_softirq(const char *arg) {
+  if (strcmp(arg, "on") == 0) {
+    softirq_set_defer(1);
+  } else if (strcmp(arg, "off") == 0) {
+    softirq_set_defer(0);
+  } else if (strcmp(arg, "reset") == 0) {
+    softirq_reset_stats();
+  } else if (arg[0]) {
+    kprintf("Usage: softirq [on|off|reset]\n");
+    return;
+  }
+
+  u64 cycles_per_us = TIMEBASE_HZ / 1000000;
+  softirq_stats_t st;
+  softirq_stats(&st);
+
+  kprintf("defer=%s\n", softirq_get_defer() ? "ON" : "OFF");
+  kprintf("max trap IRQ-off:   %u us\n", (u32)(st.trap_off_max / cycles_per_us));
+  kprintf("max softirq drain:  %u us\n", (u32)(st.softirq_max / cycles_per_us));
+  kprintf("softirq runs=%u  worker runs=%u\n", (u32)st.softirq_runs,
+          (u32)st.worker_runs);
+}
+
+static void cmd_irqsoff(const char *arg) {
+  if (!CONFIG_IRQSOFF_TRACE) {
+    kprintf("IRQ-off tracing not built in (make IRQSOFF_TRACE=1)\n");
+    return;
+  }
+  if (strcmp(arg, "reset") == 0) {
+    irqsoff_reset();
+    kprintf("IRQ-off stats reset\n");
+    return;
+  } else if (arg[0]) {
+    kprintf("Usage: irqsoff [reset]\n");
+    return;
+  }
+
+  u64 cycles_per_us = TIMEBASE_HZ / 1000000;
+  irqsoff_stats_t st;
+  irqsoff_site_t sites[8];
+  int n = irqsoff_stats(&st, sites, 8);
+
+  kprintf("regions=%u  max=%u us", (u32)st.regions,
+          (u32)(st.max / cycles_per_us));
+  if (st.max_func) {
+    kprintf(" at %s:%d", st.max_func, st.max_line);
+  }
+  kprintf("\n");
+  if (st.dropped) {
+    kprintf("(%u regions from sites beyond the table)\n", (u32)st.dropped);
+  }
+
+  kprintf("\nHistogram (us):\n");
+  for (int b = 0; b < IRQSOFF_BUCKETS; b++) {
+    if (st.hist[b]) {
+      kprintf("  < %u: %u\n", 1U << b, st.hist[b]);
+    }
+  }
+
+  kprintf("\nTop offenders (max / avg us, count):\n");
+  for (int i = 0; i < n; i++) {
+    kprintf("  %s:%d  %u / %u  x%u\n", sites[i].func, sites[i].line,
+            (u32)(sites[i].max / cycles_per_us),
+            (u32)(sites[i].total / sites[i].count / cycles_per_us),
+            sites[i].count);
+  }
+}
+
+static void schedlat_print(const char *name, const schedlat_t *lat) {
+  u64 cycles_per_us = TIMEBASE_HZ / 1000000;
+
+  kprintf("%s  n=%u  p50=%u us  p99=%u us  max=%u us\n", name,
+          (u32)lat->count,
+          (u32)(schedlat_percentile(lat, 50) / cycles_per_us),
+          (u32)(schedlat_percentile(lat, 99) / cycles_per_us),
+          (u32)(lat->max / cycles_per_us));
+}
+
+static void cmd_schedlat(const char *arg) {
+  if (strcmp(arg, "reset") == 0) {
+    sched_latency_reset();
+    kprintf("Scheduling latency stats reset\n");
+    return;
+  }
+
+  if (arg[0] >= '0' && arg[0] <= '9') {
+    int pid = atoi(arg);
+    pcb_t *task = task_get_by_pid(pid);
+    if (!task) {
+      kprintf("Task %d not found\n", pid);
+      return;
+    }
+
+    schedlat_t lat = task->lat;
+    schedlat_print("task", &lat);
+    for (int b = 0; b < SCHEDLAT_BUCKETS; b++) {
+      if (lat.hist[b]) {
+        kprintf("  < %u us: %u\n", 1U << b, lat.hist[b]);
+      }
+    }
+    return;
+  }
+
+  if (arg[0]) {
+    kprintf("Usage: schedlat [reset|<pid>]\n");
+    return;
+  }
+
+  int shown = 0;
+  for (int m = 0; m < SCHED_NR_MODES; m++) {
+    schedlat_t lat;
+    sched_latency((sched_mode_t)m, &lat);
+    if (lat.count) {
+      schedlat_print(sched_mode_name((sched_mode_t)m), &lat);
+      shown++;
+    }
+  }
+  if (!shown) {
+    kprintf("No dispatches recorded yet\n");
+  }
 }
 
 static void cmd_sleep(const char *arg) {
@@ -308,17 +763,7 @@ static void cmd_sleep(const char *arg) {
   }
 
   kprintf("Sleeping for %d ticks...\n", ticks);
-  u64 target = g_ticks + ticks;
-
-  while (g_ticks < target) {
-    if (!sched_get_preempt()) {
-      // Cooperative mode: must yield
-      sched_maybe_yield_safe();
-      task_yield();
-    }
-    // Preemptive mode: timer will context switch automatically
-  }
-
+  task_sleep((u64)ticks);
   kprintf("Done sleeping\n");
 }
 
@@ -331,11 +776,12 @@ static void cmd_pcdemo(void) {
   // Reset buffer indices
   pc_in = 0;
   pc_out = 0;
+  pc_count = 0;
 
   // Initialize synchronization primitives
-  sem_init(&pc_empty, BUFFER_SIZE); // Initially all slots empty
-  sem_init(&pc_full, 0);            // Initially no items
   mutex_init(&pc_mutex);
+  cond_init(&pc_not_full);
+  cond_init(&pc_not_empty);
 
   kprintf("Creating producer and consumer tasks...\n");
 
@@ -345,6 +791,7 @@ static void cmd_pcdemo(void) {
     kprintf("Error: failed to create producer task\n");
     return;
   }
+  task_detach(producer_pid);
   kprintf("Producer task created (PID %d)\n", producer_pid);
 
   // Create consumer task
@@ -353,128 +800,1642 @@ static void cmd_pcdemo(void) {
     kprintf("Error: failed to create consumer task\n");
     return;
   }
+  task_detach(consumer_pid);
   kprintf("Consumer task created (PID %d)\n", consumer_pid);
 
   kprintf("Demo running... (will produce/consume %d items)\n", n_items);
   kprintf("Watch the alternating output!\n");
 }
 
-static void cmd_bench(void) {
-  kprintf("Running benchmark...\n");
+// pcdemo pi: a slow producer (long SJF estimate) holds the buffer mutex
+// while a consumer with a short estimate waits for it, and medium tasks
+// keep the CPU busy in between. Without priority inheritance SJF always
+// prefers the medium tasks to the holder, so the consumer waits for all
+// of them; with it, the holder runs at the consumer's estimate.
+#define PI_HOLD_UNITS 50 // Producer's critical section, 1 ms units
+#define PI_HOGS 3
+#define PI_HOG_UNITS 100
+
+static mutex_t pi_mutex;
+static volatile int pi_locked;
+static u64 pi_wait;
+
+// Burn about a millisecond of CPU, then give up the CPU
+static void pi_work_unit(void) {
+  u64 t0 = rdtime();
+  while (rdtime() - t0 < TIMEBASE_HZ / 1000) {
+  }
+  task_yield();
+}
+
+static void pi_producer_task(void *arg) {
+  (void)arg;
+
+  mutex_lock(&pi_mutex);
+  pi_locked = 1;
+  for (int i = 0; i < PI_HOLD_UNITS; i++) {
+    pi_work_unit();
+  }
+  mutex_unlock(&pi_mutex);
+}
+
+static void pi_hog_task(void *arg) {
+  (void)arg;
 
-  // Burst times for 6 tasks
-  int bursts[] = {10, 20, 15, 30, 25, 12};
-  int num_tasks = 6;
+  for (int i = 0; i < PI_HOG_UNITS; i++) {
+    pi_work_unit();
+  }
+}
 
-  // Metrics
-  u64 wait_rr = 0, turnaround_rr = 0, duration_rr = 0;
-  u64 wait_sjf = 0, turnaround_sjf = 0, duration_sjf = 0;
+static void pi_consumer_task(void *arg) {
+  (void)arg;
 
-  // Round 1: RR
-  kprintf("Round 1: Round-Robin...\n");
+  u64 t0 = rdtime();
+  mutex_lock(&pi_mutex);
+  pi_wait = rdtime() - t0;
+  mutex_unlock(&pi_mutex);
+}
 
-  disable_irq();
-  sched_set_mode(SCHED_RR);
-  enable_irq();
+// One run; returns how long the consumer waited for the mutex, in ms
+static u32 pcdemo_pi_round(int pi) {
+  int pids[PI_HOGS + 2];
+  int n = 0;
 
-  u64 start_rr = g_ticks;
-  int pids_rr[6];
+  mutex_set_pi(pi);
+  mutex_init(&pi_mutex);
+  pi_locked = 0;
+  pi_wait = 0;
 
-  for (int i = 0; i < num_tasks; i++) {
-    pids_rr[i] = task_create(bench_task, (void *)(u64)bursts[i], bursts[i]);
+  pids[n++] = task_create(pi_producer_task, (void *)0, 50);
+  while (!pi_locked) {
+    task_sleep(1);
   }
+  for (int i = 0; i < PI_HOGS; i++) {
+    pids[n++] = task_create(pi_hog_task, (void *)0, 10);
+  }
+  pids[n++] = task_create(pi_consumer_task, (void *)0, 1);
 
-  // Wait for all tasks to finish
-  int all_done = 0;
-  while (!all_done) {
-    all_done = 1;
-    for (int i = 0; i < num_tasks; i++) {
-      pcb_t *task = task_get_by_pid(pids_rr[i]);
-      if (task && task->state != TASK_ZOMBIE) {
-        all_done = 0;
-        // kprintf("Waiting for task %d (State: %d)\n", pids_rr[i],
-        // task->state);
-        break;
-      }
-    }
-    task_yield();
+  for (int i = 0; i < n; i++) {
+    task_join(pids[i], (int *)0);
   }
+  return (u32)(pi_wait / (TIMEBASE_HZ / 1000));
+}
+
+static void cmd_pcdemo_pi(void) {
+  sched_mode_t old_mode = sched_get_mode();
+  int old_alpha = sched_get_burst_alpha();
+  int old_pi = mutex_get_pi();
+
+  // Estimates pinned to the burst hints, so the ranking is fixed:
+  // consumer (1) < medium tasks (10) < producer (50)
+  sched_set_mode(SCHED_SJF);
+  sched_set_burst_alpha(0);
+
+  kprintf("=== Priority Inversion Demo (SJF) ===\n");
+  kprintf("Producer (estimate 50) holds the mutex for %d ms; %d tasks "
+          "(estimate 10) run %d ms each; consumer (estimate 1) waits\n",
+          PI_HOLD_UNITS, PI_HOGS, PI_HOG_UNITS);
+  u32 off = pcdemo_pi_round(0);
+  kprintf("PI off: consumer waited %u ms\n", off);
+  u32 on = pcdemo_pi_round(1);
+  kprintf("PI on:  consumer waited %u ms\n", on);
+
+  mutex_set_pi(old_pi);
+  sched_set_burst_alpha(old_alpha);
+  sched_set_mode(old_mode);
+}
+
+#define BENCH_TASKS 6
+
+typedef struct {
+  u64 wait;
+  u64 turnaround;
+  u64 duration;
+  u64 est_err; // Sum of burst estimate errors, 1/1024 tick
+  u32 bursts;
+} bench_result_t;
 
-  duration_rr = g_ticks - start_rr;
+// Staggered arrivals, so SRTF sees short tasks turn up while a long
+// one runs; several bursts per task, so estimates have something to
+// learn; and hints off by 2-4x either way, so the first bursts mispredict
+static const bench_spec_t bench_specs[BENCH_TASKS] = {
+    {0, 10, 3, 20},  {0, 4, 5, 12},  {2, 15, 2, 5},
+    {5, 3, 4, 10},   {8, 6, 3, 2},   {12, 2, 6, 8},
+};
 
-  // Collect metrics
-  for (int i = 0; i < num_tasks; i++) {
-    pcb_t *task = task_get_by_pid(pids_rr[i]);
-    if (task) {
-      wait_rr += task->wait_time;
-      turnaround_rr += (task->finish_time - task->arrival_time);
-      sched_update_burst_estimate(task);
-      task_reap(pids_rr[i]);
+static void bench_round(sched_mode_t mode, bench_result_t *res) {
+  int pids[BENCH_TASKS];
+
+  memset(res, 0, sizeof(bench_result_t));
+  sched_set_mode(mode);
+
+  u64 start = g_ticks;
+
+  for (int i = 0; i < BENCH_TASKS; i++) {
+    const bench_spec_t *spec = &bench_specs[i];
+    if (g_ticks - start < spec->arrival) {
+      task_sleep(spec->arrival - (g_ticks - start));
     }
+    pids[i] = task_create(bench_task, (void *)spec, spec->hint);
   }
 
-  kprintf("RR done in %u ticks\n", (u32)duration_rr);
+  // Join every task and collect its metrics. Burst estimates were
+  // updated by the scheduler as each task's bursts ended.
+  u64 last_finish = start;
+  for (int i = 0; i < BENCH_TASKS; i++) {
+    pcb_t info;
+    if (task_waitpid(pids[i], (int *)0, &info) < 0) {
+      continue;
+    }
+    res->wait += info.wait_time;
+    res->turnaround += (info.finish_time - info.arrival_time);
+    res->est_err += info.burst_err;
+    res->bursts += info.burst_count;
+    if (info.finish_time > last_finish) {
+      last_finish = info.finish_time;
+    }
+  }
 
-  // Small delay
-  for (volatile int i = 0; i < 100000; i++)
-    ;
+  res->duration = last_finish - start;
+}
 
-  // Round 2: SJF
-  kprintf("Round 2: SJF...\n");
+static void cmd_bench(void) {
+  sched_mode_t prev_mode = sched_get_mode();
+  sched_mode_t modes[3] = {SCHED_RR, SCHED_SJF, SCHED_SRTF};
+  bench_result_t res[3];
 
-  disable_irq();
-  sched_set_mode(SCHED_SJF);
-  enable_irq();
+  kprintf("Running benchmark...\n");
 
-  u64 start_sjf = g_ticks;
-  int pids_sjf[6];
+  for (int r = 0; r < 3; r++) {
+    kprintf("Round %d: %s...\n", r + 1, sched_mode_name(modes[r]));
+    bench_round(modes[r], &res[r]);
+    kprintf("%s done in %u ticks\n", sched_mode_name(modes[r]),
+            (u32)res[r].duration);
 
-  for (int i = 0; i < num_tasks; i++) {
-    pids_sjf[i] = task_create(bench_task, (void *)(u64)bursts[i], bursts[i]);
+    // Small delay
+    for (volatile int i = 0; i < 100000; i++)
+      ;
   }
+  sched_set_mode(prev_mode);
 
-  // Wait for all tasks to finish
-  all_done = 0;
-  while (!all_done) {
-    all_done = 1;
-    for (int i = 0; i < num_tasks; i++) {
-      pcb_t *task = task_get_by_pid(pids_sjf[i]);
-      if (task && task->state != TASK_ZOMBIE) {
-        all_done = 0;
-        break;
-      }
+  // Print comparison table
+  kprintf("\nBenchmark Results (%d tasks):\n", BENCH_TASKS);
+  kprintf("                  RR        SJF       SRTF\n");
+  kprintf("Wait (avg):       %u        %u        %u ticks\n",
+          (u32)(res[0].wait / BENCH_TASKS), (u32)(res[1].wait / BENCH_TASKS),
+          (u32)(res[2].wait / BENCH_TASKS));
+  kprintf("Turnaround (avg): %u        %u        %u ticks\n",
+          (u32)(res[0].turnaround / BENCH_TASKS),
+          (u32)(res[1].turnaround / BENCH_TASKS),
+          (u32)(res[2].turnaround / BENCH_TASKS));
+
+  // Throughput: tasks per 100 ticks (to avoid float)
+  kprintf("Throughput:       ");
+  for (int r = 0; r < 3; r++) {
+    u32 duration = (u32)(res[r].duration ? res[r].duration : 1);
+    u32 throughput = (BENCH_TASKS * 100) / duration;
+    kprintf("%u.%u     ", throughput / 100, throughput % 100);
+  }
+  kprintf("tasks/sec\n");
+
+  // Mean absolute error of the burst estimate, in hundredths of a tick
+  kprintf("Est. error (avg): ");
+  for (int r = 0; r < 3; r++) {
+    u32 bursts = res[r].bursts ? res[r].bursts : 1;
+    u32 err = (u32)(((res[r].est_err / bursts) * 100) >> BURST_FP_SHIFT);
+    kprintf("%u.%u%u     ", err / 100, (err / 10) % 10, err % 10);
+  }
+  kprintf("ticks (alpha=%d%%)\n", sched_get_burst_alpha());
+}
+
+#define LAT_HOGS 16
+#define LAT_SAMPLES 32
+
+// One latency round: the shell sleeps a tick at a time, the way it waits
+// for input, and measures how long it takes to run again after the tick
+// that woke it. That delay is what a keystroke waits before being echoed.
+static void bench_lat_round(sched_mode_t mode, u32 *avg_us, u32 *max_us) {
+  int pids[LAT_HOGS];
+  pcb_t *self = sched_current();
+
+  sched_set_mode(mode);
+  hog_stop = 0;
+  for (int i = 0; i < LAT_HOGS; i++) {
+    pids[i] = task_create(hog_task, (void *)0, 20);
+  }
+
+  // Let the hogs settle into their steady-state priority
+  task_sleep(20);
+
+  u64 total = 0;
+  u64 worst = 0;
+  for (int i = 0; i < LAT_SAMPLES; i++) {
+    task_sleep(1);
+    u64 lat = rdtime() - self->wake_stamp;
+    uart_putc('.');
+    total += lat;
+    if (lat > worst) {
+      worst = lat;
     }
-    task_yield();
+  }
+  kprintf("\n");
+
+  hog_stop = 1;
+  for (int i = 0; i < LAT_HOGS; i++) {
+    task_join(pids[i], (int *)0);
+  }
+
+  u64 cycles_per_us = TIMEBASE_HZ / 1000000;
+  *avg_us = (u32)(total / LAT_SAMPLES / cycles_per_us);
+  *max_us = (u32)(worst / cycles_per_us);
+}
+
+static void cmd_bench_lat(void) {
+  sched_mode_t prev_mode = sched_get_mode();
+  sched_mode_t modes[2] = {SCHED_RR, SCHED_MLFQ};
+  u32 avg[2], max[2];
+
+  kprintf("Shell wakeup-to-echo latency with %d CPU-bound tasks\n", LAT_HOGS);
+  for (int r = 0; r < 2; r++) {
+    kprintf("%s: ", sched_mode_name(modes[r]));
+    bench_lat_round(modes[r], &avg[r], &max[r]);
+  }
+  sched_set_mode(prev_mode);
+
+  kprintf("                  RR        MLFQ\n");
+  kprintf("Latency (avg):    %u        %u us\n", avg[0], avg[1]);
+  kprintf("Latency (max):    %u        %u us\n", max[0], max[1]);
+}
+
+#define FAIR_TASKS 4
+#define FAIR_TICKS 200
+
+// Run two yielders and two hogs for FAIR_TICKS and return each one's CPU
+// time in microseconds
+static void bench_fair_round(sched_mode_t mode, u64 *cpu_us) {
+  int pids[FAIR_TASKS];
+
+  sched_set_mode(mode);
+  hog_stop = 0;
+  for (int i = 0; i < FAIR_TASKS; i++) {
+    pids[i] = task_create(i < FAIR_TASKS / 2 ? yielder_task : hog_task,
+                          (void *)0, 20);
   }
 
-  duration_sjf = g_ticks - start_sjf;
+  task_sleep(FAIR_TICKS);
+  hog_stop = 1;
 
-  // Collect metrics
-  for (int i = 0; i < num_tasks; i++) {
-    pcb_t *task = task_get_by_pid(pids_sjf[i]);
-    if (task) {
-      wait_sjf += task->wait_time;
-      turnaround_sjf += (task->finish_time - task->arrival_time);
-      sched_update_burst_estimate(task);
-      task_reap(pids_sjf[i]);
+  for (int i = 0; i < FAIR_TASKS; i++) {
+    pcb_t info;
+    cpu_us[i] = 0;
+    if (task_waitpid(pids[i], (int *)0, &info) == 0) {
+      cpu_us[i] = info.sum_exec / (TIMEBASE_HZ / 1000000);
     }
   }
+}
+
+// Jain's fairness index (sum x)^2 / (n * sum x^2), scaled by 1000
+static u32 fairness_index(const u64 *x, int n) {
+  u64 sum = 0;
+  u64 sum_sq = 0;
+  for (int i = 0; i < n; i++) {
+    sum += x[i];
+    sum_sq += x[i] * x[i];
+  }
+  if (sum_sq == 0) {
+    return 0;
+  }
+  return (u32)((sum * sum / n) * 1000 / sum_sq);
+}
 
-  kprintf("SJF done in %u ticks\n", (u32)duration_sjf);
+static void cmd_bench_fair(void) {
+  sched_mode_t prev_mode = sched_get_mode();
+  sched_mode_t modes[2] = {SCHED_RR, SCHED_FAIR};
+  u64 cpu_us[2][FAIR_TASKS];
 
-  // Print comparison table
-  kprintf("\nBenchmark Results (%d tasks):\n", num_tasks);
-  kprintf("                  RR        SJF\n");
-  kprintf("Wait (avg):       %u        %u ticks\n", (u32)(wait_rr / num_tasks),
-          (u32)(wait_sjf / num_tasks));
-  kprintf("Turnaround (avg): %u        %u ticks\n",
-          (u32)(turnaround_rr / num_tasks), (u32)(turnaround_sjf / num_tasks));
+  kprintf("CPU share of %d yielders and %d hogs over %d ticks\n",
+          FAIR_TASKS / 2, FAIR_TASKS / 2, FAIR_TICKS);
+  for (int r = 0; r < 2; r++) {
+    kprintf("Round %d: %s...\n", r + 1, sched_mode_name(modes[r]));
+    bench_fair_round(modes[r], cpu_us[r]);
+  }
+  sched_set_mode(prev_mode);
 
-  // Throughput: tasks per 100 ticks (to avoid float)
-  u32 throughput_rr = (num_tasks * 100) / (duration_rr ? duration_rr : 1);
-  u32 throughput_sjf = (num_tasks * 100) / (duration_sjf ? duration_sjf : 1);
-  kprintf("Throughput:       %u.%u     %u.%u tasks/sec\n", throughput_rr / 100,
-          throughput_rr % 100, throughput_sjf / 100, throughput_sjf % 100);
+  kprintf("TASK     RR (ms)   FAIR (ms)\n");
+  for (int i = 0; i < FAIR_TASKS; i++) {
+    kprintf("%s  %u        %u\n", i < FAIR_TASKS / 2 ? "yielder" : "hog    ",
+            (u32)(cpu_us[0][i] / 1000), (u32)(cpu_us[1][i] / 1000));
+  }
+
+  u32 jain_rr = fairness_index(cpu_us[0], FAIR_TASKS);
+  u32 jain_fair = fairness_index(cpu_us[1], FAIR_TASKS);
+  kprintf("Fairness index:   %u.%u%u%u     %u.%u%u%u\n", jain_rr / 1000,
+          (jain_rr / 100) % 10, (jain_rr / 10) % 10, jain_rr % 10,
+          jain_fair / 1000, (jain_fair / 100) % 10, (jain_fair / 10) % 10,
+          jain_fair % 10);
+}
+
+#define EDF_BENCH_TASKS 4
+#define EDF_BENCH_HOGS 2
+#define EDF_BENCH_TICKS 300
+
+// Periodic task set (runtime, period, deadline), utilization 0.8
+static const u32 edf_set[EDF_BENCH_TASKS][3] = {
+    {2, 10, 10}, {3, 15, 15}, {4, 20, 16}, {5, 25, 25}};
+
+// Run the periodic set next to two background CPU hogs and record each
+// task's deadline misses and job count
+static void bench_edf_round(sched_mode_t mode, u32 *misses, u32 *jobs) {
+  int pids[EDF_BENCH_TASKS];
+  int hogs[EDF_BENCH_HOGS];
+
+  sched_set_mode(mode);
+  hog_stop = 0;
+  for (int i = 0; i < EDF_BENCH_HOGS; i++) {
+    hogs[i] = task_create(hog_task, (void *)0, 20);
+  }
+  for (int i = 0; i < EDF_BENCH_TASKS; i++) {
+    u64 njobs = EDF_BENCH_TICKS / edf_set[i][1];
+    pids[i] = task_create_rt(rt_task, (void *)njobs, edf_set[i][0],
+                             edf_set[i][1], edf_set[i][2]);
+  }
+
+  if (mode == SCHED_RR) {
+    // Admission control: one more task would push utilization past 1
+    int pid = task_create_rt(rt_task, (void *)1, 3, 10, 10);
+    if (pid >= 0) {
+      task_detach(pid);
+    }
+    kprintf("Admission of (3,10,10) at utilization %u/1000: %s\n",
+            edf_utilization(), pid < 0 ? "refused" : "accepted");
+  }
+
+  for (int i = 0; i < EDF_BENCH_TASKS; i++) {
+    pcb_t info;
+    misses[i] = 0;
+    jobs[i] = 0;
+    if (task_waitpid(pids[i], (int *)0, &info) == 0) {
+      misses[i] = info.dl_misses;
+      jobs[i] = info.dl_jobs;
+    }
+  }
+
+  hog_stop = 1;
+  for (int i = 0; i < EDF_BENCH_HOGS; i++) {
+    task_join(hogs[i], (int *)0);
+  }
+}
+
+static void cmd_bench_edf(void) {
+  sched_mode_t prev_mode = sched_get_mode();
+  sched_mode_t modes[2] = {SCHED_RR, SCHED_EDF};
+  u32 misses[2][EDF_BENCH_TASKS];
+  u32 jobs[2][EDF_BENCH_TASKS];
+
+  kprintf("Periodic set of %d tasks with %d background hogs, %d ticks\n",
+          EDF_BENCH_TASKS, EDF_BENCH_HOGS, EDF_BENCH_TICKS);
+  for (int r = 0; r < 2; r++) {
+    kprintf("Round %d: %s...\n", r + 1, sched_mode_name(modes[r]));
+    bench_edf_round(modes[r], misses[r], jobs[r]);
+  }
+  sched_set_mode(prev_mode);
+
+  kprintf("TASK  C/T/D       RR miss/jobs   EDF miss/jobs\n");
+  u32 total[2] = {0, 0};
+  for (int i = 0; i < EDF_BENCH_TASKS; i++) {
+    kprintf("%d     %u/%u/%u     %u/%u           %u/%u\n", i, edf_set[i][0],
+            edf_set[i][1], edf_set[i][2], misses[0][i], jobs[0][i],
+            misses[1][i], jobs[1][i]);
+    total[0] += misses[0][i];
+    total[1] += misses[1][i];
+  }
+  kprintf("Deadline misses:  %u        %u\n", total[0], total[1]);
+}
+
+static int parse_sched_mode(const char *s, sched_mode_t *mode) {
+  if (strcmp(s, "rr") == 0) {
+    *mode = SCHED_RR;
+  } else if (strcmp(s, "sjf") == 0) {
+    *mode = SCHED_SJF;
+  } else if (strcmp(s, "mlfq") == 0) {
+    *mode = SCHED_MLFQ;
+  } else if (strcmp(s, "fair") == 0) {
+    *mode = SCHED_FAIR;
+  } else if (strcmp(s, "edf") == 0) {
+    *mode = SCHED_EDF;
+  } else if (strcmp(s, "srtf") == 0) {
+    *mode = SCHED_SRTF;
+  } else {
+    return -1;
+  }
+  return 0;
+}
+
+static void cmd_replay(const char *arg) {
+  static replay_metrics_t results[2][REPLAY_MAX_TASKS];
+  sched_mode_t modes[2] = {SCHED_RR, SCHED_SJF};
+
+  // Optional "replay <policy> <policy>"
+  if (*arg) {
+    char first[16];
+    int i = 0;
+    while (*arg && *arg != ' ' && i < (int)sizeof(first) - 1) {
+      first[i++] = *arg++;
+    }
+    first[i] = '\0';
+    while (*arg == ' ') {
+      arg++;
+    }
+    if (parse_sched_mode(first, &modes[0]) < 0 ||
+        parse_sched_mode(arg, &modes[1]) < 0) {
+      kprintf("Usage: replay [<policy> <policy>]  (rr, sjf, srtf, mlfq, fair, edf)\n");
+      return;
+    }
+  }
+
+  int n = replay_task_count();
+  if (n <= 0) {
+    kprintf("No valid workload trace embedded in the kernel image\n");
+    return;
+  }
+
+  kprintf("=== Trace Replay (%d tasks) ===\n", n);
+  for (int r = 0; r < 2; r++) {
+    kprintf("Replaying under %s...\n", sched_mode_name(modes[r]));
+    u64 start = g_ticks;
+    replay_run(modes[r], results[r]);
+    kprintf("%s done in %u ticks\n", sched_mode_name(modes[r]),
+            (u32)(g_ticks - start));
+  }
+
+  kprintf("\nTASK  ARRIVAL  CPU  IO    %s resp/turn    %s resp/turn\n",
+          sched_mode_name(modes[0]), sched_mode_name(modes[1]));
+
+  u64 resp[2] = {0, 0};
+  u64 turn[2] = {0, 0};
+  int count = 0;
+  for (int i = 0; i < n; i++) {
+    replay_metrics_t *a = &results[0][i];
+    replay_metrics_t *b = &results[1][i];
+    if (a->pid < 0 || b->pid < 0) {
+      kprintf("%d     (not spawned: out of task slots)\n", i);
+      continue;
+    }
+    kprintf("%d     %u       %u   %u     %u/%u          %u/%u\n", i,
+            a->arrival, a->cpu, a->io, a->response, a->turnaround,
+            b->response, b->turnaround);
+    resp[0] += a->response;
+    turn[0] += a->turnaround;
+    resp[1] += b->response;
+    turn[1] += b->turnaround;
+    count++;
+  }
+
+  if (count == 0) {
+    return;
+  }
+  kprintf("Response (avg):   %u        %u ticks\n", (u32)(resp[0] / count),
+          (u32)(resp[1] / count));
+  kprintf("Turnaround (avg): %u        %u ticks\n",
+          (u32)(turn[0] / count), (u32)(turn[1] / count));
+}
+
+#define SPAWN_MAX 4096
+
+static int spawn_pids[SPAWN_MAX];
+
+static void spawn_task(void *arg) { (void)arg; }
+
+// Create n tasks back to back, then join them all. Returns how many were
+// created; times are rdtime cycles.
+static int bench_spawn_round(int n, u64 *create, u64 *join) {
+  int created = 0;
+  u64 start = rdtime();
+
+  while (created < n) {
+    spawn_pids[created] = task_create(spawn_task, (void *)0, 1);
+    if (spawn_pids[created] < 0) {
+      break;
+    }
+    created++;
+  }
+  *create = rdtime() - start;
+
+  start = rdtime();
+  for (int i = 0; i < created; i++) {
+    task_join(spawn_pids[i], (int *)0);
+  }
+  *join = rdtime() - start;
+
+  return created;
+}
+
+static void cmd_bench_spawn(void) {
+  static const int counts[3] = {32, 1024, 4096};
+  u64 cycles_per_us = TIMEBASE_HZ / 1000000;
+
+  kprintf("Tasks   Created   Create (us)   Tasks/sec   Run+join (us)\n");
+  for (int r = 0; r < 3; r++) {
+    u64 create, join;
+    int created = bench_spawn_round(counts[r], &create, &join);
+    u64 rate = create ? (u64)created * TIMEBASE_HZ / create : 0;
+
+    kprintf("%d    %d      %u        %u       %u\n", counts[r], created,
+            (u32)(create / cycles_per_us), (u32)rate,
+            (u32)(join / cycles_per_us));
+  }
+
+  // Every PID above has been reaped; a stale one must not resolve
+  kprintf("Stale PID %d: %s\n", spawn_pids[0],
+          task_get_by_pid(spawn_pids[0]) ? "still found (BUG)" : "rejected");
+}
+
+#define IDLE_TASKS 4
+#define IDLE_TICKS 200
+
+// Context switch rate with a few tasks that are mostly asleep, which is
+// where idle used to cost a round trip through the run queue
+static void cmd_bench_idle(void) {
+  int pids[IDLE_TASKS];
+
+  hog_stop = 0;
+  for (int i = 0; i < IDLE_TASKS; i++) {
+    pids[i] = task_create(light_task, (void *)0, 1);
+  }
+
+  u64 sw0 = sched_context_switches();
+  u64 idle0 = sched_idle_switches();
+  task_sleep(IDLE_TICKS);
+  u64 sw = sched_context_switches() - sw0;
+  u64 idle = sched_idle_switches() - idle0;
+
+  hog_stop = 1;
+  for (int i = 0; i < IDLE_TASKS; i++) {
+    task_join(pids[i], (int *)0);
+  }
+
+  kprintf("%d light tasks over %d ticks (%s)\n", IDLE_TASKS, IDLE_TICKS,
+          sched_mode_name(sched_get_mode()));
+  kprintf("Context switches: %u/sec, to idle: %u/sec\n",
+          (u32)(sw * TICK_HZ / IDLE_TICKS), (u32)(idle * TICK_HZ / IDLE_TICKS));
+}
+
+#define TIMER_BENCH_N 10000
+#define TIMER_BENCH_TICKS 100
+
+static ktimer_t bench_timers[TIMER_BENCH_N];
+static volatile int bench_timer_fired = 0;
+
+static void bench_timer_fn(void *arg) {
+  (void)arg;
+  bench_timer_fired++;
+}
+
+// Average and worst ktimer_tick cost over TIMER_BENCH_TICKS, in cycles
+static void bench_timer_window(u64 *avg, u64 *max) {
+  ktimer_reset_stats();
+  task_sleep(TIMER_BENCH_TICKS);
+  ktimer_stats(avg, max);
+}
+
+// Per-tick wheel cost with no timers and with 10k outstanding ones. The
+// deadlines are spread over all wheel levels but none falls inside the
+// measured window, so only the tick and cascade cost is counted.
+static void cmd_bench_timer(void) {
+  u64 avg[2], max[2];
+
+  bench_timer_window(&avg[0], &max[0]);
+
+  bench_timer_fired = 0;
+  u32 seed = 4321;
+  u64 t0 = rdtime();
+  for (int i = 0; i < TIMER_BENCH_N; i++) {
+    seed = seed * 1103515245 + 12345;
+    u64 deadline = g_ticks + 2 * TIMER_BENCH_TICKS + (seed >> 8) % 1000000;
+    ktimer_add(&bench_timers[i], deadline, bench_timer_fn, (void *)0);
+  }
+  u64 add_cycles = rdtime() - t0;
+
+  bench_timer_window(&avg[1], &max[1]);
+
+  t0 = rdtime();
+  int cancelled = 0;
+  for (int i = 0; i < TIMER_BENCH_N; i++) {
+    cancelled += ktimer_cancel(&bench_timers[i]);
+  }
+  u64 cancel_cycles = rdtime() - t0;
+
+  u64 ns_per_cycle = 1000000000UL / TIMEBASE_HZ;
+  kprintf("Timer wheel, %d ticks per window\n", TIMER_BENCH_TICKS);
+  kprintf("Outstanding   Tick avg (ns)   Tick max (ns)\n");
+  kprintf("0             %u             %u\n", (u32)(avg[0] * ns_per_cycle),
+          (u32)(max[0] * ns_per_cycle));
+  kprintf("%d         %u             %u\n", TIMER_BENCH_N,
+          (u32)(avg[1] * ns_per_cycle), (u32)(max[1] * ns_per_cycle));
+  kprintf("Add: %u ns/timer, cancel: %u ns/timer (%d cancelled, %d fired)\n",
+          (u32)(add_cycles * ns_per_cycle / TIMER_BENCH_N),
+          (u32)(cancel_cycles * ns_per_cycle / TIMER_BENCH_N), cancelled,
+          bench_timer_fired);
+}
+
+#define PICK_TASKS 4096
+#define PICK_PASSES 16
+
+// pcb_t as it was laid out before the hot/cold split, with everything
+// after the run queue link folded into padding of the same size
+typedef struct legacy_pcb {
+  int pid;
+  task_state_t state;
+  context_t context;
+  void *stack_base;
+  void (*entry)(void *);
+  void *arg;
+  u64 ticks_used;
+  int burst_hint;
+  u64 burst_estimate;
+  u64 burst_avg;
+  u64 burst_start;
+  u64 burst_err;
+  u32 burst_count;
+  u64 arrival_time;
+  u64 start_time;
+  u64 finish_time;
+  u64 wait_time;
+  struct legacy_pcb *rq_next;
+  u8 tail[200];
+} legacy_pcb_t;
+
+// The SJF selection loop from sched_pick_next_sjf, once per layout
+static legacy_pcb_t *pick_scan_legacy(legacy_pcb_t *head) {
+  legacy_pcb_t *best = (legacy_pcb_t *)0;
+  u64 min_burst = ~0UL;
+
+  for (legacy_pcb_t *task = head; task; task = task->rq_next) {
+    if (task->burst_avg < min_burst ||
+        (task->burst_avg == min_burst &&
+         task->arrival_time < best->arrival_time)) {
+      min_burst = task->burst_avg;
+      best = task;
+    }
+  }
+  return best;
+}
+
+static pcb_t *pick_scan_hot(pcb_t *head) {
+  pcb_t *best = (pcb_t *)0;
+  u64 min_burst = ~0UL;
+
+  for (pcb_t *task = head; task; task = task->rq_next) {
+    if (task->burst_avg < min_burst ||
+        (task->burst_avg == min_burst &&
+         task->arrival_time < best->arrival_time)) {
+      min_burst = task->burst_avg;
+      best = task;
+    }
+  }
+  return best;
+}
+
+// Time a full scan of a PICK_TASKS-long run queue in both PCB layouts.
+// The PCBs are scratch copies, not live tasks.
+static void cmd_bench_pick(void) {
+  legacy_pcb_t *legacy =
+      (legacy_pcb_t *)kmalloc(PICK_TASKS * sizeof(legacy_pcb_t));
+  pcb_t *hot = (pcb_t *)kmalloc_aligned(PICK_TASKS * sizeof(pcb_t),
+                                        CACHE_LINE_SIZE);
+  if (!legacy || !hot) {
+    kprintf("bench pick: out of memory\n");
+    kfree(legacy);
+    kfree_aligned(hot);
+    return;
+  }
+
+  // Same pseudo-random keys in both queues
+  u32 seed = 12345;
+  for (int i = 0; i < PICK_TASKS; i++) {
+    seed = seed * 1103515245 + 12345;
+    legacy[i].burst_avg = hot[i].burst_avg = (seed >> 8) & 0xffff;
+    legacy[i].arrival_time = hot[i].arrival_time = (u64)i;
+    legacy[i].rq_next =
+        i + 1 < PICK_TASKS ? &legacy[i + 1] : (legacy_pcb_t *)0;
+    hot[i].rq_next = i + 1 < PICK_TASKS ? &hot[i + 1] : (pcb_t *)0;
+  }
+
+  u64 cycles[2] = {0, 0};
+  int same = 1;
+  for (int pass = 0; pass < PICK_PASSES; pass++) {
+    u64 t0 = rdtime();
+    legacy_pcb_t *a = pick_scan_legacy(legacy);
+    u64 t1 = rdtime();
+    pcb_t *b = pick_scan_hot(hot);
+    u64 t2 = rdtime();
+
+    cycles[0] += t1 - t0;
+    cycles[1] += t2 - t1;
+    same &= (a - legacy) == (b - hot);
+  }
+
+  // Nanoseconds per task visited
+  u64 visits = (u64)PICK_TASKS * PICK_PASSES;
+  u64 ns_per_cycle = 1000000000UL / TIMEBASE_HZ;
+  kprintf("Pick-next scan over %d ready tasks, %d passes\n", PICK_TASKS,
+          PICK_PASSES);
+  kprintf("Layout   PCB bytes   ns/task\n");
+  kprintf("legacy   %u         %u\n", (u32)sizeof(legacy_pcb_t),
+          (u32)(cycles[0] * ns_per_cycle / visits));
+  kprintf("hot      %u         %u\n", (u32)sizeof(pcb_t),
+          (u32)(cycles[1] * ns_per_cycle / visits));
+  if (!same) {
+    kprintf("Warning: layouts picked different tasks\n");
+  }
+
+  kfree(legacy);
+  kfree_aligned(hot);
+}
+
+#define SYNC_ITERS 100000
+#define SYNC_TASKS 32
+#define SYNC_ROUNDS 200
+#define SYNC_SEM_SLOTS 4
+#define SYNC_BARRIER_ROUNDS 1000
+
+static int legacy_sem_count;
+static sem_t sync_sem;
+static mutex_t sync_mutex;
+static spinlock_t sync_spin;
+static latch_t sync_start;
+static barrier_t sync_barrier;
+static volatile int sync_phase_bad;
+static volatile int sync_counter;
+static volatile int sync_inside;
+static volatile int sync_inside_max;
+
+// The semaphore fast path as it was: toggle SIE around a plain update
+static void legacy_sem_pair(void) {
+  irqflags_t flags = irq_save();
+  legacy_sem_count--;
+  irq_restore(flags);
+  flags = irq_save();
+  legacy_sem_count++;
+  irq_restore(flags);
+}
+
+// Each round holds the mutex across a yield, so the other tasks find it
+// taken and sleep, and passes through a semaphore that admits at most
+// SYNC_SEM_SLOTS tasks at a time
+static void sync_task(void *arg) {
+  (void)arg;
+
+  latch_wait(&sync_start);
+  for (int i = 0; i < SYNC_ROUNDS; i++) {
+    sem_wait(&sync_sem);
+    int in = ++sync_inside;
+    if (in > sync_inside_max) {
+      sync_inside_max = in;
+    }
+
+    mutex_lock(&sync_mutex);
+    int v = sync_counter;
+    task_yield();
+    sync_counter = v + 1;
+    mutex_unlock(&sync_mutex);
+
+    sync_inside--;
+    sem_post(&sync_sem);
+  }
+}
+
+// Every task bumps the counter once per round; the round's last arrival
+// checks that nobody got ahead
+static void barrier_task(void *arg) {
+  (void)arg;
+
+  latch_wait(&sync_start);
+  for (int i = 0; i < SYNC_BARRIER_ROUNDS; i++) {
+    __atomic_fetch_add(&sync_counter, 1, __ATOMIC_RELAXED);
+    if (barrier_wait(&sync_barrier) &&
+        sync_counter != (i + 1) * SYNC_TASKS) {
+      sync_phase_bad++;
+    }
+  }
+}
+
+// Create SYNC_TASKS tasks held at the start latch, release them all with
+// one count-down and join them. Returns the elapsed rdtime cycles.
+static u64 sync_run(void (*fn)(void *)) {
+  int pids[SYNC_TASKS];
+
+  latch_init(&sync_start, 1);
+  for (int i = 0; i < SYNC_TASKS; i++) {
+    pids[i] = task_create(fn, (void *)0, 10);
+  }
+
+  u64 t0 = rdtime();
+  latch_count_down(&sync_start);
+  for (int i = 0; i < SYNC_TASKS; i++) {
+    task_join(pids[i], (int *)0);
+  }
+  return rdtime() - t0;
+}
+
+static void cmd_bench_sync(void) {
+  u64 ns_per_cycle = 1000000000UL / TIMEBASE_HZ;
+  u64 t0, cycles[4];
+
+  sem_init(&sync_sem, 1);
+  mutex_init(&sync_mutex);
+  spin_init(&sync_spin);
+
+  // Uncontended: one task, so every operation takes the fast path
+  t0 = rdtime();
+  for (int i = 0; i < SYNC_ITERS; i++) {
+    legacy_sem_pair();
+  }
+  cycles[0] = rdtime() - t0;
+
+  t0 = rdtime();
+  for (int i = 0; i < SYNC_ITERS; i++) {
+    sem_wait(&sync_sem);
+    sem_post(&sync_sem);
+  }
+  cycles[1] = rdtime() - t0;
+
+  t0 = rdtime();
+  for (int i = 0; i < SYNC_ITERS; i++) {
+    mutex_lock(&sync_mutex);
+    mutex_unlock(&sync_mutex);
+  }
+  cycles[2] = rdtime() - t0;
+
+  t0 = rdtime();
+  for (int i = 0; i < SYNC_ITERS; i++) {
+    spin_lock(&sync_spin);
+    spin_unlock(&sync_spin);
+  }
+  cycles[3] = rdtime() - t0;
+
+  static const char *names[4] = {"IRQ-toggle sem (old)", "sem wait/post",
+                                 "mutex lock/unlock", "ticket spinlock"};
+  kprintf("Uncontended, %d pairs each\n", SYNC_ITERS);
+  for (int i = 0; i < 4; i++) {
+    kprintf("  %s: %u ns/pair\n", names[i],
+            (u32)(cycles[i] * ns_per_cycle / SYNC_ITERS));
+  }
+
+  // Contended: SYNC_TASKS tasks fight over one mutex and a counting sem
+  sem_init(&sync_sem, SYNC_SEM_SLOTS);
+  sync_counter = 0;
+  sync_inside = 0;
+  sync_inside_max = 0;
+
+  u64 spent = sync_run(sync_task);
+  int expect = SYNC_TASKS * SYNC_ROUNDS;
+  kprintf("Contended, %d tasks x %d rounds: %u us\n", SYNC_TASKS,
+          SYNC_ROUNDS, (u32)(spent * ns_per_cycle / 1000));
+  kprintf("  counter %d/%d (%s), max %d/%d inside the semaphore\n",
+          sync_counter, expect, sync_counter == expect ? "ok" : "LOST UPDATES",
+          sync_inside_max, SYNC_SEM_SLOTS);
+
+  // Barrier: every task waits for all the others each round
+  barrier_init(&sync_barrier, SYNC_TASKS);
+  sync_counter = 0;
+  sync_phase_bad = 0;
+
+  spent = sync_run(barrier_task);
+  kprintf("Barrier, %d tasks x %d rounds: %u ns/round (%s)\n", SYNC_TASKS,
+          SYNC_BARRIER_ROUNDS,
+          (u32)(spent * ns_per_cycle / SYNC_BARRIER_ROUNDS),
+          sync_phase_bad ? "PHASES MIXED" : "ok");
+}
+
+#define CHAN_BENCH_MSGS 20000
+#define CHAN_BENCH_SIZE 256 // Payload bytes per message
+#define CHAN_BENCH_SLOTS 16
+
+// Baseline: the pcdemo scheme, a shared ring guarded by a mutex and two
+// condition variables, with each payload copied in and out
+static u8 cb_ring[CHAN_BENCH_SLOTS][CHAN_BENCH_SIZE];
+static int cb_in, cb_out, cb_count;
+static mutex_t cb_mutex;
+static cond_t cb_not_full;
+static cond_t cb_not_empty;
+
+static chan_t cb_chan;
+static chan_t cb_free; // Empty buffers going back to the producer
+static volatile u32 cb_sum;
+
+static void cb_shared_producer(void *arg) {
+  (void)arg;
+  u8 item[CHAN_BENCH_SIZE];
+
+  for (int i = 0; i < CHAN_BENCH_MSGS; i++) {
+    memset(item, i, CHAN_BENCH_SIZE);
+    mutex_lock(&cb_mutex);
+    while (cb_count == CHAN_BENCH_SLOTS) {
+      cond_wait(&cb_not_full, &cb_mutex);
+    }
+    memcpy(cb_ring[cb_in], item, CHAN_BENCH_SIZE);
+    cb_in = (cb_in + 1) % CHAN_BENCH_SLOTS;
+    cb_count++;
+    cond_signal(&cb_not_empty);
+    mutex_unlock(&cb_mutex);
+  }
+}
+
+static void cb_shared_consumer(void *arg) {
+  (void)arg;
+  u8 item[CHAN_BENCH_SIZE];
+
+  for (int i = 0; i < CHAN_BENCH_MSGS; i++) {
+    mutex_lock(&cb_mutex);
+    while (cb_count == 0) {
+      cond_wait(&cb_not_empty, &cb_mutex);
+    }
+    memcpy(item, cb_ring[cb_out], CHAN_BENCH_SIZE);
+    cb_out = (cb_out + 1) % CHAN_BENCH_SLOTS;
+    cb_count--;
+    cond_signal(&cb_not_full);
+    mutex_unlock(&cb_mutex);
+    cb_sum += item[0];
+  }
+}
+
+// Channel: every message is a fresh kmalloc'd buffer the consumer frees
+static void cb_chan_producer(void *arg) {
+  (void)arg;
+
+  for (int i = 0; i < CHAN_BENCH_MSGS; i++) {
+    u8 *buf = (u8 *)kmalloc(CHAN_BENCH_SIZE);
+    if (!buf) {
+      break;
+    }
+    memset(buf, i, CHAN_BENCH_SIZE);
+    chan_send(&cb_chan, buf, CHAN_BENCH_SIZE);
+  }
+  chan_close(&cb_chan);
+}
+
+static void cb_chan_consumer(void *arg) {
+  (void)arg;
+  chan_msg_t m;
+
+  while (chan_recv(&cb_chan, &m) == 0) {
+    cb_sum += ((u8 *)m.buf)[0];
+    kfree(m.buf);
+  }
+}
+
+// Channel with recycling: the consumer hands each buffer back over a
+// second channel, so no allocation happens after the first ring fill
+static void cb_pool_producer(void *arg) {
+  (void)arg;
+  chan_msg_t m;
+
+  for (int i = 0; i < CHAN_BENCH_MSGS; i++) {
+    if (!chan_tryrecv(&cb_free, &m)) {
+      m.buf = kmalloc(CHAN_BENCH_SIZE);
+      if (!m.buf) {
+        chan_recv(&cb_free, &m);
+      }
+    }
+    memset(m.buf, i, CHAN_BENCH_SIZE);
+    chan_send(&cb_chan, m.buf, CHAN_BENCH_SIZE);
+  }
+  chan_close(&cb_chan);
+}
+
+static void cb_pool_consumer(void *arg) {
+  (void)arg;
+  chan_msg_t m;
+
+  while (chan_recv(&cb_chan, &m) == 0) {
+    cb_sum += ((u8 *)m.buf)[0];
+    if (!chan_trysend(&cb_free, m.buf, m.len)) {
+      kfree(m.buf);
+    }
+  }
+}
+
+// Run one producer/consumer pair to completion. Returns messages/s.
+static u32 chan_bench_pair(void (*prod)(void *), void (*cons)(void *)) {
+  cb_sum = 0;
+  u64 t0 = rdtime();
+  int c = task_create(cons, (void *)0, 10);
+  int p = task_create(prod, (void *)0, 10);
+  task_join(p, (int *)0);
+  task_join(c, (int *)0);
+  u64 spent = rdtime() - t0;
+
+  return spent ? (u32)((u64)CHAN_BENCH_MSGS * TIMEBASE_HZ / spent) : 0;
+}
+
+static void cmd_bench_chan(void) {
+  u32 rate[3];
+
+  cb_in = 0;
+  cb_out = 0;
+  cb_count = 0;
+  mutex_init(&cb_mutex);
+  cond_init(&cb_not_full);
+  cond_init(&cb_not_empty);
+  rate[0] = chan_bench_pair(cb_shared_producer, cb_shared_consumer);
+
+  if (chan_init(&cb_chan, CHAN_BENCH_SLOTS, 0) < 0) {
+    kprintf("Error: out of memory\n");
+    return;
+  }
+  rate[1] = chan_bench_pair(cb_chan_producer, cb_chan_consumer);
+  chan_destroy(&cb_chan);
+
+  if (chan_init(&cb_chan, CHAN_BENCH_SLOTS, 0) < 0) {
+    kprintf("Error: out of memory\n");
+    return;
+  }
+  if (chan_init(&cb_free, CHAN_BENCH_SLOTS, 0) < 0) {
+    chan_destroy(&cb_chan);
+    kprintf("Error: out of memory\n");
+    return;
+  }
+  rate[2] = chan_bench_pair(cb_pool_producer, cb_pool_consumer);
+  chan_destroy(&cb_chan);
+  chan_destroy(&cb_free);
+
+  static const char *names[3] = {"shared ring + mutex/cond (copy)",
+                                 "channel, kmalloc per message",
+                                 "channel, recycled buffers"};
+  kprintf("%d messages of %d bytes, %d slots\n", CHAN_BENCH_MSGS,
+          CHAN_BENCH_SIZE, CHAN_BENCH_SLOTS);
+  for (int i = 0; i < 3; i++) {
+    kprintf("  %s: %u msgs/s\n", names[i], rate[i]);
+  }
+}
+
+#define CORO_BENCH_N 64
+#define CORO_BENCH_YIELDS 1000
+#define CORO_BENCH_MANY 20000
+
+typedef struct {
+  coro_t co;
+  int i;
+} coro_bench_t;
+
+static latch_t coro_gate;
+static latch_t coro_done;
+
+static int coro_yielder(coro_t *co) {
+  coro_bench_t *st = container_of(co, coro_bench_t, co);
+
+  CORO_BEGIN(co);
+  for (st->i = 0; st->i < CORO_BENCH_YIELDS; st->i++) {
+    CORO_YIELD(co);
+  }
+  latch_count_down(&coro_done);
+  CORO_END(co);
+}
+
+static void task_yielder(void *arg) {
+  (void)arg;
+
+  latch_wait(&coro_gate);
+  for (int i = 0; i < CORO_BENCH_YIELDS; i++) {
+    task_yield();
+  }
+}
+
+// Sleeps once, then frees its own state block
+static int coro_sleeper(coro_t *co) {
+  coro_bench_t *st = container_of(co, coro_bench_t, co);
+
+  CORO_BEGIN(co);
+  CORO_SLEEP(co, 1 + st->i % 10);
+  latch_count_down(&coro_done);
+  kfree(st);
+  CORO_END(co);
+}
+
+static void cmd_bench_coro(void) {
+  u64 ns_per_cycle = 1000000000UL / TIMEBASE_HZ;
+  u64 switches = (u64)CORO_BENCH_N * CORO_BENCH_YIELDS;
+  int pids[CORO_BENCH_N];
+
+  kprintf("Memory per task: full %u bytes (PCB %u + stack %u), "
+          "coroutine %u bytes (coro_t %u + state)\n",
+          (u32)(sizeof(pcb_t) + STACK_SIZE), (u32)sizeof(pcb_t), STACK_SIZE,
+          (u32)sizeof(coro_bench_t), (u32)sizeof(coro_t));
+
+  // Switch cost: N of each kind yield K times apiece
+  coro_bench_t *cos =
+      (coro_bench_t *)kmalloc(CORO_BENCH_N * sizeof(coro_bench_t));
+  if (!cos) {
+    kprintf("Error: out of memory\n");
+    return;
+  }
+  latch_init(&coro_done, CORO_BENCH_N);
+  u64 t0 = rdtime();
+  for (int i = 0; i < CORO_BENCH_N; i++) {
+    coro_start(&cos[i].co, coro_yielder);
+  }
+  latch_wait(&coro_done);
+  u64 coro_cycles = rdtime() - t0;
+  kfree(cos);
+
+  latch_init(&coro_gate, 1);
+  for (int i = 0; i < CORO_BENCH_N; i++) {
+    pids[i] = task_create(task_yielder, (void *)0, 10);
+  }
+  t0 = rdtime();
+  latch_count_down(&coro_gate);
+  for (int i = 0; i < CORO_BENCH_N; i++) {
+    task_join(pids[i], (int *)0);
+  }
+  u64 task_cycles = rdtime() - t0;
+
+  kprintf("Switch cost, %d x %d yields: task %u ns, coroutine %u ns\n",
+          CORO_BENCH_N, CORO_BENCH_YIELDS,
+          (u32)(task_cycles * ns_per_cycle / switches),
+          (u32)(coro_cycles * ns_per_cycle / switches));
+
+  // Scale: many coroutines asleep at the same time
+  size_t used = kmalloc_used();
+  int n = 0;
+  latch_init(&coro_done, CORO_BENCH_MANY);
+  for (; n < CORO_BENCH_MANY; n++) {
+    coro_bench_t *st = (coro_bench_t *)kmalloc(sizeof(coro_bench_t));
+    if (!st) {
+      break;
+    }
+    st->i = n;
+    coro_start(&st->co, coro_sleeper);
+  }
+  size_t peak = kmalloc_used() - used;
+  for (int i = n; i < CORO_BENCH_MANY; i++) {
+    latch_count_down(&coro_done);
+  }
+
+  u64 start = g_ticks;
+  latch_wait(&coro_done);
+  kprintf("%d coroutines sleeping at once: %u KB of heap (%u bytes each), "
+          "done in %u ticks\n",
+          n, (u32)(peak / 1024), n ? (u32)(peak / n) : 0,
+          (u32)(g_ticks - start));
+  kprintf("  as full tasks: %u KB, and at most %d tasks exist\n",
+          (u32)((u64)n * (sizeof(pcb_t) + STACK_SIZE) / 1024), MAX_TASKS);
+}
+
+#define ARENA_BENCH_N 4096
+
+static void *arena_ptrs[ARENA_BENCH_N];
+
+// Small request sizes, 16 to 256 bytes, the same sequence for both
+static size_t arena_bench_size(int i) { return 16 + (size_t)(i * 37) % 241; }
+
+static void cmd_bench_arena(void) {
+  u64 ns_per_cycle = 1000000000UL / TIMEBASE_HZ;
+  size_t req = 0;
+
+  for (int i = 0; i < ARENA_BENCH_N; i++) {
+    req += arena_bench_size(i);
+  }
+
+  // Heap use is measured as the drop in free bytes, so allocator headers
+  // count too.
+  // kmalloc: one header and one IRQ-off first-fit search per object, and
+  // one kfree each
+  size_t free0 = kmalloc_free();
+  u64 t0 = rdtime();
+  for (int i = 0; i < ARENA_BENCH_N; i++) {
+    arena_ptrs[i] = kmalloc(arena_bench_size(i));
+  }
+  u64 k_alloc = rdtime() - t0;
+  size_t k_heap = free0 - kmalloc_free();
+  t0 = rdtime();
+  for (int i = 0; i < ARENA_BENCH_N; i++) {
+    kfree(arena_ptrs[i]);
+  }
+  u64 k_free = rdtime() - t0;
+
+  // Arena: a pointer bump per object, a kmalloc per chunk, one reset
+  arena_mark_t mark = arena_mark();
+  free0 = kmalloc_free();
+  t0 = rdtime();
+  for (int i = 0; i < ARENA_BENCH_N; i++) {
+    arena_ptrs[i] = arena_alloc(arena_bench_size(i));
+  }
+  u64 a_alloc = rdtime() - t0;
+  size_t a_heap = free0 - kmalloc_free();
+  t0 = rdtime();
+  arena_reset(mark);
+  u64 a_free = rdtime() - t0;
+
+  kprintf("%d allocations of 16-256 bytes, %u bytes requested\n",
+          ARENA_BENCH_N, (u32)req);
+  kprintf("  kmalloc: %u ns/alloc, %u us to kfree all, %u bytes of heap\n",
+          (u32)(k_alloc * ns_per_cycle / ARENA_BENCH_N),
+          (u32)(k_free * ns_per_cycle / 1000), (u32)k_heap);
+  kprintf("  arena:   %u ns/alloc, %u us to reset, %u bytes of heap\n",
+          (u32)(a_alloc * ns_per_cycle / ARENA_BENCH_N),
+          (u32)(a_free * ns_per_cycle / 1000), (u32)a_heap);
+}
+
+#define STR_BENCH_MAX (64 * 1024)
+#define STR_BENCH_BYTES (1024 * 1024) // Bytes processed per measurement
+#define STR_BENCH_SIZES 5
+
+static const u32 str_sizes[STR_BENCH_SIZES] = {8, 64, 512, 4096, 65536};
+static volatile size_t str_sink;
+
+// The byte-at-a-time loops lib/string.c replaced. The attribute keeps GCC
+// from turning them into calls to the new routines.
+#define NO_LIBCALL __attribute__((optimize("no-tree-loop-distribute-patterns")))
+
+static NO_LIBCALL void legacy_memset(void *s, int c, size_t n) {
+  u8 *p = s;
+  while (n--)
+    *p++ = (u8)c;
+}
+
+static NO_LIBCALL void legacy_memcpy(void *dest, const void *src, size_t n) {
+  u8 *d = dest;
+  const u8 *s = src;
+  while (n--)
+    *d++ = *s++;
+}
+
+static NO_LIBCALL size_t legacy_strlen(const char *s) {
+  size_t len = 0;
+  while (*s++)
+    len++;
+  return len;
+}
+
+static NO_LIBCALL int legacy_strcmp(const char *s1, const char *s2) {
+  while (*s1 && (*s1 == *s2)) {
+    s1++;
+    s2++;
+  }
+  return *(unsigned char *)s1 - *(unsigned char *)s2;
+}
+
+// One routine over 'size' bytes until STR_BENCH_BYTES are done. 'a' and
+// 'b' hold strings of size - 1 characters. Returns MB/s.
+static u32 str_bench_rate(int fn, int legacy, u32 size, u8 *a, u8 *b) {
+  u32 reps = STR_BENCH_BYTES / size;
+  u64 t0 = rdtime();
+
+  switch (fn) {
+  case 0:
+    for (u32 r = 0; r < reps; r++) {
+      legacy ? legacy_memcpy(b, a, size) : (void)memcpy(b, a, size);
+    }
+    break;
+  case 1:
+    for (u32 r = 0; r < reps; r++) {
+      legacy ? legacy_memset(b, (int)r, size) : (void)memset(b, (int)r, size);
+    }
+    break;
+  case 2:
+    for (u32 r = 0; r < reps; r++) {
+      str_sink += legacy ? legacy_strlen((char *)a) : strlen((char *)a);
+    }
+    break;
+  default:
+    for (u32 r = 0; r < reps; r++) {
+      str_sink += legacy ? legacy_strcmp((char *)a, (char *)b)
+                         : strcmp((char *)a, (char *)b);
+    }
+    break;
+  }
+
+  u64 spent = rdtime() - t0;
+  return spent ? (u32)((u64)reps * size * TIMEBASE_HZ / spent / (1024 * 1024))
+               : 0;
+}
+
+static void cmd_bench_str(void) {
+  static const char *names[4] = {"memcpy", "memset", "strlen", "strcmp"};
+  int old_rvv = string_get_rvv();
+  int impls = string_has_rvv() ? 3 : 2;
+  u8 *a = (u8 *)kmalloc(STR_BENCH_MAX);
+  u8 *b = (u8 *)kmalloc(STR_BENCH_MAX);
+
+  if (!a || !b) {
+    kfree(a);
+    kfree(b);
+    kprintf("Error: out of memory\n");
+    return;
+  }
+
+  kprintf("MB/s by size; byte = old loops, word = 64-bit scalar%s\n",
+          impls == 3 ? ", rvv = vector" : " (no vector unit)");
+  for (int fn = 0; fn < 4; fn++) {
+    kprintf("%s\n", names[fn]);
+    for (int i = 0; i < STR_BENCH_SIZES; i++) {
+      u32 size = str_sizes[i];
+
+      // Equal strings of size - 1 characters, for strlen and strcmp
+      memset(a, 'a', size);
+      memset(b, 'a', size);
+      a[size - 1] = '\0';
+      b[size - 1] = '\0';
+
+      kprintf("  %u B:", size);
+      for (int impl = 0; impl < impls; impl++) {
+        if (impl > 0) {
+          string_set_rvv(impl == 2);
+        }
+        kprintf(" %s %u", impl == 0 ? "byte" : impl == 1 ? "word" : "rvv",
+                str_bench_rate(fn, impl == 0, size, a, b));
+      }
+      kprintf("\n");
+    }
+  }
+
+  string_set_rvv(old_rvv);
+  kfree(a);
+  kfree(b);
+}
+
+#define BLK_BENCH_BS (4 * 1024)                // Bytes per request
+#define BLK_BENCH_QD 16                        // Requests kept in flight
+#define BLK_BENCH_SEQ_BYTES (8 * 1024 * 1024)  // Per sequential pass
+#define BLK_BENCH_RAND_IOS 2048                // Per random pass
+
+static blk_req_t blk_bench_reqs[BLK_BENCH_QD];
+
+// n requests of BLK_BENCH_BS bytes, BLK_BENCH_QD of them in flight.
+// Sequential passes start at block 0 and wrap at the end of the disk.
+// Writes tag each block with its number in its first word, and 'verify'
+// counts reads that find a wrong tag in *bad. Returns rdtime cycles, or 0
+// after an I/O error.
+static u64 blk_bench_pass(u8 *bufs, u64 blocks, u32 n, int write, int random,
+                          int verify, u32 *bad) {
+  u32 spb = BLK_BENCH_BS / BLK_SECTOR_SIZE;
+  u32 seed = 12345;
+  u32 submitted = 0;
+  int err = 0;
+  u64 t0 = rdtime();
+
+  // Slot q is refilled with request i once request i - QD has completed
+  for (u32 i = 0; i < n + BLK_BENCH_QD; i++) {
+    u32 q = i % BLK_BENCH_QD;
+    blk_req_t *r = &blk_bench_reqs[q];
+    u64 *tag = (u64 *)(bufs + q * BLK_BENCH_BS);
+
+    if (i >= BLK_BENCH_QD && i - BLK_BENCH_QD < submitted) {
+      if (blk_wait(r) != BLK_OK) {
+        err = 1;
+      } else if (verify && *tag != r->sector / spb) {
+        (*bad)++;
+      }
+    }
+
+    if (i < n && !err) {
+      u64 block;
+      if (random) {
+        seed = seed * 1103515245 + 12345;
+        block = (seed >> 4) % blocks;
+      } else {
+        block = i % blocks;
+      }
+      if (write) {
+        *tag = block;
+      }
+      blk_req_init(r, write, block * spb, spb, tag);
+      if (blk_submit(r) < 0) {
+        err = 1;
+      } else {
+        submitted++;
+      }
+    }
+  }
+
+  u64 spent = rdtime() - t0;
+  return err ? 0 : (spent ? spent : 1);
+}
+
+static void cmd_bench_blk(void) {
+  static const struct {
+    const char *name;
+    int write;
+    int random;
+    int merge;
+  } passes[] = {
+      {"seq write ", 1, 0, 0}, {"seq write ", 1, 0, 1},
+      {"seq read  ", 0, 0, 0}, {"seq read  ", 0, 0, 1},
+      {"rand read ", 0, 1, 1}, {"rand write", 1, 1, 1},
+  };
+  u32 spb = BLK_BENCH_BS / BLK_SECTOR_SIZE;
+  blk_info_t info;
+
+  blk_info(&info);
+  if (!info.present) {
+    kprintf("No virtio-blk disk (make disk, then make run)\n");
+    return;
+  }
+  if (info.readonly) {
+    kprintf("Error: disk is read-only\n");
+    return;
+  }
+  u64 blocks = info.capacity / spb;
+  if (blocks < BLK_BENCH_QD) {
+    kprintf("Error: disk too small\n");
+    return;
+  }
+
+  u8 *bufs = (u8 *)kmalloc(BLK_BENCH_QD * BLK_BENCH_BS);
+  if (!bufs) {
+    kprintf("Error: out of memory\n");
+    return;
+  }
+
+  int old_merge = blk_get_merge();
+  kprintf("%u MB disk, %s transport, queue %u; %u x %u B requests in "
+          "flight; the disk is overwritten\n",
+          (u32)(info.capacity / 2048), info.legacy ? "legacy" : "virtio 1.x",
+          info.queue_size, BLK_BENCH_QD, BLK_BENCH_BS);
+
+  for (u32 p = 0; p < sizeof(passes) / sizeof(passes[0]); p++) {
+    u32 n = passes[p].random ? BLK_BENCH_RAND_IOS
+                             : BLK_BENCH_SEQ_BYTES / BLK_BENCH_BS;
+    u32 bad = 0;
+    blk_stats_t before, after;
+
+    blk_set_merge(passes[p].merge);
+    blk_stats(&before);
+    // Sequential reads check the tags the sequential writes left
+    u64 spent = blk_bench_pass(bufs, blocks, n, passes[p].write,
+                               passes[p].random,
+                               !passes[p].write && !passes[p].random, &bad);
+    blk_stats(&after);
+
+    if (!spent) {
+      kprintf("  %s: I/O error\n", passes[p].name);
+      break;
+    }
+    u64 dev_reqs = after.dev_reqs - before.dev_reqs;
+    u64 per10 = dev_reqs ? (after.submitted - before.submitted) * 10 / dev_reqs
+                         : 0;
+    kprintf("  %s merge %s: %u MB/s, %u IOPS, %u.%u requests per device "
+            "request, %u IRQs",
+            passes[p].name, passes[p].merge ? "on " : "off",
+            (u32)((u64)n * BLK_BENCH_BS * TIMEBASE_HZ / spent / (1024 * 1024)),
+            (u32)((u64)n * TIMEBASE_HZ / spent), (u32)(per10 / 10),
+            (u32)(per10 % 10), (u32)(after.irqs - before.irqs));
+    if (bad) {
+      kprintf(", %u bad blocks", bad);
+    }
+    kprintf("\n");
+  }
+
+  blk_set_merge(old_merge);
+  kfree(bufs);
+}
+
+#define BC_BENCH_SEQ_MAX 2048  // Blocks per sequential pass (8 MB)
+#define BC_BENCH_RAND_OPS 4096 // bread calls per random pass
+
+// n bread calls on 'dev'. Sequential passes walk blocks 0..span-1, random
+// ones pick blocks below 'span'. Writes tag each block with its number
+// and end with bcache_sync, so the write-back is timed too; 'verify'
+// counts blocks read with a wrong tag in *bad. Returns rdtime cycles, or
+// 0 if a block could not be read.
+static u64 bc_bench_pass(int dev, u64 span, u32 n, int write, int random,
+                         int verify, u32 *bad) {
+  u32 seed = 12345;
+  u64 t0 = rdtime();
+
+  for (u32 i = 0; i < n; i++) {
+    u64 block;
+    if (random) {
+      seed = seed * 1103515245 + 12345;
+      block = (seed >> 4) % span;
+    } else {
+      block = i % span;
+    }
+
+    buf_t *b = bread(dev, block);
+    if (!b) {
+      return 0;
+    }
+    u64 *tag = (u64 *)b->data;
+    if (write) {
+      *tag = block;
+      bdirty(b);
+    } else if (verify && *tag != block) {
+      (*bad)++;
+    }
+    brelse(b);
+  }
+  if (write) {
+    bcache_sync();
+  }
+
+  u64 spent = rdtime() - t0;
+  return spent ? spent : 1;
+}
+
+static void cmd_bench_bcache(const char *arg) {
+  static const struct {
+    const char *name;
+    int write;
+    int random;
+    int readahead;
+    int cold; // Start with nothing of the device cached
+    int hot;  // Random blocks from a set half the size of the cache
+  } passes[] = {
+      {"seq write       ", 1, 0, 1, 1, 0},
+      {"seq read  ra off", 0, 0, 0, 1, 0},
+      {"seq read  ra on ", 0, 0, 1, 1, 0},
+      {"rand read       ", 0, 1, 1, 0, 0},
+      {"rand read hot   ", 0, 1, 1, 0, 1},
+      {"rand write      ", 1, 1, 1, 0, 0},
+  };
+  int dev = arg[0] ? atoi(arg) : 0;
+  const blkdev_t *d = blkdev_get(dev);
+
+  if (!d) {
+    kprintf("No block device %d\n", dev);
+    return;
+  }
+
+  u64 blocks = d->capacity / (BCACHE_BLOCK_SIZE / BLK_SECTOR_SIZE);
+  u64 seq = blocks < BC_BENCH_SEQ_MAX ? blocks : BC_BENCH_SEQ_MAX;
+  int old_ra = bcache_get_readahead();
+  bcache_stats_t st;
+  bcache_stats(&st);
+
+  kprintf("%s: %u blocks of %u B, %u used, cache of %u; overwrites the "
+          "device\n",
+          d->name, (u32)blocks, BCACHE_BLOCK_SIZE, (u32)seq, st.bufs);
+
+  for (u32 p = 0; p < sizeof(passes) / sizeof(passes[0]); p++) {
+    u64 span = passes[p].hot ? st.bufs / 2 : seq;
+    u32 n = passes[p].random ? BC_BENCH_RAND_OPS : (u32)seq;
+    u32 bad = 0;
+    bcache_stats_t before, after;
+
+    if (passes[p].cold) {
+      bcache_invalidate(dev);
+    }
+    bcache_set_readahead(passes[p].readahead);
+    bcache_stats(&before);
+    // Sequential reads check the tags the sequential write left
+    u64 spent = bc_bench_pass(dev, span, n, passes[p].write, passes[p].random,
+                              !passes[p].write && !passes[p].random, &bad);
+    bcache_stats(&after);
+
+    if (!spent) {
+      kprintf("  %s: read error\n", passes[p].name);
+      break;
+    }
+    u64 lookups = after.lookups - before.lookups;
+    kprintf("  %s: %u MB/s, hit rate %u%%, %u read ahead, %u written back",
+            passes[p].name,
+            (u32)((u64)n * BCACHE_BLOCK_SIZE * TIMEBASE_HZ / spent /
+                  (1024 * 1024)),
+            (u32)(lookups ? (after.hits - before.hits) * 100 / lookups : 0),
+            (u32)(after.ra_blocks - before.ra_blocks),
+            (u32)(after.writebacks - before.writebacks));
+    if (bad) {
+      kprintf(", %u bad blocks", bad);
+    }
+    kprintf("\n");
+  }
+
+  bcache_set_readahead(old_ra);
+}
+
+static void cmd_bcache(const char *arg) {
+  if (strcmp(arg, "sync") == 0) {
+    bcache_sync();
+  } else if (strcmp(arg, "reset") == 0) {
+    bcache_reset_stats();
+  } else if (strcmp(arg, "ra on") == 0) {
+    bcache_set_readahead(1);
+  } else if (strcmp(arg, "ra off") == 0) {
+    bcache_set_readahead(0);
+  } else if (arg[0]) {
+    kprintf("Usage: bcache [sync|reset|ra on|ra off]\n");
+    return;
+  }
+
+  bcache_stats_t st;
+  bcache_stats(&st);
+
+  for (int dev = 0; blkdev_get(dev); dev++) {
+    const blkdev_t *d = blkdev_get(dev);
+    kprintf("dev %d: %s, %u KB\n", dev, d->name, (u32)(d->capacity / 2));
+  }
+  kprintf("buffers=%u  dirty=%u  in flight=%u  read-ahead=%s\n", st.bufs,
+          st.dirty, st.inflight, bcache_get_readahead() ? "ON" : "OFF");
+  kprintf("lookups=%u  hits=%u (%u%%)  misses=%u\n", (u32)st.lookups,
+          (u32)st.hits,
+          (u32)(st.lookups ? st.hits * 100 / st.lookups : 0),
+          (u32)st.misses);
+  kprintf("read ahead=%u (used %u)  evictions=%u  writebacks=%u  "
+          "flushes=%u\n",
+          (u32)st.ra_blocks, (u32)st.ra_hits, (u32)st.evictions,
+          (u32)st.writebacks, (u32)st.flushes);
 }
 
 void shell_run(void) {
@@ -505,24 +2466,80 @@ void shell_run(void) {
       cmd_help();
     } else if (strcmp(buf, "ps") == 0) {
       cmd_ps();
+    } else if (strcmp(buf, "ps -s") == 0) {
+      cmd_ps_stack();
     } else if (strcmp(buf, "run cpu") == 0) {
       cmd_run_cpu();
     } else if (strcmp(buf, "run io") == 0) {
       cmd_run_io();
+    } else if (strncmp(buf, "run rt ", 7) == 0) {
+      cmd_run_rt(buf + 7);
     } else if (strncmp(buf, "kill ", 5) == 0) {
       cmd_kill(buf + 5);
+    } else if (strncmp(buf, "nice ", 5) == 0) {
+      cmd_nice(buf + 5);
     } else if (strncmp(buf, "sched ", 6) == 0) {
       cmd_sched(buf + 6);
     } else if (strcmp(buf, "pcdemo") == 0) {
       cmd_pcdemo();
+    } else if (strcmp(buf, "pcdemo pi") == 0) {
+      cmd_pcdemo_pi();
     } else if (strcmp(buf, "bench") == 0) {
       cmd_bench();
+    } else if (strcmp(buf, "bench lat") == 0) {
+      cmd_bench_lat();
+    } else if (strcmp(buf, "bench fair") == 0) {
+      cmd_bench_fair();
+    } else if (strcmp(buf, "bench edf") == 0) {
+      cmd_bench_edf();
+    } else if (strcmp(buf, "bench spawn") == 0) {
+      cmd_bench_spawn();
+    } else if (strcmp(buf, "bench pick") == 0) {
+      cmd_bench_pick();
+    } else if (strcmp(buf, "bench idle") == 0) {
+      cmd_bench_idle();
+    } else if (strcmp(buf, "bench timer") == 0) {
+      cmd_bench_timer();
+    } else if (strcmp(buf, "bench sync") == 0) {
+      cmd_bench_sync();
+    } else if (strcmp(buf, "bench chan") == 0) {
+      cmd_bench_chan();
+    } else if (strcmp(buf, "bench coro") == 0) {
+      cmd_bench_coro();
+    } else if (strcmp(buf, "bench arena") == 0) {
+      cmd_bench_arena();
+    } else if (strcmp(buf, "bench str") == 0) {
+      cmd_bench_str();
+    } else if (strcmp(buf, "bench blk") == 0) {
+      cmd_bench_blk();
+    } else if (strncmp(buf, "bench bcache", 12) == 0 &&
+               (buf[12] == '\0' || buf[12] == ' ')) {
+      cmd_bench_bcache(buf[12] ? buf + 13 : buf + 12);
+    } else if (strncmp(buf, "replay", 6) == 0 &&
+               (buf[6] == '\0' || buf[6] == ' ')) {
+      cmd_replay(buf[6] ? buf + 7 : buf + 6);
+    } else if (strncmp(buf, "top", 3) == 0 &&
+               (buf[3] == '\0' || buf[3] == ' ')) {
+      cmd_top(buf[3] ? buf + 4 : buf + 3);
     } else if (strcmp(buf, "uptime") == 0) {
       cmd_uptime();
-    } else if (strcmp(buf, "meminfo") == 0) {
-      cmd_meminfo();
+    } else if (strncmp(buf, "meminfo", 7) == 0 &&
+               (buf[7] == '\0' || buf[7] == ' ')) {
+      cmd_meminfo(buf[7] ? buf + 8 : buf + 7);
+    } else if (strncmp(buf, "bcache", 6) == 0 &&
+               (buf[6] == '\0' || buf[6] == ' ')) {
+      cmd_bcache(buf[6] ? buf + 7 : buf + 6);
     } else if (strcmp(buf, "intstats") == 0) {
       cmd_intstats();
+    } else if (strncmp(buf, "softirq", 7) == 0 &&
+               (buf[7] == '\0' || buf[7] == ' ')) {
+      cmd_softirq(buf[7] ? buf + 8 : buf + 7);
+    } else if (strncmp(buf, "schedlat", 8) == 0 &&
+               (buf[8] == '\0' || buf[8] == ' ')) {
+      cmd_schedlat(buf[8] ? buf + 9 : buf + 8);
+    } else if (strncmp(buf, "irqsoff", 7) == 0 &&
+               (buf[7] == '\0' || buf[7] == ' ')) {
+      cmd_irqsoff(buf[7] ? buf + 8 : buf + 7);
     } else if (strncmp(buf, "sleep ", 6) == 0) {
       cmd_sleep(buf + 6);
     } else {
@@ -0,0 +1,153 @@
+#include "uros.h"
+
+// Deferred interrupt work
+//
+// Interrupt handlers keep their IRQ-off time short by queueing work_t
+// items instead of doing the work inline. Each hart has two lists:
+//  - softirq: drained on the way out of the trap handler, with interrupts
+//    re-enabled, before returning to the interrupted code
+//  - workqueue: drained by the hart's worker task, for work that may
+//    take long or has to run in task context
+// Both are lock-free stacks pushed with compare-and-swap, so a nested
+// interrupt can queue work while a list is being drained. The drainer
+// takes the whole list with one atomic swap and runs it oldest first.
+
+typedef struct {
+  work_t *softirq;
+  work_t *workq;
+  int in_softirq; // A drain is running further up this hart's stack
+} softirq_hart_t;
+
+static softirq_hart_t hart0;
+
+static softirq_hart_t *this_hart(void) { return &hart0; }
+
+static int defer_enabled = 1;
+
+// Instrumentation, in rdtime cycles
+static u64 trap_off_max = 0;   // Longest hard IRQ-off part of a trap
+static u64 softirq_max = 0;    // Longest softirq drain
+static u64 softirq_runs = 0;
+static u64 worker_runs = 0;
+
+void work_init(work_t *w, void (*fn)(void *), void *arg) {
+  w->next = (work_t *)0;
+  w->fn = fn;
+  w->arg = arg;
+  w->queued = 0;
+}
+
+// Returns 0 if the item was already queued
+static int work_push(work_t **head, work_t *w) {
+  if (__atomic_exchange_n(&w->queued, 1, __ATOMIC_ACQ_REL)) {
+    return 0;
+  }
+
+  work_t *old = __atomic_load_n(head, __ATOMIC_RELAXED);
+  do {
+    w->next = old;
+  } while (!__atomic_compare_exchange_n(head, &old, w, 1, __ATOMIC_RELEASE,
+                                        __ATOMIC_RELAXED));
+  return 1;
+}
+
+// Take everything queued on a list and run it in queueing order. An item
+// may queue itself again from its own handler.
+static void work_drain(work_t **head) {
+  work_t *list = __atomic_exchange_n(head, (work_t *)0, __ATOMIC_ACQUIRE);
+  work_t *fifo = (work_t *)0;
+
+  while (list) {
+    work_t *next = list->next;
+    list->next = fifo;
+    fifo = list;
+    list = next;
+  }
+
+  while (fifo) {
+    work_t *w = fifo;
+    fifo = w->next;
+    __atomic_store_n(&w->queued, 0, __ATOMIC_RELEASE);
+    w->fn(w->arg);
+  }
+}
+
+int softirq_raise(work_t *w) { return work_push(&this_hart()->softirq, w); }
+
+int work_queue(work_t *w) {
+  if (!work_push(&this_hart()->workq, w)) {
+    return 0;
+  }
+
+  irqflags_t flags = irq_save();
+  sched_kick_worker();
+  irq_restore(flags);
+  return 1;
+}
+
+// Called by the trap handler when the hard part of a trap is done, with
+// IRQs still off. 'entry' is rdtime() at trap entry.
+void softirq_exit(u64 entry) {
+  softirq_hart_t *hart = this_hart();
+  u64 start = rdtime();
+
+  if (start - entry > trap_off_max) {
+    trap_off_max = start - entry;
+  }
+  irqsoff_trap(entry);
+
+  // Nested trap: the outer drain picks up whatever was queued
+  if (hart->in_softirq || !hart->softirq) {
+    return;
+  }
+
+  // The trap's own IRQ-off time was accounted above, so this bypasses
+  // irq_save/irq_restore and their tracing
+  hart->in_softirq = 1;
+  __asm__ volatile("csrsi sstatus, 2" : : : "memory");
+  while (__atomic_load_n(&hart->softirq, __ATOMIC_ACQUIRE)) {
+    work_drain(&hart->softirq);
+  }
+  __asm__ volatile("csrci sstatus, 2" : : : "memory");
+  hart->in_softirq = 0;
+
+  u64 spent = rdtime() - start;
+  softirq_runs++;
+  if (spent > softirq_max) {
+    softirq_max = spent;
+  }
+}
+
+// Per-hart worker: drains the workqueue, then waits for the next kick
+void worker_task(void *arg) {
+  (void)arg;
+
+  while (1) {
+    if (this_hart()->workq) {
+      worker_runs++;
+      work_drain(&this_hart()->workq);
+    }
+    sched_worker_wait();
+  }
+}
+
+// With deferral off, interrupt handlers do their work inline as before
+void softirq_set_defer(int on) { defer_enabled = on ? 1 : 0; }
+
+int softirq_get_defer(void) { return defer_enabled; }
+
+void softirq_stats(softirq_stats_t *st) {
+  st->trap_off_max = trap_off_max;
+  st->softirq_max = softirq_max;
+  st->softirq_runs = softirq_runs;
+  st->worker_runs = worker_runs;
+}
+
+void softirq_reset_stats(void) {
+  irqflags_t flags = irq_save();
+  trap_off_max = 0;
+  softirq_max = 0;
+  softirq_runs = 0;
+  worker_runs = 0;
+  irq_restore(flags);
+}
@@ -1,41 +1,349 @@
 #include "uros.h"
 
-// Semaphore implementation with cooperative busy-wait
+// Synchronization primitives
+//
+// Semaphores and mutexes keep their state in a word updated with atomic
+// instructions (amoadd / lr.sc via the __atomic builtins), so the
+// uncontended paths never touch sstatus. Only a task that has to sleep,
+// or a release that finds sleepers, disables interrupts to use the wait
+// queue; wait queues, like the run queues, are protected that way.
+//
+// Mutexes support priority inheritance: a task that sleeps on a mutex
+// lends its scheduling priority to the owner, and on along the chain if
+// that owner is itself waiting for a mutex, so a low-priority holder is
+// not starved by tasks ranked between it and the waiter.
+//
+// Condition variables, barriers and latches are built on the same wait
+// queues and release every sleeper with one sched_wake_all, so a phase
+// change never needs a polling loop.
+//
+// Ticket spinlocks are for short sections that never sleep or yield: a
+// task spinning on one would wait for a holder that cannot run.
+
+// Take one unit if the count is positive
+static int sem_trydown(sem_t *s) {
+    int c = __atomic_load_n(&s->count, __ATOMIC_RELAXED);
+    while (c > 0) {
+        if (__atomic_compare_exchange_n(&s->count, &c, c - 1, 1,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
 void sem_init(sem_t *s, int count) {
     s->count = count;
+    wq_init(&s->wq);
 }
 
 void sem_wait(sem_t *s) {
-    // Cooperative busy-wait
-    while (s->count <= 0) {
-        // Yield to other tasks while waiting
-        sched_maybe_yield_safe();
-        task_yield();
+    if (sem_trydown(s)) {
+        return;
+    }
+
+    // Slow path: recheck with IRQs off so a post cannot slip in between
+    // the check and going to sleep
+    irqflags_t flags = irq_save();
+    while (!sem_trydown(s)) {
+        sched_block(&s->wq, flags);
     }
-    
-    // Critical section: decrement count
-    disable_irq();
-    s->count--;
-    enable_irq();
+    irq_restore(flags);
+}
+
+int sem_trywait(sem_t *s) {
+    return sem_trydown(s);
 }
 
 void sem_post(sem_t *s) {
-    // Critical section: increment count
-    disable_irq();
-    s->count++;
-    enable_irq();
+    __atomic_fetch_add(&s->count, 1, __ATOMIC_SEQ_CST);
+
+    if (__atomic_load_n(&s->wq.head, __ATOMIC_SEQ_CST)) {
+        irqflags_t flags = irq_save();
+        sched_wake_one(&s->wq);
+        irq_restore(flags);
+    }
 }
 
-// Mutex implementation (binary semaphore wrapper)
+static int pi_enabled = 1;
+
+// Mutexes: state 0 is unlocked, 1 locked, 2 locked with possible sleepers.
+// A task that had to wait takes the lock in state 2, so its unlock checks
+// the wait queue even if nobody else is left.
 void mutex_init(mutex_t *m) {
-    sem_init(&m->s, 1);  // Binary semaphore (0 or 1)
+    m->state = 0;
+    m->owner = (pcb_t *)0;
+    m->held_next = (mutex_t *)0;
+    wq_init(&m->wq);
+}
+
+// With PI off, mutexes still record their owner but lend no priority
+void mutex_set_pi(int on) {
+    pi_enabled = on ? 1 : 0;
+}
+
+int mutex_get_pi(void) {
+    return pi_enabled;
+}
+
+static void mutex_set_owner(mutex_t *m, pcb_t *self) {
+    m->owner = self;
+    if (self) {
+        m->held_next = self->pi_held;
+        self->pi_held = m;
+    }
+}
+
+static void mutex_clear_owner(mutex_t *m) {
+    pcb_t *self = m->owner;
+
+    m->owner = (pcb_t *)0;
+    if (!self) {
+        return;
+    }
+    for (mutex_t **pp = &self->pi_held; *pp; pp = &(*pp)->held_next) {
+        if (*pp == m) {
+            *pp = m->held_next;
+            break;
+        }
+    }
+    m->held_next = (mutex_t *)0;
+}
+
+// Recompute a task's priority from the best waiter on any mutex it holds,
+// then carry the change down the chain of owners it is waiting on.
+// Called with IRQs off.
+static void pi_update(pcb_t *task) {
+    for (int depth = 0; task && depth < PI_MAX_DEPTH; depth++) {
+        pcb_t *donor = (pcb_t *)0;
+
+        if (pi_enabled) {
+            for (mutex_t *m = task->pi_held; m; m = m->held_next) {
+                for (pcb_t *w = m->wq.head; w; w = w->wq_next) {
+                    if (!donor || sched_prio_higher(w, donor)) {
+                        donor = w;
+                    }
+                }
+            }
+        }
+        if (!donor && !task->pi_boosted) {
+            return;
+        }
+        sched_pi_set(task, donor);
+
+        task = task->pi_blocked_on ? task->pi_blocked_on->owner : (pcb_t *)0;
+    }
+}
+
+// 'donor' is about to sleep on a mutex 'owner' holds: lift the owner,
+// and the owners it waits for in turn, to at least the donor's priority.
+// Called with IRQs off.
+static void pi_boost(pcb_t *owner, pcb_t *donor) {
+    if (!pi_enabled) {
+        return;
+    }
+
+    for (int depth = 0; owner && depth < PI_MAX_DEPTH; depth++) {
+        if (!sched_prio_higher(donor, owner)) {
+            return;
+        }
+        sched_pi_set(owner, donor);
+        owner = owner->pi_blocked_on ? owner->pi_blocked_on->owner
+                                     : (pcb_t *)0;
+    }
+}
+
+// A task is being freed: mutexes it still holds stay locked, as they
+// always did, but must not point at its PCB. Called with IRQs off.
+void mutex_owner_gone(pcb_t *task) {
+    mutex_t *m = task->pi_held;
+
+    while (m) {
+        mutex_t *next = m->held_next;
+        m->owner = (pcb_t *)0;
+        m->held_next = (mutex_t *)0;
+        m = next;
+    }
+    task->pi_held = (mutex_t *)0;
+}
+
+int mutex_trylock(mutex_t *m) {
+    int expected = 0;
+    if (__atomic_compare_exchange_n(&m->state, &expected, 1, 0,
+                                    __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+        mutex_set_owner(m, sched_current());
+        return 1;
+    }
+    return 0;
 }
 
 void mutex_lock(mutex_t *m) {
-    sem_wait(&m->s);
+    if (mutex_trylock(m)) {
+        return;
+    }
+
+    irqflags_t flags = irq_save();
+    pcb_t *self = sched_current();
+    while (__atomic_exchange_n(&m->state, 2, __ATOMIC_ACQUIRE) != 0) {
+        if (self) {
+            self->pi_blocked_on = m;
+            pi_boost(m->owner, self);
+        }
+        sched_block(&m->wq, flags);
+    }
+    if (self) {
+        self->pi_blocked_on = (mutex_t *)0;
+    }
+    mutex_set_owner(m, self);
+
+    // Whoever is still waiting now waits on this task
+    if (m->wq.head) {
+        pi_update(self);
+    }
+    irq_restore(flags);
 }
 
 void mutex_unlock(mutex_t *m) {
-    sem_post(&m->s);
+    pcb_t *self = m->owner;
+    mutex_clear_owner(m);
+
+    if (__atomic_exchange_n(&m->state, 0, __ATOMIC_RELEASE) == 2) {
+        irqflags_t flags = irq_save();
+        sched_wake_one(&m->wq);
+        // Drop what this mutex's waiters lent, keep what others lend
+        if (self && self->pi_boosted) {
+            pi_update(self);
+        }
+        irq_restore(flags);
+    }
+}
+
+// Condition variables. Callers hold the mutex and recheck their
+// condition in a loop around cond_wait, as usual.
+void cond_init(cond_t *c) {
+    wq_init(&c->wq);
+}
+
+// Release the mutex and sleep, then take the mutex again. IRQs stay off
+// from the unlock until the task is queued, so a signal sent by the next
+// holder cannot be lost.
+void cond_wait(cond_t *c, mutex_t *m) {
+    irqflags_t flags = irq_save();
+    mutex_unlock(m);
+    sched_block(&c->wq, flags);
+    irq_restore(flags);
+
+    mutex_lock(m);
+}
+
+void cond_signal(cond_t *c) {
+    if (__atomic_load_n(&c->wq.head, __ATOMIC_SEQ_CST)) {
+        irqflags_t flags = irq_save();
+        sched_wake_one(&c->wq);
+        irq_restore(flags);
+    }
+}
+
+void cond_broadcast(cond_t *c) {
+    if (__atomic_load_n(&c->wq.head, __ATOMIC_SEQ_CST)) {
+        irqflags_t flags = irq_save();
+        sched_wake_all(&c->wq);
+        irq_restore(flags);
+    }
+}
+
+// Barriers: the last of 'count' tasks to arrive starts a new generation
+// and wakes the rest, so the barrier can be reused right away
+void barrier_init(barrier_t *b, int count) {
+    b->count = count > 0 ? count : 1;
+    b->arrived = 0;
+    b->generation = 0;
+    wq_init(&b->wq);
+}
+
+// Returns 1 in exactly one task per round, the one that completed it
+int barrier_wait(barrier_t *b) {
+    irqflags_t flags = irq_save();
+    u32 gen = b->generation;
+
+    if (++b->arrived == b->count) {
+        b->arrived = 0;
+        b->generation++;
+        sched_wake_all(&b->wq);
+        irq_restore(flags);
+        return 1;
+    }
+
+    while (b->generation == gen) {
+        sched_block(&b->wq, flags);
+    }
+    irq_restore(flags);
+    return 0;
+}
+
+// Countdown latches: one-shot, for waiting until N things have happened
+void latch_init(latch_t *l, int count) {
+    l->count = count;
+    wq_init(&l->wq);
 }
 
+void latch_count_down(latch_t *l) {
+    if (__atomic_sub_fetch(&l->count, 1, __ATOMIC_SEQ_CST) == 0) {
+        irqflags_t flags = irq_save();
+        sched_wake_all(&l->wq);
+        irq_restore(flags);
+    }
+}
+
+void latch_wait(latch_t *l) {
+    if (latch_done(l)) {
+        return;
+    }
+
+    irqflags_t flags = irq_save();
+    while (!latch_done(l)) {
+        sched_block(&l->wq, flags);
+    }
+    irq_restore(flags);
+}
+
+int latch_done(latch_t *l) {
+    return __atomic_load_n(&l->count, __ATOMIC_ACQUIRE) <= 0;
+}
+
+// Ticket spinlocks: each locker takes a ticket with amoadd and waits for
+// its turn, so waiters get the lock in arrival order
+void spin_init(spinlock_t *l) {
+    l->next = 0;
+    l->owner = 0;
+}
+
+void spin_lock(spinlock_t *l) {
+    u32 ticket = __atomic_fetch_add(&l->next, 1, __ATOMIC_RELAXED);
+    while (__atomic_load_n(&l->owner, __ATOMIC_ACQUIRE) != ticket) {
+        __asm__ volatile("" : : : "memory");
+    }
+}
+
+int spin_trylock(spinlock_t *l) {
+    u32 owner = __atomic_load_n(&l->owner, __ATOMIC_RELAXED);
+    u32 expected = owner;
+    return __atomic_compare_exchange_n(&l->next, &expected, owner + 1, 0,
+                                       __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+}
+
+void spin_unlock(spinlock_t *l) {
+    // Only the holder writes owner
+    __atomic_store_n(&l->owner, l->owner + 1, __ATOMIC_RELEASE);
+}
+
+irqflags_t spin_lock_irqsave(spinlock_t *l) {
+    irqflags_t flags = irq_save();
+    spin_lock(l);
+    return flags;
+}
+
+void spin_unlock_irqrestore(spinlock_t *l, irqflags_t flags) {
+    spin_unlock(l);
+    irq_restore(flags);
+}
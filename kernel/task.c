@@ -1,78 +1,156 @@
 #include "uros.h"
 
 // Task table
-static pcb_t tasks[MAX_TASKS];
-static int next_pid = 0;
+//
+// PCBs are allocated from the heap and indexed by slot. A PID is the slot
+// index with the slot's generation in the bits above PID_SLOT_BITS; the
+// generation is bumped every time a slot is freed, so a PID kept after its
+// task was reaped no longer matches and lookups fail instead of finding
+// whichever task reused the slot. Free slots are kept on a stack, making
+// both allocation and lookup O(1).
+static pcb_t *slots[MAX_TASKS];
+static u32 slot_gen[MAX_TASKS];
+static u16 free_slots[MAX_TASKS];
+static int free_top = 0;
+
+// Stacks are filled with STACK_PAINT when a task is created, so the first
+// word that no longer holds it marks the deepest the stack has been used.
+// The lowest word holds STACK_CANARY; the scheduler checks it every time
+// it switches away from a task.
+#define STACK_PAINT 0x5a5a5a5a5a5a5a5aUL
+#define STACK_CANARY 0x57ac4ca4a12d0c0dUL
+
+// Detached tasks that exited and are waiting for their stack to be freed,
+// linked through rq_next
+static pcb_t *dead_list = (pcb_t *)0;
 
 void task_init(void) {
-  // Initialize all tasks to ZOMBIE (free)
-  for (int i = 0; i < MAX_TASKS; i++) {
-    tasks[i].state = TASK_ZOMBIE;
-    tasks[i].pid = -1;
+  // Push in reverse so slot 0 (the idle task, PID 0) is handed out first
+  free_top = 0;
+  dead_list = (pcb_t *)0;
+  for (int i = MAX_TASKS - 1; i >= 0; i--) {
+    slots[i] = (pcb_t *)0;
+    slot_gen[i] = 0;
+    free_slots[free_top++] = (u16)i;
   }
-  next_pid = 0;
+}
+
+static int pid_make(int slot) {
+  return (int)((slot_gen[slot] << PID_SLOT_BITS) | (u32)slot);
+}
+
+// Return a PCB and its stack to the heap and put the slot back on the
+// free stack with a new generation. Called with IRQs off.
+static void task_free(pcb_t *task) {
+  int slot = PID_SLOT(task->pid);
+
+  kfree(task->stack_base);
+  kfree_aligned(task);
+
+  slots[slot] = (pcb_t *)0;
+  slot_gen[slot] = (slot_gen[slot] + 1) & PID_GEN_MASK;
+  free_slots[free_top++] = (u16)slot;
+}
+
+// Release everything an exited task still holds. Called with IRQs off.
+static void task_destroy(pcb_t *task) {
+  // A killed real-time task gives back its utilization here
+  edf_release(task);
+  mutex_owner_gone(task);
+  arena_release(&task->arena);
+  task_free(task);
 }
 
 // Task entry wrapper
 static void task_entry_wrapper(void) {
   pcb_t *current = sched_current();
 
+  // First run of this task: nothing returned through sched_switch yet.
+  // The switch here left interrupts on but its IRQ-off region open.
+  irq_restore(SSTATUS_SIE);
+  task_reap_dead();
+
   if (current && current->entry) {
     // Call the actual task function
     current->entry(current->arg);
   }
 
   // Task finished - exit
-  task_exit();
+  task_exit(0);
 }
 
-int task_create(void (*entry)(void *), void *arg, int burst_hint) {
-  disable_irq();
-
-  // Find free PID
-  int pid = -1;
-  for (int i = 0; i < MAX_TASKS; i++) {
-    if (tasks[i].state == TASK_ZOMBIE) {
-      pid = i;
-      break;
-    }
+// Allocate and paint a task stack with IRQs on; painting is O(stack
+// size) and has no business in an IRQ-off region. Rounds *stack_size to
+// what was allocated. Returns 0 if the size is unusable or memory is out.
+static u64 *task_stack_alloc(u32 *stack_size) {
+  u32 size = *stack_size;
+
+  if (size == 0) {
+    size = STACK_SIZE;
+  } else if (size < STACK_MIN) {
+    size = STACK_MIN;
+  } else if (size > ~15U) {
+    return (u64 *)0; // Would wrap when rounded up
   }
+  size = (size + 15) & ~15U;
 
-  if (pid == -1) {
-    enable_irq();
-    return -1; // No free slots
+  u64 *stack = (u64 *)kmalloc(size);
+  if (!stack) {
+    return (u64 *)0;
+  }
+  stack[0] = STACK_CANARY;
+  for (u32 i = 1; i < size / sizeof(u64); i++) {
+    stack[i] = STACK_PAINT;
   }
 
-  // Allocate stack (aligned to 16 bytes)
-  void *stack = kmalloc(STACK_SIZE);
-  if (!stack) {
-    enable_irq();
-    return -1;
+  *stack_size = size;
+  return stack;
+}
+
+// Take a slot and initialize a PCB around a stack from task_stack_alloc.
+// Called with IRQs off; the caller makes the task runnable, or frees the
+// stack if this fails.
+static pcb_t *task_alloc(void (*entry)(void *), void *arg, int burst_hint,
+                         u64 *stack, u32 stack_size) {
+  if (free_top == 0) {
+    return (pcb_t *)0; // No free slots
+  }
+
+  // Allocate the PCB on a cache line boundary so its hot block is one line
+  pcb_t *task = (pcb_t *)kmalloc_aligned(sizeof(pcb_t), CACHE_LINE_SIZE);
+  if (!task) {
+    return (pcb_t *)0;
   }
 
   // Initialize PCB
-  pcb_t *task = &tasks[pid];
+  int slot = free_slots[--free_top];
   memset(task, 0, sizeof(pcb_t));
+  slots[slot] = task;
+  wq_init(&task->joiners);
 
-  task->pid = pid;
+  task->pid = pid_make(slot);
   task->state = TASK_NEW;
   task->stack_base = stack;
+  task->stack_size = stack_size;
   task->entry = entry;
   task->arg = arg;
   task->burst_hint = burst_hint;
   task->burst_estimate = burst_hint;
+  task->burst_avg = (u64)burst_hint << BURST_FP_SHIFT;
   task->arrival_time = g_ticks;
   task->ticks_used = 0;
   task->start_time = 0;
   task->finish_time = 0;
   task->wait_time = 0;
+  mlfq_task_init(task);
+  fair_task_init(task);
 
   // Initialize context
   memset(&task->context, 0, sizeof(context_t));
 
   // Set up initial context
   // Stack grows down, align to 16 bytes
-  u64 stack_top = (u64)stack + STACK_SIZE;
+  u64 stack_top = (u64)stack + stack_size;
   stack_top &= ~15UL; // Align to 16 bytes
 
   task->context.x1 = (u64)task_entry_wrapper;   // ra used by ctx_switch->ret
@@ -84,27 +162,160 @@ int task_create(void (*entry)(void *), void *arg, int burst_hint) {
   // SPP=1 (S-mode return), SPIE=1 (Previous IE), SIE=1 (Enable interrupts
   // immediately) We set SIE=1 because ctx_switch restores sstatus directly via
   // csrw, not sret.
-  task->context.sstatus = 0x00000122;
+  // VS is on for every task when the CPU has a vector unit
+  task->context.sstatus = 0x00000122 | string_task_sstatus();
+
+  return task;
+}
+
+// Create this hart's idle task. It is never made ready: the scheduler
+// switches to it only when the run queue is empty.
+int task_create_idle(void) {
+  u32 stack_size = 0;
+  u64 *stack = task_stack_alloc(&stack_size);
+  if (!stack) {
+    return -1;
+  }
+
+  irqflags_t flags = irq_save();
+
+  pcb_t *task = task_alloc(idle_task, (void *)0, 0, stack, stack_size);
+  if (!task) {
+    irq_restore(flags);
+    kfree(stack);
+    return -1;
+  }
+
+  task->state = TASK_READY;
+  task->kthread = 1;
+  sched_set_idle(task);
+
+  irq_restore(flags);
+
+  return task->pid;
+}
+
+// Create this hart's worker for deferred work. Like idle it never enters a
+// run queue; it sleeps until the scheduler is kicked with work for it.
+int task_create_worker(void (*entry)(void *), void *arg) {
+  u32 stack_size = 0;
+  u64 *stack = task_stack_alloc(&stack_size);
+  if (!stack) {
+    return -1;
+  }
+
+  irqflags_t flags = irq_save();
+
+  pcb_t *task = task_alloc(entry, arg, 0, stack, stack_size);
+  if (!task) {
+    irq_restore(flags);
+    kfree(stack);
+    return -1;
+  }
+
+  task->state = TASK_READY;
+  task->kthread = 1;
+  sched_set_worker(task);
+  sched_kick_worker(); // Let it start up and park itself
+
+  irq_restore(flags);
+
+  return task->pid;
+}
+
+int task_create(void (*entry)(void *), void *arg, int burst_hint) {
+  return task_create_stack(entry, arg, burst_hint, 0);
+}
+
+// Same, with a stack of 'stack_size' bytes (0 for STACK_SIZE, at least
+// STACK_MIN). ps -s shows how much of it a task actually uses.
+int task_create_stack(void (*entry)(void *), void *arg, int burst_hint,
+                      u32 stack_size) {
+  u64 *stack = task_stack_alloc(&stack_size);
+  if (!stack) {
+    return -1;
+  }
+
+  irqflags_t flags = irq_save();
+
+  pcb_t *task = task_alloc(entry, arg, burst_hint, stack, stack_size);
+  if (!task) {
+    irq_restore(flags);
+    kfree(stack);
+    return -1;
+  }
 
   // Add to scheduler
   task->state = TASK_READY;
   sched_add_ready(task);
 
-  enable_irq();
+  irq_restore(flags);
 
-  return pid;
+  return task->pid;
 }
 
-void task_exit(void) {
-  disable_irq();
+// Create a periodic real-time task. Fails if admitting it would push the
+// total utilization (runtime / period) of real-time tasks above 1.
+int task_create_rt(void (*entry)(void *), void *arg, u32 runtime, u32 period,
+                   u32 deadline) {
+  u32 stack_size = 0;
+  u64 *stack = task_stack_alloc(&stack_size);
+  if (!stack) {
+    return -1;
+  }
+
+  irqflags_t flags = irq_save();
+
+  pcb_t *task = task_alloc(entry, arg, (int)runtime, stack, stack_size);
+  if (!task) {
+    irq_restore(flags);
+    kfree(stack);
+    return -1;
+  }
+
+  if (edf_admit(runtime, period, deadline) < 0) {
+    // Rejected: hand the slot, PCB and stack straight back
+    task_free(task);
+    irq_restore(flags);
+    return -1;
+  }
+  edf_task_init(task, runtime, period, deadline);
+
+  task->state = TASK_READY;
+  sched_add_ready(task);
+
+  irq_restore(flags);
+
+  return task->pid;
+}
 
+void task_exit(int status) {
   pcb_t *current = sched_current();
+
+  // Record the stack high-water mark before IRQs go off; the scan is
+  // O(stack size)
+  if (current) {
+    task_stack_used(current);
+  }
+
+  irqflags_t flags = irq_save();
+
   if (current) {
     current->state = TASK_ZOMBIE;
     current->finish_time = g_ticks;
+    current->exit_status = status;
+    edf_release(current);
+    arena_release(&current->arena);
+    sched_wake_all(&current->joiners);
+
+    // We are still running on this stack; the next task to run frees it
+    if (current->detached) {
+      current->rq_next = dead_list;
+      dead_list = current;
+    }
   }
 
-  enable_irq();
+  irq_restore(flags);
 
   // Yield to next task
   sched_yield();
@@ -116,51 +327,222 @@ void task_exit(void) {
 
 void task_yield(void) { sched_yield(); }
 
+void task_wait_period(void) { sched_wait_period(); }
+
+void task_sleep(u64 ticks) { sched_sleep(ticks); }
+
+// O(1): the slot comes straight from the PID, and a stale PID fails the
+// generation check
 pcb_t *task_get_by_pid(int pid) {
-  if (pid < 0 || pid >= MAX_TASKS) {
+  if (pid < 0) {
     return (pcb_t *)0;
   }
 
-  if (tasks[pid].state == TASK_ZOMBIE && tasks[pid].pid == -1) {
+  pcb_t *task = slots[PID_SLOT(pid)];
+  if (!task || task->pid != pid) {
     return (pcb_t *)0;
   }
 
-  return &tasks[pid];
+  return task;
 }
 
 void task_reap(int pid) {
-  if (pid < 0 || pid >= MAX_TASKS) {
+  // Don't kill idle task (PID 0)
+  if (pid == 0) {
     return;
   }
 
-  // Don't kill idle task (PID 0)
-  if (pid == 0) {
+  irqflags_t flags = irq_save();
+
+  // Detached tasks are freed by the reaper, never here
+  pcb_t *task = task_get_by_pid(pid);
+  if (task && task->state == TASK_ZOMBIE && !task->detached &&
+      task != sched_current()) {
+    task_destroy(task);
+  }
+
+  irq_restore(flags);
+}
+
+// Wait for a task to exit, then reap it. Returns 0 and its exit status,
+// or -1 if there is no such joinable task. If info is not NULL the exited
+// PCB is copied there before it is freed, for its accounting fields. When
+// several tasks join the same one, only the first gets the status.
+int task_waitpid(int pid, int *status, pcb_t *info) {
+  irqflags_t flags = irq_save();
+
+  pcb_t *self = sched_current();
+  pcb_t *task = task_get_by_pid(pid);
+
+  while (task && task != self && pid != 0 && !task->detached &&
+         task->state != TASK_ZOMBIE) {
+    self->joining = 1;
+    sched_block(&task->joiners, flags);
+    self->joining = 0;
+
+    // It may have been reaped by another joiner while we were waking up
+    task = task_get_by_pid(pid);
+  }
+
+  if (!task || task == self || pid == 0 || task->detached) {
+    irq_restore(flags);
+    return -1;
+  }
+
+  if (status) {
+    *status = task->exit_status;
+  }
+  if (info) {
+    memcpy(info, task, sizeof(pcb_t));
+  }
+  task_destroy(task);
+
+  irq_restore(flags);
+  return 0;
+}
+
+int task_join(int pid, int *status) {
+  return task_waitpid(pid, status, (pcb_t *)0);
+}
+
+// Nobody will join this task: free it as soon as it exits
+int task_detach(int pid) {
+  irqflags_t flags = irq_save();
+
+  pcb_t *task = task_get_by_pid(pid);
+  if (!task || pid == 0 || task->detached) {
+    irq_restore(flags);
+    return -1;
+  }
+
+  task->detached = 1;
+  if (task->state == TASK_ZOMBIE && task != sched_current()) {
+    task_destroy(task);
+  }
+
+  irq_restore(flags);
+  return 0;
+}
+
+// Free detached tasks that have exited. Runs right after a context
+// switch, so the stacks being freed are not the one in use.
+void task_reap_dead(void) {
+  if (!dead_list) {
     return;
   }
 
-  pcb_t *task = &tasks[pid];
-  if (task->state == TASK_ZOMBIE && task->stack_base) {
-    // Free the stack memory
-    kfree(task->stack_base);
-    task->stack_base = (void *)0;
+  irqflags_t flags = irq_save();
+  pcb_t *task = dead_list;
+  dead_list = (pcb_t *)0;
+
+  while (task) {
+    pcb_t *next = task->rq_next;
+    task_destroy(task);
+    task = next;
+  }
+
+  irq_restore(flags);
+}
 
-    // Mark as completely free
-    task->pid = -1;
-    task->state = TASK_ZOMBIE;
+// Terminate another task. It is freed right away unless tasks are
+// joining it, in which case they get status -1 and reap it. Refused
+// with -1 while it is blocked on anything but a join (semaphores,
+// mutexes, channels, disk I/O...): a join wait keeps nothing outside
+// the PCB, others may have stack nodes, requests, a busy buffer or
+// donated priority that only the task itself can take back.
+int task_kill(int pid) {
+  irqflags_t flags = irq_save();
+
+  pcb_t *task = task_get_by_pid(pid);
+  if (!task || task->kthread || task == sched_current() ||
+      (task->wq && !task->joining)) {
+    irq_restore(flags);
+    return -1;
   }
+
+  // Already exited: a detached one is queued for the reaper
+  if (task->state == TASK_ZOMBIE) {
+    if (!task->detached) {
+      task_destroy(task);
+    }
+    irq_restore(flags);
+    return 0;
+  }
+
+  // Take it off the run, sleep or wait queue before its PCB goes away
+  sched_remove(task);
+  task->state = TASK_ZOMBIE;
+  task->finish_time = g_ticks;
+  task->exit_status = -1;
+
+  // Joiners reap it themselves once they have its status
+  if (task->joiners.head && !task->detached) {
+    sched_wake_all(&task->joiners);
+  } else {
+    task_destroy(task);
+  }
+
+  irq_restore(flags);
+  return 0;
 }
 
-// Get task table for ps command
-pcb_t *task_get_table(void) { return tasks; }
+// Walk the task table for ps; empty slots return NULL
+pcb_t *task_get_slot(int slot) {
+  if (slot < 0 || slot >= MAX_TASKS) {
+    return (pcb_t *)0;
+  }
+  return slots[slot];
+}
 
-int task_get_max_tasks(void) { return MAX_TASKS; }
+int task_count(void) { return MAX_TASKS - free_top; }
 
 // Idle task - runs when no other tasks are ready
 void idle_task(void *arg) {
   (void)arg; // Unused parameter
 
   while (1) {
-    task_yield();
-    __asm__ volatile("wfi");
+    // Check with IRQs off so a wakeup between the check and wfi is not
+    // slept through; wfi still returns on a pending interrupt
+    irqflags_t flags = irq_save();
+    if (!need_resched) {
+      __asm__ volatile("wfi");
+      // Time spent waiting in wfi is not interrupt latency
+      irqsoff_restart();
+    }
+    irq_restore(flags);
+
+    sched_maybe_yield_safe();
+  }
+}
+
+// Bytes of the task's stack ever used: scan up from the bottom for the
+// first word that lost its paint. Also updates the recorded high-water mark.
+u32 task_stack_used(pcb_t *task) {
+  const u64 *stack = (const u64 *)task->stack_base;
+  u32 words = task->stack_size / sizeof(u64);
+  u32 i = 1;
+
+  while (i < words && stack[i] == STACK_PAINT) {
+    i++;
   }
+
+  u32 used = (words - i) * sizeof(u64);
+  if (used > task->stack_hwm) {
+    task->stack_hwm = used;
+  }
+  return task->stack_hwm;
+}
+
+// Called by the scheduler when switching away from 'task'. An overwritten
+// canary means the stack ran into the heap block below it; the heap can no
+// longer be trusted, so stop here like an unhandled trap does.
+void task_check_stack(pcb_t *task) {
+  if (*(const u64 *)task->stack_base == STACK_CANARY) {
+    return;
+  }
+
+  kprintf("!!! STACK OVERFLOW !!! pid=%d stack=%u bytes\n", task->pid,
+          task->stack_size);
+  while (1)
+    ;
 }
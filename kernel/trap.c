@@ -4,21 +4,67 @@
 volatile u64 g_ticks = 0;
 volatile int need_resched = 0;
 
+// Tick work deferred to softirq context
+static work_t tick_work;
+static work_t timer_work;
+static u64 ticks_pending = 0; // Ticks sched_on_tick has not seen yet
+
 static inline int is_s_timer_interrupt(u64 scause) {
   return (scause >> 63) && ((scause & 0xff) == 5);
 }
 
-void trap_handler_c(u64 scause, u64 sepc, u64 stval) {
-  (void)sepc;
-  (void)stval;
+static inline int is_s_external_interrupt(u64 scause) {
+  return (scause >> 63) && ((scause & 0xff) == 9);
+}
+
+// Scheduler bookkeeping for every tick since the last run. Runs with IRQs
+// on: a softirq only starts when the trap interrupted code with IRQs
+// enabled, so it never lands inside a run queue critical section.
+static void tick_softirq(void *arg) {
+  (void)arg;
+
+  u64 n = __atomic_exchange_n(&ticks_pending, 0, __ATOMIC_ACQ_REL);
+  while (n--) {
+    sched_on_tick();
+  }
+}
+
+static void timer_softirq(void *arg) {
+  (void)arg;
+  ktimer_run_expired();
+}
+
+// The hard part of a trap, with IRQs off. Returns rdtime() at entry for
+// softirq_exit's IRQ-off accounting.
+u64 trap_handler_c(u64 scause, u64 sepc, u64 stval) {
+  u64 entry = rdtime();
 
   if (is_s_timer_interrupt(scause)) {
     timer_schedule_next();
     g_ticks++;
 
-    sched_on_tick();
-    need_resched = 1;
-    return;
+    if (!softirq_get_defer()) {
+      // Legacy path: all tick work inline, timer callbacks in the worker
+      if (ktimer_tick(g_ticks)) {
+        work_queue(&timer_work);
+      }
+      sched_on_tick();
+      return entry;
+    }
+
+    // Only the O(1) wheel advance happens here; the rest runs on exit
+    __atomic_add_fetch(&ticks_pending, 1, __ATOMIC_RELEASE);
+    softirq_raise(&tick_work);
+    if (ktimer_tick(g_ticks)) {
+      softirq_raise(&timer_work);
+    }
+    return entry;
+  }
+
+  // Device interrupts; drivers defer their own work
+  if (is_s_external_interrupt(scause)) {
+    plic_handle();
+    return entry;
   }
 
   // Unhandled trap
@@ -28,11 +74,14 @@ void trap_handler_c(u64 scause, u64 sepc, u64 stval) {
     ;
 }
 
-// Minimal assembly wrapper
+// Assembly wrapper. sepc and sstatus are saved in the frame because
+// softirq_exit re-enables interrupts, and a nested trap overwrites both.
+// sstatus.VS is cleared for the trap and comes back with the saved sstatus,
+// so string routines called from a trap take their scalar path.
 __asm__(".align 4\n"
         ".global trap_handler\n"
         "trap_handler:\n"
-        "addi sp, sp, -128\n"
+        "addi sp, sp, -144\n"
         "sd ra, 0(sp)\n"
         "sd a0, 8(sp)\n"
         "sd a1, 16(sp)\n"
@@ -49,12 +98,24 @@ __asm__(".align 4\n"
         "sd t4, 104(sp)\n"
         "sd t5, 112(sp)\n"
         "sd t6, 120(sp)\n"
+        "csrr t0, sepc\n"
+        "sd t0, 128(sp)\n"
+        "csrr t0, sstatus\n"
+        "sd t0, 136(sp)\n"
+        // Vector unit off until sret: the task's vector state stays intact
+        "li t0, 0x600\n"
+        "csrc sstatus, t0\n"
 
         "csrr a0, scause\n"
         "csrr a1, sepc\n"
         "csrr a2, stval\n"
         "call trap_handler_c\n"
+        "call softirq_exit\n"
 
+        "ld t0, 128(sp)\n"
+        "csrw sepc, t0\n"
+        "ld t0, 136(sp)\n"
+        "csrw sstatus, t0\n"
         "ld t6, 120(sp)\n"
         "ld t5, 112(sp)\n"
         "ld t4, 104(sp)\n"
@@ -71,13 +132,16 @@ __asm__(".align 4\n"
         "ld a1, 16(sp)\n"
         "ld a0, 8(sp)\n"
         "ld ra, 0(sp)\n"
-        "addi sp, sp, 128\n"
+        "addi sp, sp, 144\n"
         "sret\n");
 
 void trap_init(void) {
   extern void trap_handler(void);
   u64 handler_addr = (u64)trap_handler;
 
+  work_init(&tick_work, tick_softirq, (void *)0);
+  work_init(&timer_work, timer_softirq, (void *)0);
+
   // Set stvec (direct mode)
   __asm__ volatile("csrw stvec, %0" ::"r"(handler_addr));
 
@@ -92,46 +92,6 @@ void kprintf(const char *fmt, ...) {
 }
 
 // Utility functions
-void *memset(void *s, int c, size_t n) {
-    u8 *p = s;
-    while (n--)
-        *p++ = (u8)c;
-    return s;
-}
-
-void *memcpy(void *dest, const void *src, size_t n) {
-    u8 *d = dest;
-    const u8 *s = src;
-    while (n--)
-        *d++ = *s++;
-    return dest;
-}
-
-int strcmp(const char *s1, const char *s2) {
-    while (*s1 && (*s1 == *s2)) {
-        s1++;
-        s2++;
-    }
-    return *(unsigned char *)s1 - *(unsigned char *)s2;
-}
-
-int strncmp(const char *s1, const char *s2, size_t n) {
-    while (n && *s1 && (*s1 == *s2)) {
-        s1++;
-        s2++;
-        n--;
-    }
-    if (n == 0) return 0;
-    return *(unsigned char *)s1 - *(unsigned char *)s2;
-}
-
-size_t strlen(const char *s) {
-    size_t len = 0;
-    while (*s++)
-        len++;
-    return len;
-}
-
 int atoi(const char *s) {
     int result = 0;
     int sign = 1;
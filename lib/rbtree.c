@@ -0,0 +1,264 @@
+#include "uros.h"
+
+// Intrusive red-black tree
+//
+// Nodes are embedded in the objects they order; the caller supplies the
+// ordering at insert time. The leftmost node is cached so the minimum is
+// available in O(1); insert and erase are O(log n).
+
+#define RB_RED 0
+#define RB_BLACK 1
+
+static void rb_rotate_left(rb_root_t *root, rb_node_t *x) {
+  rb_node_t *y = x->right;
+
+  x->right = y->left;
+  if (y->left) {
+    y->left->parent = x;
+  }
+  y->parent = x->parent;
+  if (!x->parent) {
+    root->root = y;
+  } else if (x == x->parent->left) {
+    x->parent->left = y;
+  } else {
+    x->parent->right = y;
+  }
+  y->left = x;
+  x->parent = y;
+}
+
+static void rb_rotate_right(rb_root_t *root, rb_node_t *x) {
+  rb_node_t *y = x->left;
+
+  x->left = y->right;
+  if (y->right) {
+    y->right->parent = x;
+  }
+  y->parent = x->parent;
+  if (!x->parent) {
+    root->root = y;
+  } else if (x == x->parent->right) {
+    x->parent->right = y;
+  } else {
+    x->parent->left = y;
+  }
+  y->right = x;
+  x->parent = y;
+}
+
+void rb_init(rb_root_t *root) {
+  root->root = (rb_node_t *)0;
+  root->leftmost = (rb_node_t *)0;
+}
+
+void rb_insert(rb_root_t *root, rb_node_t *node,
+               int (*less)(const rb_node_t *, const rb_node_t *)) {
+  rb_node_t *parent = (rb_node_t *)0;
+  rb_node_t **link = &root->root;
+  int leftmost = 1;
+
+  // Equal keys go to the right so they are visited in insertion order
+  while (*link) {
+    parent = *link;
+    if (less(node, parent)) {
+      link = &parent->left;
+    } else {
+      link = &parent->right;
+      leftmost = 0;
+    }
+  }
+
+  node->parent = parent;
+  node->left = (rb_node_t *)0;
+  node->right = (rb_node_t *)0;
+  node->color = RB_RED;
+  *link = node;
+
+  if (leftmost) {
+    root->leftmost = node;
+  }
+
+  // Restore the red-black properties
+  while (node != root->root && node->parent->color == RB_RED) {
+    rb_node_t *p = node->parent;
+    rb_node_t *g = p->parent;
+
+    if (p == g->left) {
+      rb_node_t *uncle = g->right;
+      if (uncle && uncle->color == RB_RED) {
+        p->color = RB_BLACK;
+        uncle->color = RB_BLACK;
+        g->color = RB_RED;
+        node = g;
+      } else {
+        if (node == p->right) {
+          node = p;
+          rb_rotate_left(root, node);
+          p = node->parent;
+        }
+        p->color = RB_BLACK;
+        g->color = RB_RED;
+        rb_rotate_right(root, g);
+      }
+    } else {
+      rb_node_t *uncle = g->left;
+      if (uncle && uncle->color == RB_RED) {
+        p->color = RB_BLACK;
+        uncle->color = RB_BLACK;
+        g->color = RB_RED;
+        node = g;
+      } else {
+        if (node == p->left) {
+          node = p;
+          rb_rotate_right(root, node);
+          p = node->parent;
+        }
+        p->color = RB_BLACK;
+        g->color = RB_RED;
+        rb_rotate_left(root, g);
+      }
+    }
+  }
+  root->root->color = RB_BLACK;
+}
+
+rb_node_t *rb_next(rb_node_t *node) {
+  if (node->right) {
+    node = node->right;
+    while (node->left) {
+      node = node->left;
+    }
+    return node;
+  }
+
+  rb_node_t *parent = node->parent;
+  while (parent && node == parent->right) {
+    node = parent;
+    parent = parent->parent;
+  }
+  return parent;
+}
+
+// Put subtree v in the place of subtree u
+static void rb_transplant(rb_root_t *root, rb_node_t *u, rb_node_t *v) {
+  if (!u->parent) {
+    root->root = v;
+  } else if (u == u->parent->left) {
+    u->parent->left = v;
+  } else {
+    u->parent->right = v;
+  }
+  if (v) {
+    v->parent = u->parent;
+  }
+}
+
+void rb_erase(rb_root_t *root, rb_node_t *node) {
+  if (root->leftmost == node) {
+    root->leftmost = rb_next(node);
+  }
+
+  rb_node_t *x;        // Node that moves into the removed position
+  rb_node_t *x_parent; // Its parent (x may be NULL)
+  int removed_color = node->color;
+
+  if (!node->left) {
+    x = node->right;
+    x_parent = node->parent;
+    rb_transplant(root, node, node->right);
+  } else if (!node->right) {
+    x = node->left;
+    x_parent = node->parent;
+    rb_transplant(root, node, node->left);
+  } else {
+    // Two children: splice in the in-order successor
+    rb_node_t *y = node->right;
+    while (y->left) {
+      y = y->left;
+    }
+    removed_color = y->color;
+    x = y->right;
+
+    if (y->parent == node) {
+      x_parent = y;
+    } else {
+      x_parent = y->parent;
+      rb_transplant(root, y, y->right);
+      y->right = node->right;
+      y->right->parent = y;
+    }
+    rb_transplant(root, node, y);
+    y->left = node->left;
+    y->left->parent = y;
+    y->color = node->color;
+  }
+
+  if (removed_color != RB_BLACK) {
+    return;
+  }
+
+  // Removing a black node left one path short; fix it up
+  while (x != root->root && (!x || x->color == RB_BLACK)) {
+    if (x == x_parent->left) {
+      rb_node_t *w = x_parent->right;
+      if (w->color == RB_RED) {
+        w->color = RB_BLACK;
+        x_parent->color = RB_RED;
+        rb_rotate_left(root, x_parent);
+        w = x_parent->right;
+      }
+      if ((!w->left || w->left->color == RB_BLACK) &&
+          (!w->right || w->right->color == RB_BLACK)) {
+        w->color = RB_RED;
+        x = x_parent;
+        x_parent = x->parent;
+      } else {
+        if (!w->right || w->right->color == RB_BLACK) {
+          w->left->color = RB_BLACK;
+          w->color = RB_RED;
+          rb_rotate_right(root, w);
+          w = x_parent->right;
+        }
+        w->color = x_parent->color;
+        x_parent->color = RB_BLACK;
+        if (w->right) {
+          w->right->color = RB_BLACK;
+        }
+        rb_rotate_left(root, x_parent);
+        x = root->root;
+      }
+    } else {
+      rb_node_t *w = x_parent->left;
+      if (w->color == RB_RED) {
+        w->color = RB_BLACK;
+        x_parent->color = RB_RED;
+        rb_rotate_right(root, x_parent);
+        w = x_parent->left;
+      }
+      if ((!w->right || w->right->color == RB_BLACK) &&
+          (!w->left || w->left->color == RB_BLACK)) {
+        w->color = RB_RED;
+        x = x_parent;
+        x_parent = x->parent;
+      } else {
+        if (!w->left || w->left->color == RB_BLACK) {
+          w->right->color = RB_BLACK;
+          w->color = RB_RED;
+          rb_rotate_left(root, w);
+          w = x_parent->left;
+        }
+        w->color = x_parent->color;
+        x_parent->color = RB_BLACK;
+        if (w->left) {
+          w->left->color = RB_BLACK;
+        }
+        rb_rotate_right(root, x_parent);
+        x = root->root;
+      }
+    }
+  }
+  if (x) {
+    x->color = RB_BLACK;
+  }
+}
@@ -0,0 +1,235 @@
+#include "uros.h"
+
+// Memory and string routines
+//
+// The scalar versions work a 64-bit aligned word at a time: a byte loop up
+// to the first aligned address, an unrolled loop of four words, then the
+// remaining words and bytes. memcpy between buffers of different alignment
+// reads aligned source words and shifts them into place, since misaligned
+// loads may trap to firmware. strlen and strcmp find a zero byte in a word
+// with the usual (w - 0x01..) & ~w & 0x80.. test; an aligned word never
+// crosses into memory the string does not reach.
+//
+// When the DTB reports the V extension, string_init() turns the vector
+// unit on and large copies and fills, and all strlen/strcmp calls, go to
+// the RVV loops in string_rvv.S. Trap entry switches the vector unit off
+// (sstatus.VS) until sret, so code running in a trap falls back to the
+// scalar path and cannot clobber the vector registers of the task it
+// interrupted. Tasks only switch at calls, where vector state is dead, so
+// it is never saved.
+//
+// Built with -fno-tree-loop-distribute-patterns so the compiler does not
+// turn these loops back into calls to themselves.
+
+#define ONES  0x0101010101010101UL
+#define HIGHS 0x8080808080808080UL
+#define HAS_ZERO(w) (((w) - ONES) & ~(w) & HIGHS)
+
+// Below this a vector loop does not pay for its setup
+#define RVV_MIN 64
+
+void *memset_rvv(void *s, int c, size_t n);
+void *memcpy_rvv(void *dest, const void *src, size_t n);
+size_t strlen_rvv(const char *s);
+int strcmp_rvv(const char *s1, const char *s2);
+
+static int rvv_present = 0;
+static int rvv_enabled = 0;
+
+// The vector unit is on in this context: a task, not a trap
+static inline int rvv_usable(void) {
+    if (!rvv_enabled) {
+        return 0;
+    }
+    u64 sstatus;
+    __asm__ volatile("csrr %0, sstatus" : "=r"(sstatus));
+    return (sstatus & SSTATUS_VS) != 0;
+}
+
+void string_init(int has_rvv) {
+    rvv_present = has_rvv;
+    rvv_enabled = has_rvv;
+    if (has_rvv) {
+        __asm__ volatile("csrs sstatus, %0" : : "r"(SSTATUS_VS_INITIAL));
+    }
+}
+
+// sstatus bits every new task starts with
+u64 string_task_sstatus(void) {
+    return rvv_present ? SSTATUS_VS_INITIAL : 0;
+}
+
+int string_has_rvv(void) {
+    return rvv_present;
+}
+
+// Returns -1 if the CPU has no vector unit
+int string_set_rvv(int on) {
+    if (on && !rvv_present) {
+        return -1;
+    }
+    rvv_enabled = on ? 1 : 0;
+    return 0;
+}
+
+int string_get_rvv(void) {
+    return rvv_enabled;
+}
+
+void *memset(void *s, int c, size_t n) {
+    u8 *p = s;
+
+    if (n >= RVV_MIN && rvv_usable()) {
+        return memset_rvv(s, c, n);
+    }
+
+    if (n >= 16) {
+        u64 w = (u8)c * ONES;
+
+        while ((u64)p & 7) {
+            *p++ = (u8)c;
+            n--;
+        }
+        u64 *q = (u64 *)p;
+        while (n >= 32) {
+            q[0] = w;
+            q[1] = w;
+            q[2] = w;
+            q[3] = w;
+            q += 4;
+            n -= 32;
+        }
+        while (n >= 8) {
+            *q++ = w;
+            n -= 8;
+        }
+        p = (u8 *)q;
+    }
+
+    while (n--) {
+        *p++ = (u8)c;
+    }
+    return s;
+}
+
+void *memcpy(void *dest, const void *src, size_t n) {
+    u8 *d = dest;
+    const u8 *s = src;
+
+    if (n >= RVV_MIN && rvv_usable()) {
+        return memcpy_rvv(dest, src, n);
+    }
+
+    if (n >= 16) {
+        while ((u64)d & 7) {
+            *d++ = *s++;
+            n--;
+        }
+
+        u64 *dw = (u64 *)d;
+        u32 off = (u64)s & 7;
+        if (off == 0) {
+            const u64 *sw = (const u64 *)s;
+            while (n >= 32) {
+                u64 a = sw[0], b = sw[1], c = sw[2], e = sw[3];
+                dw[0] = a;
+                dw[1] = b;
+                dw[2] = c;
+                dw[3] = e;
+                sw += 4;
+                dw += 4;
+                n -= 32;
+            }
+            while (n >= 8) {
+                *dw++ = *sw++;
+                n -= 8;
+            }
+            s = (const u8 *)sw;
+        } else {
+            // Source is off by 'off' bytes: merge neighbouring aligned words
+            u32 shift = off * 8;
+            const u64 *sw = (const u64 *)(s - off);
+            u64 lo = *sw++;
+            while (n >= 8) {
+                u64 hi = *sw++;
+                *dw++ = (lo >> shift) | (hi << (64 - shift));
+                lo = hi;
+                s += 8;
+                n -= 8;
+            }
+        }
+        d = (u8 *)dw;
+    }
+
+    while (n--) {
+        *d++ = *s++;
+    }
+    return dest;
+}
+
+size_t strlen(const char *s) {
+    const char *p = s;
+
+    if (rvv_usable()) {
+        return strlen_rvv(s);
+    }
+
+    while ((u64)p & 7) {
+        if (!*p) {
+            return p - s;
+        }
+        p++;
+    }
+
+    const u64 *w = (const u64 *)p;
+    while (!HAS_ZERO(*w)) {
+        w++;
+    }
+    p = (const char *)w;
+    while (*p) {
+        p++;
+    }
+    return p - s;
+}
+
+int strcmp(const char *s1, const char *s2) {
+    if (rvv_usable()) {
+        return strcmp_rvv(s1, s2);
+    }
+
+    // Word compare only when both strings can be aligned together
+    if ((((u64)s1 ^ (u64)s2) & 7) == 0) {
+        while ((u64)s1 & 7) {
+            if (!*s1 || *s1 != *s2) {
+                return *(unsigned char *)s1 - *(unsigned char *)s2;
+            }
+            s1++;
+            s2++;
+        }
+
+        const u64 *w1 = (const u64 *)s1;
+        const u64 *w2 = (const u64 *)s2;
+        while (*w1 == *w2 && !HAS_ZERO(*w1)) {
+            w1++;
+            w2++;
+        }
+        s1 = (const char *)w1;
+        s2 = (const char *)w2;
+    }
+
+    while (*s1 && (*s1 == *s2)) {
+        s1++;
+        s2++;
+    }
+    return *(unsigned char *)s1 - *(unsigned char *)s2;
+}
+
+int strncmp(const char *s1, const char *s2, size_t n) {
+    while (n && *s1 && (*s1 == *s2)) {
+        s1++;
+        s2++;
+        n--;
+    }
+    if (n == 0) return 0;
+    return *(unsigned char *)s1 - *(unsigned char *)s2;
+}
@@ -0,0 +1,63 @@
+#!/usr/bin/env python3
+"""Convert a text workload trace into the binary format used by `replay`.
+
+Text format (one task per line, '#' starts a comment):
+
+    <arrival_tick> <cpu>/<io> <cpu>/<io> ...
+
+Each <cpu>/<io> pair is a CPU burst followed by an I/O wait, both in ticks.
+The I/O wait after the last burst is normally 0.
+
+Binary format (little-endian, see kernel/replay.c):
+
+    header:  u32 magic 'UTRC', u8 version, u8 reserved, u16 ntasks
+    task:    u32 arrival_tick, u16 nbursts, u16 reserved
+    burst:   u16 cpu_ticks, u16 io_ticks        (nbursts times)
+"""
+import struct
+import sys
+
+TRACE_MAGIC = 0x43525455  # "UTRC"
+TRACE_VERSION = 1
+
+
+def parse(path):
+    tasks = []
+    with open(path) as f:
+        for lineno, line in enumerate(f, 1):
+            line = line.split('#', 1)[0].split()
+            if not line:
+                continue
+            arrival = int(line[0])
+            bursts = []
+            for pair in line[1:]:
+                cpu, _, io = pair.partition('/')
+                bursts.append((int(cpu), int(io or 0)))
+            if not bursts:
+                sys.exit(f"{path}:{lineno}: task has no bursts")
+            tasks.append((arrival, bursts))
+    # The replay driver spawns tasks in table order, so sort them by
+    # arrival time; the sort is stable, so ties keep their file order
+    tasks.sort(key=lambda t: t[0])
+    return tasks
+
+
+def main():
+    if len(sys.argv) != 3:
+        sys.exit(f"usage: {sys.argv[0]} <trace.txt> <trace.trc>")
+
+    tasks = parse(sys.argv[1])
+    out = bytearray(struct.pack('<IBBH', TRACE_MAGIC, TRACE_VERSION, 0,
+                                len(tasks)))
+    for arrival, bursts in tasks:
+        out += struct.pack('<IHH', arrival, len(bursts), 0)
+        for cpu, io in bursts:
+            out += struct.pack('<HH', cpu, io)
+
+    with open(sys.argv[2], 'wb') as f:
+        f.write(out)
+    print(f"{sys.argv[2]}: {len(tasks)} tasks, {len(out)} bytes")
+
+
+if __name__ == '__main__':
+    main()
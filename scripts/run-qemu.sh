@@ -9,6 +9,18 @@ QEMU_CMD="qemu-system-riscv64 \
   -monitor none \
   -kernel build/kernel.elf"
 
+# RVV=1: give the CPU a vector unit, picked up from the DTB at boot
+if [ "${RVV:-0}" = "1" ]; then
+  QEMU_CMD="$QEMU_CMD -cpu rv64,v=true,vlen=128"
+fi
+
+# Attach a raw disk image as virtio-blk if there is one (make disk)
+DISK="${DISK:-build/disk.img}"
+if [ -f "$DISK" ]; then
+  QEMU_CMD="$QEMU_CMD -drive file=$DISK,if=none,format=raw,id=hd0 \
+  -device virtio-blk-device,drive=hd0,bus=virtio-mmio-bus.0"
+fi
+
 if [ "${1:-}" = "gdb" ]; then
   echo "Starting QEMU in GDB mode on :1234 ..."
   exec $QEMU_CMD -S -s